@@ -12,10 +12,28 @@ static struct sockaddr_in g_server_addr;
 static int g_running = 1;
 static SharedMemory *g_shm = NULL;
 static int g_shmid = -1;
-static int g_semid = -1;
 static int g_connected_to_server = 0;
-static char g_list_buffer[MAX_MESSAGE * 4];
-static int g_list_received = 0;
+static int g_local = 0;            // Serveur joint par les anneaux locaux (option -l)
+
+// Réassemblage d'une liste reçue en morceaux (voir list_fetch)
+static pthread_mutex_t g_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static MessageType g_list_type;    // Réponse attendue (0 : aucune)
+static char *g_list_buffer = NULL;
+static size_t g_list_len = 0;
+static size_t g_list_capacity = 0;
+static int g_list_cursor = 0;      // Emplacement où reprendre la liste
+static int g_list_chunks = 0;      // Morceaux acceptés depuis le début
+static int g_list_page_end = 0;    // Dernier morceau de la page reçu
+static int g_list_done = 0;
+
+// Réplique de l'annuaire (option -s, voir directory.c) : /users et /groups
+// y sont lus sans requête tant qu'aucun changement ne manque
+static int g_subscribe = 0;
+static pthread_mutex_t g_directory_lock = PTHREAD_MUTEX_INITIALIZER;
+static Directory g_directory;
+static int g_directory_lost = 0;        // Attente débordée pendant un rechargement
+static int g_directory_base_received = 0;
+static uint32_t g_directory_base = 0;   // Version renvoyée par MSG_SUBSCRIBE
 
 void cleanup_and_exit(int signum) {
     printf("\n\nDéconnexion...\n");
@@ -26,6 +44,15 @@ void cleanup_and_exit(int signum) {
         message_create(&msg, MSG_DISCONNECT, g_username, NULL, NULL, "");
         socket_send(g_sockfd, &msg, &g_server_addr);
     }
+
+    // Rendre l'emplacement local une fois la déconnexion lue par le serveur
+    if (g_local) {
+        ring_release();
+    }
+
+    // Attendre l'acquittement des derniers envois fiables (le thread de
+    // réception tourne encore)
+    reliable_stop(RELIABLE_DRAIN_MS);
     
     g_running = 0;
     
@@ -41,14 +68,245 @@ void cleanup_and_exit(int signum) {
     exit(0);
 }
 
+// Ajoute un morceau de liste "<numéro> <début> <suite>|entrées" s'il
+// reprend exactement là où la liste en est ; les autres (doublons, restes
+// d'une page redemandée) sont ignorés
+static void list_receive_chunk(const Message *msg) {
+    int number, start, entries_offset = 0;
+    char next[16];
+
+    if (sscanf(msg->content, "%d %d %15[^|]|%n", &number, &start, next, &entries_offset) < 3 ||
+        entries_offset == 0) {
+        return;
+    }
+    const char *entries = msg->content + entries_offset;
+    size_t len = strlen(entries);
+
+    pthread_mutex_lock(&g_list_lock);
+    if (msg->type != g_list_type || g_list_done || start != g_list_cursor) {
+        pthread_mutex_unlock(&g_list_lock);
+        return;
+    }
+
+    if (g_list_len + len + 1 > g_list_capacity) {
+        size_t capacity = g_list_capacity ? g_list_capacity : MAX_MESSAGE * 4;
+        while (g_list_len + len + 1 > capacity) {
+            capacity *= 2;
+        }
+        char *buffer = realloc(g_list_buffer, capacity);
+        if (buffer == NULL) {
+            perror("Erreur realloc");
+            pthread_mutex_unlock(&g_list_lock);
+            return;
+        }
+        g_list_buffer = buffer;
+        g_list_capacity = capacity;
+    }
+    memcpy(g_list_buffer + g_list_len, entries, len + 1);
+    g_list_len += len;
+    g_list_chunks++;
+
+    if (strcmp(next, "fin") == 0) {
+        g_list_done = 1;
+    } else {
+        g_list_cursor = atoi(next);
+        if (number == LIST_PAGE_CHUNKS - 1) {
+            g_list_page_end = 1;
+        }
+    }
+    pthread_mutex_unlock(&g_list_lock);
+}
+
+// Demande une liste page par page (request : MSG_LIST_USERS ou
+// MSG_LIST_GROUPS) jusqu'à son dernier morceau. Une page incomplète (morceau
+// perdu) est redemandée à partir du dernier morceau reçu. Retourne 0 quand
+// g_list_buffer contient toute la liste, -1 si le serveur ne répond plus.
+static int list_fetch(MessageType request, MessageType response) {
+    pthread_mutex_lock(&g_list_lock);
+    g_list_type = response;
+    g_list_len = 0;
+    g_list_cursor = 0;
+    g_list_chunks = 0;
+    g_list_done = 0;
+    pthread_mutex_unlock(&g_list_lock);
+
+    int attempts = 0;
+    int result = -1;
+    while (attempts < 3) {
+        char cursor[16];
+        pthread_mutex_lock(&g_list_lock);
+        snprintf(cursor, sizeof(cursor), "%d", g_list_cursor);
+        g_list_page_end = 0;
+        int chunks = g_list_chunks;
+        pthread_mutex_unlock(&g_list_lock);
+
+        Message msg;
+        message_create(&msg, request, g_username, NULL, NULL, cursor);
+        if (socket_send(g_sockfd, &msg, &g_server_addr) < 0) {
+            break;
+        }
+
+        // Attendre la page : 500 ms pour le premier morceau, puis 100 ms
+        // au plus entre deux morceaux
+        int seen = chunks;
+        int idle = 0;
+        int done = 0, page_end = 0;
+        while (1) {
+            usleep(10000);  // 10 ms
+            pthread_mutex_lock(&g_list_lock);
+            done = g_list_done;
+            page_end = g_list_page_end;
+            int received = g_list_chunks;
+            pthread_mutex_unlock(&g_list_lock);
+
+            if (received > seen) {
+                seen = received;
+                idle = 0;
+            } else if (++idle >= (seen > chunks ? 10 : 50)) {
+                break;
+            }
+            if (done || page_end) {
+                break;
+            }
+        }
+
+        if (done) {
+            result = 0;
+            break;
+        }
+        // Sans aucun morceau reçu, la requête ou toute la page s'est perdue
+        attempts = (seen > chunks) ? 0 : attempts + 1;
+    }
+
+    // Ignorer les morceaux en retard pendant l'affichage
+    pthread_mutex_lock(&g_list_lock);
+    g_list_done = 1;
+    pthread_mutex_unlock(&g_list_lock);
+    return result;
+}
+
+// Réponse à MSG_SUBSCRIBE ou changement poussé par le serveur
+static void directory_receive_message(const Message *msg) {
+    pthread_mutex_lock(&g_directory_lock);
+    if (msg->type == MSG_SUBSCRIBE) {
+        g_directory_base = (uint32_t)strtoul(msg->content, NULL, 10);
+        g_directory_base_received = 1;
+    } else if (directory_receive(&g_directory, msg->content) < 0) {
+        g_directory_lost = 1;
+    }
+    pthread_mutex_unlock(&g_directory_lock);
+}
+
+// (Re)charge la réplique : abonnement, dont la réponse donne la version de
+// départ, puis les deux listes complètes sur lesquelles sont rejoués les
+// changements reçus entre-temps. Retourne -1 si le serveur ne répond pas.
+static int directory_sync(void) {
+    pthread_mutex_lock(&g_directory_lock);
+    g_directory.ready = 0;
+    g_directory_lost = 0;
+    g_directory_base_received = 0;
+    pthread_mutex_unlock(&g_directory_lock);
+
+    int received = 0;
+    for (int attempt = 0; attempt < 3 && !received; attempt++) {
+        Message msg;
+        message_create(&msg, MSG_SUBSCRIBE, g_username, NULL, NULL, "");
+        if (socket_send(g_sockfd, &msg, &g_server_addr) < 0) {
+            return -1;
+        }
+        for (int wait = 0; wait < 50 && !received; wait++) {
+            usleep(10000);  // 10 ms
+            pthread_mutex_lock(&g_directory_lock);
+            received = g_directory_base_received;
+            pthread_mutex_unlock(&g_directory_lock);
+        }
+    }
+    if (!received) {
+        return -1;
+    }
+
+    // g_list_buffer sert aux deux listes : garder celle des utilisateurs
+    if (list_fetch(MSG_LIST_USERS, MSG_LIST_USERS_RESPONSE) < 0) {
+        return -1;
+    }
+    char *users = strdup(g_list_len > 0 ? g_list_buffer : "");
+    if (users == NULL) {
+        perror("Erreur strdup");
+        return -1;
+    }
+    if (list_fetch(MSG_LIST_GROUPS, MSG_LIST_GROUPS_RESPONSE) < 0) {
+        free(users);
+        return -1;
+    }
+
+    int result = 0;
+    pthread_mutex_lock(&g_directory_lock);
+    if (directory_load(&g_directory, 1, users) == -1 ||
+        directory_load(&g_directory, 0, g_list_len > 0 ? g_list_buffer : "") == -1) {
+        result = -1;
+    } else if (!g_directory_lost) {
+        // Sinon les listes restent affichables, mais seront rechargées à
+        // la prochaine commande
+        directory_rebase(&g_directory, g_directory_base);
+    }
+    pthread_mutex_unlock(&g_directory_lock);
+    free(users);
+    return result;
+}
+
+// Liste de /users (users non nul) ou /groups : depuis la réplique si elle
+// est à jour, sinon depuis le serveur. Retourne une liste allouée par
+// malloc, ou NULL si le serveur ne répond pas.
+static char *list_get(int users, size_t *len) {
+    if (g_subscribe) {
+        pthread_mutex_lock(&g_directory_lock);
+        int current = g_directory.ready && g_directory.pending_count == 0;
+        pthread_mutex_unlock(&g_directory_lock);
+
+        // Un changement manque (trou dans les versions) ou la réplique
+        // n'a jamais été chargée
+        if (!current && directory_sync() == -1) {
+            return NULL;
+        }
+
+        pthread_mutex_lock(&g_directory_lock);
+        char *list = directory_list(&g_directory, users, len);
+        pthread_mutex_unlock(&g_directory_lock);
+        return list;
+    }
+
+    if (users ? list_fetch(MSG_LIST_USERS, MSG_LIST_USERS_RESPONSE) < 0
+              : list_fetch(MSG_LIST_GROUPS, MSG_LIST_GROUPS_RESPONSE) < 0) {
+        return NULL;
+    }
+    char *list = strdup(g_list_len > 0 ? g_list_buffer : "");
+    if (list == NULL) {
+        perror("Erreur strdup");
+        return NULL;
+    }
+    *len = g_list_len;
+    return list;
+}
+
 void* receive_thread(void *arg) {
-    Message msg;
+    // Un datagramme du serveur peut regrouper plusieurs messages (MSG_BUNDLE)
+    Message msgs[BUNDLE_MAX_MESSAGES];
     struct sockaddr_in src_addr;
 
     while (g_running) {
-        ssize_t n = socket_receive(g_sockfd, &msg, &src_addr);
-
-        if (n > 0) {
+        // Anneau local : attente bornée sans appel système tant que le
+        // serveur répond vite (voir ring_receive)
+        int count = g_local ? ring_receive(msgs, BUNDLE_MAX_MESSAGES, 100)
+                            : socket_receive(g_sockfd, msgs, BUNDLE_MAX_MESSAGES, &src_addr);
+
+        for (int i = 0; i < count; i++) {
+            Message msg = msgs[i];
+
+            // Annuaire : mise à jour silencieuse de la réplique
+            if (msg.type == MSG_SUBSCRIBE || msg.type == MSG_DIRECTORY) {
+                directory_receive_message(&msg);
+                continue;
+            }
             printf("\n");
 
             // Gérer les cas spéciaux avant d'afficher
@@ -101,16 +359,14 @@ void* receive_thread(void *arg) {
                 }
                 // Afficher le message
                 message_display(&msg, g_user_color);
-            } else if (msg.type == MSG_LIST_USERS_RESPONSE) {
-                // Réponse avec la liste des utilisateurs
-                strncpy(g_list_buffer, msg.content, sizeof(g_list_buffer) - 1);
-                g_list_buffer[sizeof(g_list_buffer) - 1] = '\0';
-                g_list_received = 1;
-            } else if (msg.type == MSG_LIST_GROUPS_RESPONSE) {
-                // Réponse avec la liste des groupes
-                strncpy(g_list_buffer, msg.content, sizeof(g_list_buffer) - 1);
-                g_list_buffer[sizeof(g_list_buffer) - 1] = '\0';
-                g_list_received = 1;
+            } else if (msg.type == MSG_LIST_USERS_RESPONSE ||
+                       msg.type == MSG_LIST_GROUPS_RESPONSE) {
+                // Morceau de la liste demandée par /users ou /groups
+                list_receive_chunk(&msg);
+            } else if (msg.type == MSG_HISTORY_END) {
+                // Fin d'une réponse à /history ou /since
+                printf("%s--- Fin de l'historique (%s message(s)) ---%s\n",
+                       COLOR_CYAN, msg.content, COLOR_RESET);
             } else if (msg.type == MSG_CHANGE_COLOR) {
                 // Changement de couleur du groupe
                 const char *color_code = COLOR_GREEN;
@@ -136,7 +392,9 @@ void* receive_thread(void *arg) {
             display_prompt(g_username, g_current_group, g_user_color);
         }
 
-        usleep(10000); // 10 ms
+        if (count <= 0 && !g_local) {
+            usleep(10000); // 10 ms
+        }
     }
 
     return NULL;
@@ -154,6 +412,8 @@ void print_help(void) {
     printf("  /demote <user>         - Rétrograder un administrateur (admin uniquement)\n");
     printf("  /users                 - Lister les utilisateurs\n");
     printf("  /groups                - Lister les groupes\n");
+    printf("  /history [n]           - Derniers messages du groupe (privés reçus hors groupe)\n");
+    printf("  /since <HH:MM[:SS]>    - Messages depuis cette heure (aujourd'hui) ou une date epoch\n");
     printf("  /color <couleur>       - Changer la couleur du prompt (admin uniquement)\n");
     printf("                          (red, green, yellow, blue, magenta, cyan, white)\n");
     printf("  /clear                 - Effacer l'écran\n");
@@ -188,24 +448,10 @@ int process_command(char *input) {
             clear_screen();
         }
         else if (strcmp(input, "/users") == 0) {
-            // Envoyer une requête au serveur
-            Message msg;
-            message_create(&msg, MSG_LIST_USERS, g_username, NULL, NULL, "");
-
-            if (socket_send(g_sockfd, &msg, &g_server_addr) < 0) {
-                printf("Erreur : impossible d'envoyer la requête au serveur\n");
-                return 0;
-            }
-
-            // Attendre la réponse (avec timeout)
-            g_list_received = 0;
-            int timeout = 0;
-            while (!g_list_received && timeout < 50) {  // 500ms max
-                usleep(10000);  // 10ms
-                timeout++;
-            }
-
-            if (!g_list_received) {
+            // Réplique de l'annuaire (-s) ou liste demandée au serveur
+            size_t list_len = 0;
+            char *list = list_get(1, &list_len);
+            if (list == NULL) {
                 printf("Erreur : pas de réponse du serveur\n");
                 printf("Vérifiez que le serveur est démarré.\n");
                 return 0;
@@ -213,10 +459,10 @@ int process_command(char *input) {
 
             // Afficher la liste des utilisateurs
             printf("\n=== UTILISATEURS CONNECTÉS ===\n");
-            if (strlen(g_list_buffer) == 0) {
+            if (list_len == 0) {
                 printf("Aucun utilisateur connecté\n");
             } else {
-                char *token = strtok(g_list_buffer, "|");
+                char *token = strtok(list, "|");
                 int count = 0;
                 while (token != NULL) {
                     char username[MAX_USERNAME];
@@ -230,26 +476,13 @@ int process_command(char *input) {
                 printf("\nTotal: %d utilisateur(s)\n", count);
             }
             printf("\n");
+            free(list);
         }
         else if (strcmp(input, "/groups") == 0) {
-            // Envoyer une requête au serveur
-            Message msg;
-            message_create(&msg, MSG_LIST_GROUPS, g_username, NULL, NULL, "");
-
-            if (socket_send(g_sockfd, &msg, &g_server_addr) < 0) {
-                printf("Erreur : impossible d'envoyer la requête au serveur\n");
-                return 0;
-            }
-
-            // Attendre la réponse (avec timeout)
-            g_list_received = 0;
-            int timeout = 0;
-            while (!g_list_received && timeout < 50) {  // 500ms max
-                usleep(10000);  // 10ms
-                timeout++;
-            }
-
-            if (!g_list_received) {
+            // Réplique de l'annuaire (-s) ou liste demandée au serveur
+            size_t list_len = 0;
+            char *list = list_get(0, &list_len);
+            if (list == NULL) {
                 printf("Erreur : pas de réponse du serveur\n");
                 printf("Vérifiez que le serveur est démarré.\n");
                 return 0;
@@ -257,10 +490,10 @@ int process_command(char *input) {
 
             // Afficher la liste des groupes
             printf("\n=== GROUPES ACTIFS ===\n");
-            if (strlen(g_list_buffer) == 0) {
+            if (list_len == 0) {
                 printf("Aucun groupe actif\n");
             } else {
-                char *token = strtok(g_list_buffer, "|");
+                char *token = strtok(list, "|");
                 int count = 0;
                 while (token != NULL) {
                     char groupname[MAX_GROUP_NAME];
@@ -274,6 +507,7 @@ int process_command(char *input) {
                 printf("\nTotal: %d groupe(s)\n", count);
             }
             printf("\n");
+            free(list);
         }
         else if (strcmp(input, "/leave") == 0) {
             if (strlen(g_current_group) == 0) {
@@ -315,6 +549,49 @@ int process_command(char *input) {
             }
             // Ne pas mettre à jour g_current_group ici, attendre la confirmation du serveur
         }
+        else if (strcmp(input, "/history") == 0 || strncmp(input, "/history ", 9) == 0) {
+            // Historique du groupe actuel, ou des messages privés reçus
+            int count = 20;
+            if (input[8] == ' ' && sscanf(input + 9, "%d", &count) != 1) {
+                printf("Usage: /history [nombre]\n");
+                return 0;
+            }
+
+            char content[16];
+            snprintf(content, sizeof(content), "%d", count);
+            Message msg;
+            message_create(&msg, MSG_HISTORY, g_username, NULL, g_current_group, content);
+            socket_send(g_sockfd, &msg, &g_server_addr);
+        }
+        else if (sscanf(input, "/since %s", arg1) == 1) {
+            // Heure du jour (HH:MM ou HH:MM:SS) ou secondes depuis l'époque
+            time_t since;
+            int hours, minutes, seconds = 0;
+            char *end;
+            long long epoch = strtoll(arg1, &end, 10);
+
+            if (*end == '\0') {
+                since = (time_t)epoch;
+            } else if (sscanf(arg1, "%d:%d:%d", &hours, &minutes, &seconds) >= 2) {
+                time_t now = time(NULL);
+                struct tm tm_info;
+                localtime_r(&now, &tm_info);
+                tm_info.tm_hour = hours;
+                tm_info.tm_min = minutes;
+                tm_info.tm_sec = seconds;
+                tm_info.tm_isdst = -1;
+                since = mktime(&tm_info);
+            } else {
+                printf("Usage: /since <HH:MM[:SS]> ou /since <secondes depuis l'époque>\n");
+                return 0;
+            }
+
+            char content[32];
+            snprintf(content, sizeof(content), "%lld", (long long)since);
+            Message msg;
+            message_create(&msg, MSG_HISTORY_SINCE, g_username, NULL, g_current_group, content);
+            socket_send(g_sockfd, &msg, &g_server_addr);
+        }
         else if (sscanf(input, "/merge %s %s", arg1, arg2) == 2) {
             char content[MAX_MESSAGE];
             snprintf(content, MAX_MESSAGE, "%s:%s", arg1, arg2);
@@ -435,17 +712,44 @@ int process_command(char *input) {
 }
 
 int main(int argc, char **argv) {
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <username> <server_ip> [server_port]\n", argv[0]);
+    int reliable = 0;
+    int local = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "rsl")) != -1) {
+        switch (opt) {
+            case 'r':
+                reliable = 1;
+                break;
+            case 's':
+                g_subscribe = 1;
+                break;
+            case 'l':
+                local = 1;
+                break;
+            default:
+                argc = 0;  // Afficher l'usage
+                break;
+        }
+    }
+
+    if (argc - optind < (local ? 1 : 2)) {
+        fprintf(stderr, "Usage: %s [-r] [-s] <username> <server_ip> [server_port]\n", argv[0]);
+        fprintf(stderr, "       %s [-s] <username> <chemin_socket>\n", argv[0]);
+        fprintf(stderr, "       %s -l [-s] <username> [server_ip|chemin_socket] [server_port]\n", argv[0]);
+        fprintf(stderr, "  -r  envois fiables (numérotés, acquittés et retransmis)\n");
+        fprintf(stderr, "  -s  s'abonner à l'annuaire : /users et /groups sans requête au serveur\n");
+        fprintf(stderr, "  -l  serveur sur cette machine, par mémoire partagée (server_ip ou chemin_socket si indisponible)\n");
+        fprintf(stderr, "  chemin_socket  socket local d'un serveur lancé avec -x (contient un '/', ex. ./messagerie.sock)\n");
         return EXIT_FAILURE;
     }
     
-    char *username = argv[1];
-    char *server_ip = argv[2];
+    char *username = argv[optind];
+    char *server_ip = (argc - optind > 1) ? argv[optind + 1] : NULL;
     int server_port = PORT_BASE;
     
-    if (argc > 3) {
-        server_port = atoi(argv[3]);
+    if (argc - optind > 2) {
+        server_port = atoi(argv[optind + 2]);
     }
     
     // Copier le nom d'utilisateur
@@ -454,7 +758,13 @@ int main(int argc, char **argv) {
     
     printf("=== CLIENT DE MESSAGERIE ===\n");
     printf("Utilisateur: %s\n", g_username);
-    printf("Serveur: %s:%d\n\n", server_ip, server_port);
+    if (server_ip != NULL && strchr(server_ip, '/') != NULL) {
+        printf("Serveur: %s\n\n", server_ip);
+    } else if (server_ip != NULL) {
+        printf("Serveur: %s:%d\n\n", server_ip, server_port);
+    } else {
+        printf("Serveur: local\n\n");
+    }
     
     // Installer le gestionnaire de signal
     signal(SIGINT, cleanup_and_exit);
@@ -463,37 +773,75 @@ int main(int argc, char **argv) {
     // Attacher à la mémoire partagée
     key_t shm_key = ftok(SHM_KEY_FILE, '1');
     if (shm_key != -1) {
-        g_shmid = shmget(shm_key, sizeof(SharedMemory), 0);
-        if (g_shmid != -1) {
-            shm_attach(g_shmid, &g_shm);
-            
-            key_t sem_key = ftok(SEM_KEY_FILE, '1');
-            if (sem_key != -1) {
-                g_semid = semget(sem_key, 1, 0);
+        // La taille et la disposition du segment sont lues dans son en-tête
+        g_shmid = shmget(shm_key, 0, 0);
+        struct shmid_ds ds;
+        if (g_shmid != -1 && shmctl(g_shmid, IPC_STAT, &ds) != -1 &&
+            shm_attach(g_shmid, &g_shm) == 0) {
+            if (shm_layout_check(g_shm, ds.shm_segsz) == -1) {
+                shm_detach(g_shm);
+                g_shm = NULL;
             }
         }
     }
     
-    // Créer le socket
-    g_sockfd = socket_create_udp();
+    // Serveur local : prendre un emplacement dans le segment des anneaux
+    if (local) {
+        key_t ring_key = ftok(SHM_KEY_FILE, '2');
+        if (ring_key != -1 && ring_attach(ring_key) == 0) {
+            if (ring_claim(&g_server_addr) == 0) {
+                g_local = 1;
+                printf("Connexion locale par mémoire partagée\n");
+            } else {
+                ring_release();
+            }
+        }
+        if (!g_local && server_ip == NULL) {
+            fprintf(stderr, "Erreur : aucun serveur local (lancé avec -l) sur cette machine\n");
+            return EXIT_FAILURE;
+        }
+        if (!g_local) {
+            printf("Serveur local indisponible, connexion par %s\n",
+                   strchr(server_ip, '/') != NULL ? "socket local" : "UDP");
+        }
+    }
+
+    // Créer le socket : un chemin à la place de l'adresse IP désigne le
+    // socket local (AF_UNIX) d'un serveur lancé avec -x
+    int unix_socket = (!g_local && strchr(server_ip, '/') != NULL);
+    if (unix_socket) {
+        g_sockfd = socket_connect_unix(server_ip, &g_server_addr);
+    } else {
+        g_sockfd = socket_create_udp();
+    }
     if (g_sockfd == -1) {
         return EXIT_FAILURE;
     }
-    
+
     // Configurer l'adresse du serveur
-    memset(&g_server_addr, 0, sizeof(g_server_addr));
-    g_server_addr.sin_family = AF_INET;
-    g_server_addr.sin_port = htons(server_port);
-    
-    if (inet_pton(AF_INET, server_ip, &g_server_addr.sin_addr) <= 0) {
-        perror("Adresse IP invalide");
-        return EXIT_FAILURE;
+    if (!g_local && !unix_socket) {
+        memset(&g_server_addr, 0, sizeof(g_server_addr));
+        g_server_addr.sin_family = AF_INET;
+        g_server_addr.sin_port = htons(server_port);
+
+        if (inet_pton(AF_INET, server_ip, &g_server_addr.sin_addr) <= 0) {
+            perror("Adresse IP invalide");
+            return EXIT_FAILURE;
+        }
     }
     
     // Configurer le socket en mode non-bloquant
     int flags = fcntl(g_sockfd, F_GETFL, 0);
     fcntl(g_sockfd, F_SETFL, flags | O_NONBLOCK);
     
+    // Retransmissions et acquittements des envois vers le serveur (inutiles
+    // par un anneau ou un socket local)
+    if (reliable && !g_local && !unix_socket && reliable_start(g_sockfd) == -1) {
+        return EXIT_FAILURE;
+    }
+
+    directory_init(&g_directory);
+
     // Créer le thread de réception
     pthread_t recv_thread_id;
     if (pthread_create(&recv_thread_id, NULL, receive_thread, NULL) != 0) {
@@ -506,13 +854,15 @@ int main(int argc, char **argv) {
     Message connect_msg;
     message_create(&connect_msg, MSG_CONNECT, g_username, NULL, NULL, "");
 
+    // Remis à zéro avant l'envoi : l'accusé de réception peut être traité
+    // par le thread de réception avant la fin de socket_send
+    g_connected_to_server = 0;
     if (socket_send(g_sockfd, &connect_msg, &g_server_addr) < 0) {
         fprintf(stderr, "Erreur : impossible d'envoyer la requête de connexion\n");
         return EXIT_FAILURE;
     }
 
     // Attendre la confirmation avec timeout (2 secondes)
-    g_connected_to_server = 0;
     int timeout = 0;
     while (!g_connected_to_server && timeout < 200) {  // 2 secondes max
         usleep(10000);  // 10ms
@@ -521,13 +871,28 @@ int main(int argc, char **argv) {
 
     if (!g_connected_to_server) {
         fprintf(stderr, "\n%sErreur : Serveur injoignable%s\n", COLOR_RED, COLOR_RESET);
-        fprintf(stderr, "Vérifiez que le serveur est démarré à l'adresse %s:%d\n\n", server_ip, server_port);
+        if (g_local) {
+            fprintf(stderr, "Vérifiez que le serveur local est démarré\n\n");
+        } else if (unix_socket) {
+            fprintf(stderr, "Vérifiez que le serveur est démarré avec -x %s\n\n", server_ip);
+        } else {
+            fprintf(stderr, "Vérifiez que le serveur est démarré à l'adresse %s:%d\n\n", server_ip, server_port);
+        }
         g_running = 0;
+        if (g_local) {
+            ring_release();
+        }
         close(g_sockfd);
         return EXIT_FAILURE;
     }
 
     printf("%sConnecté au serveur!%s Tapez /help pour l'aide.\n\n", COLOR_GREEN, COLOR_RESET);
+
+    // Charger la réplique de l'annuaire dès maintenant pour que le
+    // premier /users n'attende pas
+    if (g_subscribe && directory_sync() == -1) {
+        printf("Annuaire indisponible, nouvel essai au prochain /users ou /groups\n\n");
+    }
     
     // Boucle principale d'entrée
     char input[MAX_MESSAGE];
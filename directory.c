@@ -0,0 +1,347 @@
+#include "messaging.h"
+
+// ========== Annuaire poussé aux abonnés ==========
+
+// Un client abonné (MSG_SUBSCRIBE, option -s du client) reçoit chaque
+// changement de /users ou /groups dans un message MSG_DIRECTORY dont le
+// contenu est
+//     "<version> <entrée>"
+// version : SharedMemory.directory_version après le changement (+1 par
+// entrée) ; entrée : l'état complet de l'utilisateur ou du groupe touché,
+// dans le format des listes
+//     "U nom:groupe"           utilisateur connecté ("aucun" hors groupe)
+//     "u nom"                  utilisateur déconnecté
+//     "G nom:membres:admins"   groupe affiché par /groups
+//     "g nom"                  groupe disparu ou vide
+// Une entrée remplace la précédente du même nom. Un client qui détecte un
+// trou dans les versions se réabonne, recharge les deux listes puis rejoue
+// dans l'ordre les entrées postérieures à la version renvoyée par
+// MSG_SUBSCRIBE : un nom que ces entrées ne touchent pas n'a pas changé
+// depuis, les autres finissent dans leur dernier état.
+
+// Abonne l'utilisateur et retourne la version à partir de laquelle il
+// reçoit les changements. L'appelant doit être dans une section d'écriture.
+uint32_t directory_subscribe(SharedMemory *shm, const char *username) {
+    int id = user_get_id(shm, username);
+    if (id >= 0) {
+        bitset_set(shm_subscribers(shm), id);
+    }
+    return shm->directory_version;
+}
+
+// Numérote l'entrée et la pousse aux abonnés connectés. Le message n'est
+// construit que s'il y a au moins un abonné.
+static void directory_publish(Outbox *ob, SharedMemory *shm, const char *entry) {
+    uint32_t version = ++shm->directory_version;
+    const uint64_t *subscribers = shm_subscribers(shm);
+    int words = shm->member_words;
+    int msg_index = -1;
+
+    for (int id = bitset_next(subscribers, words, 0); id >= 0;
+         id = bitset_next(subscribers, words, id + 1)) {
+        User *user = shm_user(shm, id);
+        if (!user->active) {
+            continue;
+        }
+        if (msg_index < 0) {
+            Message msg;
+            char content[MAX_MESSAGE];
+            snprintf(content, sizeof(content), "%u %s", version, entry);
+            message_create(&msg, MSG_DIRECTORY, "Serveur", NULL, NULL, content);
+            if ((msg_index = outbox_message(ob, &msg)) < 0) {
+                return;
+            }
+        }
+        outbox_send_to(ob, msg_index, user->username, &user->addr);
+    }
+}
+
+// Pousse l'état courant d'un utilisateur (connecté ou non)
+void directory_publish_user(Outbox *ob, SharedMemory *shm, const char *username) {
+    char entry[MAX_USERNAME + MAX_GROUP_NAME + 4];
+    User *user = user_find(shm, username);
+
+    if (user != NULL) {
+        snprintf(entry, sizeof(entry), "U %.*s:%.*s",
+                 MAX_USERNAME - 1, user->username,
+                 MAX_GROUP_NAME - 1,
+                 user->current_group[0] ? user->current_group : "aucun");
+    } else {
+        snprintf(entry, sizeof(entry), "u %.*s", MAX_USERNAME - 1, username);
+    }
+    directory_publish(ob, shm, entry);
+}
+
+// Pousse l'état courant d'un groupe (existant ou non)
+void directory_publish_group(Outbox *ob, SharedMemory *shm, const char *group_name) {
+    char entry[MAX_GROUP_NAME + 32];
+    Group *group = group_find(shm, group_name);
+
+    if (group != NULL && group->user_count > 0) {
+        snprintf(entry, sizeof(entry), "G %.*s:%d:%d",
+                 MAX_GROUP_NAME - 1, group->name,
+                 group->user_count, group->admin_count);
+    } else {
+        snprintf(entry, sizeof(entry), "g %.*s", MAX_GROUP_NAME - 1, group_name);
+    }
+    directory_publish(ob, shm, entry);
+}
+
+// ========== Réplique côté client ==========
+
+// Comme la table des utilisateurs du serveur, une table de la réplique ne
+// fait que grandir : une entrée retirée garde son emplacement et son nom
+// reste indexé, une entrée ultérieure du même nom le réactive.
+
+static int directory_table_lookup(const DirectoryTable *table, const char *name) {
+    if (table->index_size == 0) {
+        return -1;
+    }
+
+    unsigned int mask = table->index_size - 1;
+    unsigned int pos = hash_string(name) & mask;
+    while (table->index[pos] != 0) {
+        int slot = table->index[pos] - 1;
+        if (strcmp(table->entries[slot].name, name) == 0) {
+            return slot;
+        }
+        pos = (pos + 1) & mask;
+    }
+    return -1;
+}
+
+static void directory_table_index(DirectoryTable *table, int slot) {
+    unsigned int mask = table->index_size - 1;
+    unsigned int pos = hash_string(table->entries[slot].name) & mask;
+
+    while (table->index[pos] != 0) {
+        pos = (pos + 1) & mask;
+    }
+    table->index[pos] = slot + 1;
+}
+
+static int directory_table_grow(DirectoryTable *table) {
+    int capacity = table->capacity ? 2 * table->capacity : 64;
+    DirectoryEntry *entries = realloc(table->entries, (size_t)capacity * sizeof(DirectoryEntry));
+    if (entries == NULL) {
+        perror("Erreur realloc");
+        return -1;
+    }
+    table->entries = entries;
+
+    int *index = calloc((size_t)(4 * capacity), sizeof(int));
+    if (index == NULL) {
+        perror("Erreur calloc");
+        return -1;
+    }
+    free(table->index);
+    table->index = index;
+    table->index_size = 4 * capacity;
+    table->capacity = capacity;
+    for (int slot = 0; slot < table->count; slot++) {
+        directory_table_index(table, slot);
+    }
+    return 0;
+}
+
+// Remplace la valeur de name, en l'ajoutant au besoin ; value NULL retire
+// l'entrée
+static int directory_table_set(DirectoryTable *table, const char *name, const char *value) {
+    int slot = directory_table_lookup(table, name);
+
+    if (slot < 0) {
+        if (value == NULL) {
+            return 0;
+        }
+        if (table->count == table->capacity && directory_table_grow(table) == -1) {
+            return -1;
+        }
+        slot = table->count++;
+        strncpy(table->entries[slot].name, name, MAX_GROUP_NAME - 1);
+        table->entries[slot].name[MAX_GROUP_NAME - 1] = '\0';
+        directory_table_index(table, slot);
+    }
+
+    DirectoryEntry *entry = &table->entries[slot];
+    entry->active = (value != NULL);
+    if (value != NULL) {
+        strncpy(entry->value, value, MAX_GROUP_NAME - 1);
+        entry->value[MAX_GROUP_NAME - 1] = '\0';
+    }
+    return 0;
+}
+
+static void directory_table_free(DirectoryTable *table) {
+    free(table->entries);
+    free(table->index);
+    memset(table, 0, sizeof(*table));
+}
+
+void directory_init(Directory *dir) {
+    memset(dir, 0, sizeof(*dir));
+}
+
+void directory_free(Directory *dir) {
+    directory_table_free(&dir->users);
+    directory_table_free(&dir->groups);
+    memset(dir, 0, sizeof(*dir));
+}
+
+// Remplace une table par une liste complète reçue de /users (users non
+// nul) ou /groups, au format "nom:valeur|nom:valeur|..."
+int directory_load(Directory *dir, int users, const char *list) {
+    DirectoryTable *table = users ? &dir->users : &dir->groups;
+
+    table->count = 0;
+    if (table->index != NULL) {
+        memset(table->index, 0, (size_t)table->index_size * sizeof(int));
+    }
+
+    while (*list != '\0') {
+        size_t len = strcspn(list, "|");
+        const char *colon = memchr(list, ':', len);
+        if (colon != NULL) {
+            char name[MAX_GROUP_NAME];
+            char value[MAX_GROUP_NAME];
+            snprintf(name, sizeof(name), "%.*s", (int)(colon - list), list);
+            snprintf(value, sizeof(value), "%.*s", (int)(len - (size_t)(colon - list) - 1), colon + 1);
+            if (directory_table_set(table, name, value) == -1) {
+                return -1;
+            }
+        }
+        list += len;
+        if (*list == '|') {
+            list++;
+        }
+    }
+    return 0;
+}
+
+// Applique une entrée "U nom:groupe", "u nom", "G nom:m:a" ou "g nom"
+static void directory_apply(Directory *dir, const char *entry) {
+    char kind = entry[0];
+    if (kind == '\0' || entry[1] != ' ') {
+        return;
+    }
+
+    DirectoryTable *table = (kind == 'U' || kind == 'u') ? &dir->users : &dir->groups;
+    char name[MAX_GROUP_NAME];
+    const char *value = NULL;
+
+    if (kind == 'U' || kind == 'G') {
+        const char *colon = strchr(entry + 2, ':');
+        if (colon == NULL) {
+            return;
+        }
+        snprintf(name, sizeof(name), "%.*s", (int)(colon - entry - 2), entry + 2);
+        value = colon + 1;
+    } else if (kind == 'u' || kind == 'g') {
+        snprintf(name, sizeof(name), "%s", entry + 2);
+    } else {
+        return;
+    }
+    directory_table_set(table, name, value);
+}
+
+// Applique les changements en attente qui suivent la version courante
+static void directory_drain(Directory *dir) {
+    int i = 0;
+    while (i < dir->pending_count) {
+        if (dir->pending_versions[i] != dir->version + 1) {
+            i++;
+            continue;
+        }
+        directory_apply(dir, dir->pending[i]);
+        dir->version++;
+
+        // Retirer l'entrée (la dernière prend sa place) et reprendre du début
+        dir->pending_count--;
+        dir->pending_versions[i] = dir->pending_versions[dir->pending_count];
+        memcpy(dir->pending[i], dir->pending[dir->pending_count], MAX_MESSAGE);
+        i = 0;
+    }
+}
+
+// Les listes viennent d'être chargées après un abonnement qui a renvoyé
+// version : écarter les changements antérieurs et rejouer les suivants
+void directory_rebase(Directory *dir, uint32_t version) {
+    int kept = 0;
+    for (int i = 0; i < dir->pending_count; i++) {
+        if (dir->pending_versions[i] > version) {
+            dir->pending_versions[kept] = dir->pending_versions[i];
+            memcpy(dir->pending[kept], dir->pending[i], MAX_MESSAGE);
+            kept++;
+        }
+    }
+    dir->pending_count = kept;
+    dir->version = version;
+    dir->ready = 1;
+    directory_drain(dir);
+}
+
+// Reçoit le contenu d'un MSG_DIRECTORY. Tant que la réplique n'est pas
+// prête, ou si un changement précédent manque, il est mis en attente.
+// Retourne -1 si l'attente déborde : les changements en attente sont
+// écartés et la réplique est à recharger.
+int directory_receive(Directory *dir, const char *content) {
+    char *end;
+    unsigned long version = strtoul(content, &end, 10);
+    if (end == content || *end != ' ') {
+        return 0;
+    }
+
+    if (dir->ready && version <= dir->version) {
+        return 0;  // Doublon ou déjà compris dans les listes chargées
+    }
+    if (dir->ready && version == dir->version + 1) {
+        directory_apply(dir, end + 1);
+        dir->version++;
+        directory_drain(dir);
+        return 0;
+    }
+
+    for (int i = 0; i < dir->pending_count; i++) {
+        if (dir->pending_versions[i] == version) {
+            return 0;
+        }
+    }
+    if (dir->pending_count == DIRECTORY_PENDING_MAX) {
+        dir->pending_count = 0;
+        dir->ready = 0;
+        return -1;
+    }
+    dir->pending_versions[dir->pending_count] = (uint32_t)version;
+    snprintf(dir->pending[dir->pending_count], MAX_MESSAGE, "%s", end + 1);
+    dir->pending_count++;
+    return 0;
+}
+
+// Liste des entrées actives au format de /users ou /groups, allouée par
+// malloc (à libérer par l'appelant), ou NULL si la mémoire manque
+char *directory_list(const Directory *dir, int users, size_t *len) {
+    const DirectoryTable *table = users ? &dir->users : &dir->groups;
+    size_t size = 1;
+
+    for (int i = 0; i < table->count; i++) {
+        if (table->entries[i].active) {
+            size += strlen(table->entries[i].name) + strlen(table->entries[i].value) + 2;
+        }
+    }
+
+    char *list = malloc(size);
+    if (list == NULL) {
+        perror("Erreur malloc");
+        return NULL;
+    }
+
+    size_t used = 0;
+    for (int i = 0; i < table->count; i++) {
+        const DirectoryEntry *entry = &table->entries[i];
+        if (entry->active) {
+            used += (size_t)sprintf(list + used, "%s:%s|", entry->name, entry->value);
+        }
+    }
+    list[used] = '\0';
+    *len = used;
+    return list;
+}
@@ -1,58 +1,132 @@
 #include "messaging.h"
 
+// ========== Index haché des groupes ==========
+
+// Retourne l'emplacement du groupe actif portant ce nom ou -1
+static int group_index_lookup(SharedMemory *shm, const char *group_name) {
+    int *index = shm_group_index(shm);
+    unsigned int mask = shm->group_hash_size - 1;
+    unsigned int pos = hash_string(group_name) & mask;
+
+    for (int probe = 0; probe < shm->group_hash_size; probe++) {
+        int slot = index[pos];
+        if (slot == 0) {
+            return -1;
+        }
+        if (slot != HASH_TOMBSTONE && slot - 1 < shm->group_count &&
+            strcmp(shm_group(shm, slot - 1)->name, group_name) == 0) {
+            return slot - 1;
+        }
+        pos = (pos + 1) & mask;
+    }
+    return -1;
+}
+
+static void group_index_insert(SharedMemory *shm, int idx) {
+    int *index = shm_group_index(shm);
+    unsigned int mask = shm->group_hash_size - 1;
+    unsigned int pos = hash_string(shm_group(shm, idx)->name) & mask;
+
+    // Réutiliser la première case vide ou libérée
+    while (index[pos] > 0) {
+        pos = (pos + 1) & mask;
+    }
+    index[pos] = idx + 1;
+}
+
+static void group_index_delete(SharedMemory *shm, int idx) {
+    int *index = shm_group_index(shm);
+    unsigned int mask = shm->group_hash_size - 1;
+    unsigned int pos = hash_string(shm_group(shm, idx)->name) & mask;
+
+    for (int probe = 0; probe < shm->group_hash_size; probe++) {
+        if (index[pos] == 0) {
+            return;
+        }
+        if (index[pos] == idx + 1) {
+            index[pos] = HASH_TOMBSTONE;
+            return;
+        }
+        pos = (pos + 1) & mask;
+    }
+}
+
+void group_index_rebuild(SharedMemory *shm) {
+    int *free_slots = shm_group_free(shm);
+
+    memset(shm_group_index(shm), 0, shm->group_hash_size * sizeof(int));
+    shm->group_free_count = 0;
+
+    for (int i = 0; i < shm->group_count; i++) {
+        if (shm_group(shm, i)->active) {
+            group_index_insert(shm, i);
+        } else {
+            free_slots[shm->group_free_count++] = i;
+        }
+    }
+}
+
+// Vide les ensembles de membres et d'administrateurs d'un groupe
+static void group_clear_sets(SharedMemory *shm, Group *group) {
+    group->user_count = 0;
+    group->admin_count = 0;
+    memset(group->bits, 0, 2 * shm->member_words * sizeof(uint64_t));
+}
+
+// Désactive un groupe et rend son emplacement réutilisable
+static void group_release(SharedMemory *shm, Group *group) {
+    int idx = shm_group_slot(shm, group);
+
+    group_index_delete(shm, idx);
+    group->active = 0;
+    __atomic_add_fetch(&group->incarnation, 1, __ATOMIC_SEQ_CST);
+    group_clear_sets(shm, group);
+    shm_group_free(shm)[shm->group_free_count++] = idx;
+    shm->group_generation++;
+}
+
 // ========== Gestion des groupes ==========
 
 int group_create(SharedMemory *shm, const char *group_name, const char *creator) {
     // Vérifier si le groupe existe déjà
-    for (int i = 0; i < shm->group_count; i++) {
-        if (strcmp(shm->groups[i].name, group_name) == 0) {
-            if (shm->groups[i].active) {
-                fprintf(stderr, "Groupe %s existe déjà\n", group_name);
-                return -1;
-            } else {
-                // Réactiver le groupe
-                shm->groups[i].active = 1;
-                shm->groups[i].user_count = 0;
-                shm->groups[i].admin_count = 0;
-                strncpy(shm->groups[i].color, COLOR_GREEN, 15);
-                shm->groups[i].color[15] = '\0';
-                // Ajouter le créateur comme premier administrateur
-                if (creator != NULL && strlen(creator) > 0) {
-                    strncpy(shm->groups[i].admins[0], creator, MAX_USERNAME - 1);
-                    shm->groups[i].admins[0][MAX_USERNAME - 1] = '\0';
-                    shm->groups[i].admin_count = 1;
-                }
-                return i;
-            }
-        }
+    if (group_index_lookup(shm, group_name) >= 0) {
+        fprintf(stderr, "Groupe %s existe déjà\n", group_name);
+        return -1;
     }
 
-    // Créer un nouveau groupe
-    if (shm->group_count >= MAX_GROUPS) {
+    // Réutiliser l'emplacement d'un groupe désactivé, sinon en prendre un nouveau
+    int idx;
+    if (shm->group_free_count > 0) {
+        idx = shm_group_free(shm)[--shm->group_free_count];
+    } else if (shm->group_count < shm->max_groups) {
+        idx = shm->group_count++;
+    } else {
         fprintf(stderr, "Nombre maximum de groupes atteint\n");
         return -1;
     }
 
-    int idx = shm->group_count;
-    strncpy(shm->groups[idx].name, group_name, MAX_GROUP_NAME - 1);
-    shm->groups[idx].name[MAX_GROUP_NAME - 1] = '\0';
-    shm->groups[idx].user_count = 0;
-    shm->groups[idx].admin_count = 0;
-    shm->groups[idx].active = 1;
-    strncpy(shm->groups[idx].color, COLOR_GREEN, 15);
-    shm->groups[idx].color[15] = '\0';
+    Group *group = shm_group(shm, idx);
+    strncpy(group->name, group_name, MAX_GROUP_NAME - 1);
+    group->name[MAX_GROUP_NAME - 1] = '\0';
+    group_clear_sets(shm, group);
+    group->active = 1;
+    strncpy(group->color, COLOR_GREEN, 15);
+    group->color[15] = '\0';
+    // Les numéros de l'historique continuent ceux de l'incarnation
+    // précédente : une case qu'un ajout en retard y écrirait reste invisible
+    __atomic_add_fetch(&group->incarnation, 1, __ATOMIC_SEQ_CST);
+    group->history_first = __atomic_load_n(&group->history_next, __ATOMIC_SEQ_CST);
+    memset(shm_history(shm, idx), 0, (size_t)shm->history_size * sizeof(HistoryEntry));
+    group_index_insert(shm, idx);
 
     // Ajouter le créateur comme premier administrateur
-    if (creator != NULL && strlen(creator) > 0) {
-        strncpy(shm->groups[idx].admins[0], creator, MAX_USERNAME - 1);
-        shm->groups[idx].admins[0][MAX_USERNAME - 1] = '\0';
-        shm->groups[idx].admin_count = 1;
-        printf("Groupe %s créé avec %s comme administrateur (index %d)\n", group_name, creator, idx);
-    } else {
-        printf("Groupe %s créé (index %d)\n", group_name, idx);
+    int creator_id = (creator != NULL) ? user_get_id(shm, creator) : -1;
+    if (creator_id >= 0) {
+        bitset_set(group_admins(shm, group), creator_id);
+        group->admin_count = 1;
     }
 
-    shm->group_count++;
+    shm->group_generation++;
     return idx;
 }
 
@@ -70,28 +144,21 @@ int group_add_user(SharedMemory *shm, const char *group_name, const char *userna
     }
     
     // Vérifier si l'utilisateur est déjà dans le groupe
-    for (int i = 0; i < group->user_count; i++) {
-        if (strcmp(group->users[i], username) == 0) {
-            fprintf(stderr, "Utilisateur %s déjà dans le groupe %s\n", username, group_name);
-            return -1;
-        }
-    }
-    
-    // Ajouter l'utilisateur au groupe
-    if (group->user_count >= MAX_CLIENTS) {
-        fprintf(stderr, "Groupe %s plein\n", group_name);
+    int id = user_get_id(shm, username);
+    if (bitset_test(group_members(shm, group), id)) {
+        fprintf(stderr, "Utilisateur %s déjà dans le groupe %s\n", username, group_name);
         return -1;
     }
     
-    strncpy(group->users[group->user_count], username, MAX_USERNAME - 1);
-    group->users[group->user_count][MAX_USERNAME - 1] = '\0';
+    // Ajouter l'utilisateur au groupe
+    bitset_set(group_members(shm, group), id);
     group->user_count++;
     
     // Mettre à jour le groupe actuel de l'utilisateur
     strncpy(user->current_group, group_name, MAX_GROUP_NAME - 1);
     user->current_group[MAX_GROUP_NAME - 1] = '\0';
-    
-    printf("Utilisateur %s ajouté au groupe %s\n", username, group_name);
+    shm->user_generation++;
+    shm->group_generation++;
     return 0;
 }
 
@@ -100,35 +167,31 @@ int group_remove_user(SharedMemory *shm, const char *group_name, const char *use
     if (group == NULL) {
         return -1;
     }
-    
-    // Chercher et retirer l'utilisateur
-    for (int i = 0; i < group->user_count; i++) {
-        if (strcmp(group->users[i], username) == 0) {
-            // Décaler les utilisateurs suivants
-            for (int j = i; j < group->user_count - 1; j++) {
-                strcpy(group->users[j], group->users[j + 1]);
-            }
-            group->user_count--;
-            
-            // Effacer le groupe actuel de l'utilisateur
-            User *user = user_find(shm, username);
-            if (user != NULL) {
-                user->current_group[0] = '\0';
-            }
-            
-            printf("Utilisateur %s retiré du groupe %s\n", username, group_name);
-            return 0;
-        }
+
+    return group_remove_member(shm, group, username);
+}
+
+int group_remove_member(SharedMemory *shm, Group *group, const char *username) {
+    int id = user_get_id(shm, username);
+    if (id < 0 || !bitset_test(group_members(shm, group), id)) {
+        return -1;
     }
-    
-    return -1;
+
+    // Retirer l'utilisateur
+    bitset_clear(group_members(shm, group), id);
+    group->user_count--;
+
+    // Effacer le groupe actuel de l'utilisateur
+    shm_user(shm, id)->current_group[0] = '\0';
+    shm->user_generation++;
+    shm->group_generation++;
+    return 0;
 }
 
 Group* group_find(SharedMemory *shm, const char *group_name) {
-    for (int i = 0; i < shm->group_count; i++) {
-        if (shm->groups[i].active && strcmp(shm->groups[i].name, group_name) == 0) {
-            return &shm->groups[i];
-        }
+    int i = group_index_lookup(shm, group_name);
+    if (i >= 0 && shm_group(shm, i)->active) {
+        return shm_group(shm, i);
     }
     return NULL;
 }
@@ -152,138 +215,78 @@ int group_merge(SharedMemory *shm, const char *group1_name, const char *group2_n
         return -1;
     }
 
-    // Transférer tous les utilisateurs de group2 vers group1
-    for (int i = 0; i < group2->user_count; i++) {
-        char username[MAX_USERNAME];
-        strncpy(username, group2->users[i], MAX_USERNAME - 1);
-        username[MAX_USERNAME - 1] = '\0';
+    // Transférer tous les utilisateurs et administrateurs de group2 vers group1
+    uint64_t *members1 = group_members(shm, group1);
+    uint64_t *admins1 = group_admins(shm, group1);
+    uint64_t *members2 = group_members(shm, group2);
+    uint64_t *admins2 = group_admins(shm, group2);
+    int words = shm->member_words;
 
-        // Vérifier si l'utilisateur n'est pas déjà dans group1
-        int already_in_group1 = 0;
-        for (int j = 0; j < group1->user_count; j++) {
-            if (strcmp(group1->users[j], username) == 0) {
-                already_in_group1 = 1;
-                break;
-            }
-        }
-
-        if (!already_in_group1) {
-            if (group1->user_count < MAX_CLIENTS) {
-                strncpy(group1->users[group1->user_count], username, MAX_USERNAME - 1);
-                group1->users[group1->user_count][MAX_USERNAME - 1] = '\0';
-                group1->user_count++;
-
-                // Mettre à jour le groupe actuel de l'utilisateur
-                User *user = user_find(shm, username);
-                if (user != NULL) {
-                    strncpy(user->current_group, group1_name, MAX_GROUP_NAME - 1);
-                    user->current_group[MAX_GROUP_NAME - 1] = '\0';
-                }
-            }
-        }
+    for (int word = 0; word < words; word++) {
+        members1[word] |= members2[word];
+        admins1[word] |= admins2[word];
     }
-
-    // Transférer les administrateurs de group2 vers group1
-    for (int i = 0; i < group2->admin_count; i++) {
-        char admin_name[MAX_USERNAME];
-        strncpy(admin_name, group2->admins[i], MAX_USERNAME - 1);
-        admin_name[MAX_USERNAME - 1] = '\0';
-
-        // Vérifier si l'admin n'est pas déjà dans la liste des admins de group1
-        int already_admin = 0;
-        for (int j = 0; j < group1->admin_count; j++) {
-            if (strcmp(group1->admins[j], admin_name) == 0) {
-                already_admin = 1;
-                break;
-            }
-        }
-
-        if (!already_admin && group1->admin_count < MAX_CLIENTS) {
-            strncpy(group1->admins[group1->admin_count], admin_name, MAX_USERNAME - 1);
-            group1->admins[group1->admin_count][MAX_USERNAME - 1] = '\0';
-            group1->admin_count++;
-        }
+    group1->user_count = bitset_count(members1, words);
+    group1->admin_count = bitset_count(admins1, words);
+
+    // Mettre à jour le groupe actuel des anciens membres de group2
+    for (int id = bitset_next(members2, words, 0); id >= 0;
+         id = bitset_next(members2, words, id + 1)) {
+        User *user = shm_user(shm, id);
+        strncpy(user->current_group, group1_name, MAX_GROUP_NAME - 1);
+        user->current_group[MAX_GROUP_NAME - 1] = '\0';
     }
 
-    // Désactiver group2
-    group2->active = 0;
-    group2->user_count = 0;
-    group2->admin_count = 0;
-
-    printf("Groupes %s et %s fusionnés dans %s\n", group1_name, group2_name, group1_name);
+    // Désactiver group2 et libérer son emplacement
+    group_release(shm, group2);
+    shm->user_generation++;
     return 0;
 }
 
 // Vérifier si un utilisateur est administrateur d'un groupe
-int group_is_admin(Group *group, const char *username) {
+int group_is_admin(SharedMemory *shm, Group *group, const char *username) {
     if (group == NULL || username == NULL) {
         return 0;
     }
 
-    for (int i = 0; i < group->admin_count; i++) {
-        if (strcmp(group->admins[i], username) == 0) {
-            return 1;
-        }
-    }
-    return 0;
+    int id = user_get_id(shm, username);
+    return id >= 0 && bitset_test(group_admins(shm, group), id);
 }
 
 // Ajouter un utilisateur comme administrateur
-int group_add_admin(Group *group, const char *username) {
+int group_add_admin(SharedMemory *shm, Group *group, const char *username) {
     if (group == NULL || username == NULL) {
         return -1;
     }
 
     // Vérifier si l'utilisateur est déjà administrateur
-    if (group_is_admin(group, username)) {
+    if (group_is_admin(shm, group, username)) {
         fprintf(stderr, "Utilisateur %s est déjà administrateur\n", username);
         return -1;
     }
 
     // Vérifier si l'utilisateur est dans le groupe
-    int user_in_group = 0;
-    for (int i = 0; i < group->user_count; i++) {
-        if (strcmp(group->users[i], username) == 0) {
-            user_in_group = 1;
-            break;
-        }
-    }
-
-    if (!user_in_group) {
+    int id = user_get_id(shm, username);
+    if (id < 0 || !bitset_test(group_members(shm, group), id)) {
         fprintf(stderr, "Utilisateur %s n'est pas membre du groupe\n", username);
         return -1;
     }
 
     // Ajouter l'utilisateur comme administrateur
-    if (group->admin_count >= MAX_CLIENTS) {
-        fprintf(stderr, "Nombre maximum d'administrateurs atteint\n");
-        return -1;
-    }
-
-    strncpy(group->admins[group->admin_count], username, MAX_USERNAME - 1);
-    group->admins[group->admin_count][MAX_USERNAME - 1] = '\0';
+    bitset_set(group_admins(shm, group), id);
     group->admin_count++;
-
-    printf("Utilisateur %s promu administrateur du groupe %s\n", username, group->name);
+    shm->group_generation++;
     return 0;
 }
 
 // Retirer les droits d'administrateur à un utilisateur
-int group_remove_admin(Group *group, const char *username) {
+int group_remove_admin(SharedMemory *shm, Group *group, const char *username) {
     if (group == NULL || username == NULL) {
         return -1;
     }
 
     // Vérifier si l'utilisateur est administrateur
-    int admin_index = -1;
-    for (int i = 0; i < group->admin_count; i++) {
-        if (strcmp(group->admins[i], username) == 0) {
-            admin_index = i;
-            break;
-        }
-    }
-
-    if (admin_index == -1) {
+    if (!group_is_admin(shm, group, username)) {
         fprintf(stderr, "Utilisateur %s n'est pas administrateur\n", username);
         return -1;
     }
@@ -294,13 +297,10 @@ int group_remove_admin(Group *group, const char *username) {
         return -1;
     }
 
-    // Retirer l'utilisateur de la liste des admins
-    for (int i = admin_index; i < group->admin_count - 1; i++) {
-        strcpy(group->admins[i], group->admins[i + 1]);
-    }
+    // Retirer l'utilisateur de l'ensemble des admins
+    bitset_clear(group_admins(shm, group), user_get_id(shm, username));
     group->admin_count--;
-
-    printf("Utilisateur %s n'est plus administrateur du groupe %s\n", username, group->name);
+    shm->group_generation++;
     return 0;
 }
 
@@ -311,18 +311,86 @@ int group_kick_user(SharedMemory *shm, const char *group_name, const char *usern
         return -1;
     }
 
-    // Retirer l'utilisateur de la liste des admins s'il en fait partie
-    for (int i = 0; i < group->admin_count; i++) {
-        if (strcmp(group->admins[i], username) == 0) {
-            // Décaler les admins suivants
-            for (int j = i; j < group->admin_count - 1; j++) {
-                strcpy(group->admins[j], group->admins[j + 1]);
-            }
-            group->admin_count--;
-            break;
-        }
+    // Retirer l'utilisateur de l'ensemble des admins s'il en fait partie
+    int id = user_get_id(shm, username);
+    if (id >= 0 && bitset_test(group_admins(shm, group), id)) {
+        bitset_clear(group_admins(shm, group), id);
+        group->admin_count--;
+        shm->group_generation++;
     }
 
     // Retirer l'utilisateur du groupe
-    return group_remove_user(shm, group_name, username);
+    return group_remove_member(shm, group, username);
+}
+
+// ========== Historique des groupes ==========
+
+// Ajoute un message public à l'historique du groupe de l'emplacement slot.
+// Appelé après une section de lecture, sans verrou : la case est réservée
+// par un incrément atomique et protégée par son propre numéro de séquence.
+// incarnation, lue dans la section de lecture, est revérifiée après la
+// réservation : si le groupe a été libéré ou recréé entre-temps, le message
+// est abandonné. Une réservation faite avant la libération porte un numéro
+// antérieur à history_first et reste invisible pour le groupe recréé.
+void group_history_append(SharedMemory *shm, int slot, uint32_t incarnation, const Message *msg) {
+    if (shm->history_size == 0) {
+        return;
+    }
+
+    Group *group = shm_group(shm, slot);
+    HistoryEntry *ring = shm_history(shm, slot);
+    uint64_t n = __atomic_fetch_add(&group->history_next, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&group->incarnation, __ATOMIC_SEQ_CST) != incarnation) {
+        return;
+    }
+    HistoryEntry *entry = &ring[n % shm->history_size];
+
+    __atomic_store_n(&entry->seq, 2 * n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    entry->timestamp = (int64_t)msg->timestamp;
+    memcpy(entry->sender, msg->sender, MAX_USERNAME);
+    memcpy(entry->content, msg->content, MAX_MESSAGE);
+    __atomic_store_n(&entry->seq, 2 * n + 2, __ATOMIC_RELEASE);
+}
+
+// Ajoute à l'outbox l'envoi des derniers messages du groupe à un membre,
+// du plus ancien au plus récent. Les cases en cours d'écriture ou déjà
+// réécrites sont sautées. Retourne le nombre de messages envoyés.
+int group_history_replay(Outbox *ob, SharedMemory *shm, Group *group,
+                         const char *username, const struct sockaddr_in *addr) {
+    if (shm->history_size == 0) {
+        return 0;
+    }
+
+    HistoryEntry *ring = shm_history(shm, shm_group_slot(shm, group));
+    uint64_t next = __atomic_load_n(&group->history_next, __ATOMIC_ACQUIRE);
+    uint64_t first = next > (uint64_t)shm->history_size ? next - shm->history_size : 0;
+    if (first < group->history_first) {
+        first = group->history_first;
+    }
+    int count = 0;
+
+    Message msg;
+    message_create(&msg, MSG_PUBLIC, "", NULL, group->name, "");
+
+    for (uint64_t n = first; n < next; n++) {
+        HistoryEntry *entry = &ring[n % shm->history_size];
+        if (__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != 2 * n + 2) {
+            continue;
+        }
+        msg.timestamp = (time_t)entry->timestamp;
+        memcpy(msg.sender, entry->sender, MAX_USERNAME);
+        memcpy(msg.content, entry->content, MAX_MESSAGE);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != 2 * n + 2) {
+            continue;
+        }
+        msg.sender[MAX_USERNAME - 1] = '\0';
+        msg.content[MAX_MESSAGE - 1] = '\0';
+
+        if (outbox_send(ob, &msg, username, addr) == 0) {
+            count++;
+        }
+    }
+    return count;
 }
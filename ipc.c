@@ -1,4 +1,5 @@
 #include "messaging.h"
+#include <sched.h>
 
 // ========== Gestion de la mémoire partagée ==========
 
@@ -13,8 +14,9 @@ int shm_create(key_t key, size_t size) {
 
 int shm_attach(int shmid, SharedMemory **shm) {
     *shm = (SharedMemory *)shmat(shmid, NULL, 0);
-    if ((int)(*shm) == -1) {
+    if (*shm == (void *)-1) {
         perror("Erreur shmat");
+        *shm = NULL;
         return -1;
     }
     return 0;
@@ -36,58 +38,202 @@ int shm_destroy(int shmid) {
     return 0;
 }
 
-// ========== Gestion des sémaphores ==========
+// ========== Disposition de la mémoire partagée ==========
 
-int sem_create(key_t key) {
-    int semid = semget(key, 1, IPC_CREAT | 0666);
-    if (semid == -1) {
-        perror("Erreur semget");
+static int next_power_of_two(int n) {
+    int p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+static size_t align_up(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+// Remplit l'en-tête layout pour les capacités demandées et retourne la
+// taille totale du segment. Les compteurs et tables ne sont pas touchés.
+size_t shm_layout_init(SharedMemory *layout, int max_users, int max_groups, int history_size) {
+    memset(layout, 0, sizeof(*layout));
+    layout->magic = SHM_MAGIC;
+    layout->version = SHM_LAYOUT_VERSION;
+    layout->max_users = max_users;
+    layout->max_groups = max_groups;
+    layout->member_words = (max_users + 63) / 64;
+    layout->user_hash_size = next_power_of_two(2 * max_users);
+    layout->group_hash_size = next_power_of_two(2 * max_groups);
+    layout->history_size = history_size;
+    layout->group_stride = align_up(sizeof(Group) + 2 * layout->member_words * sizeof(uint64_t));
+
+    size_t offset = align_up(sizeof(SharedMemory));
+    layout->users_offset = offset;
+    offset = align_up(offset + (size_t)max_users * sizeof(User));
+    layout->groups_offset = offset;
+    offset = align_up(offset + (size_t)max_groups * layout->group_stride);
+    layout->user_index_offset = offset;
+    offset = align_up(offset + (size_t)layout->user_hash_size * sizeof(int));
+    layout->group_index_offset = offset;
+    offset = align_up(offset + (size_t)layout->group_hash_size * sizeof(int));
+    layout->group_free_offset = offset;
+    offset = align_up(offset + (size_t)max_groups * sizeof(int));
+    layout->history_offset = offset;
+    offset = align_up(offset + (size_t)max_groups * history_size * sizeof(HistoryEntry));
+    layout->subscribers_offset = offset;
+    offset = align_up(offset + (size_t)layout->member_words * sizeof(uint64_t));
+
+    layout->total_size = offset;
+    return offset;
+}
+
+// Vérifie qu'un segment attaché porte un en-tête cohérent avec sa taille
+int shm_layout_check(const SharedMemory *shm, size_t segment_size) {
+    if (segment_size < sizeof(SharedMemory) ||
+        shm->magic != SHM_MAGIC ||
+        shm->version != SHM_LAYOUT_VERSION ||
+        shm->total_size > segment_size) {
         return -1;
     }
-    return semid;
+    return 0;
 }
 
-int sem_init(int semid, int value) {
-    union semun arg;
-    arg.val = value;
-    
-    if (semctl(semid, 0, SETVAL, arg) == -1) {
-        perror("Erreur semctl SETVAL");
+// Recopie utilisateurs et groupes de src vers dst (déjà initialisé avec
+// shm_layout_init et mis à zéro), éventuellement de capacités différentes
+int shm_migrate(SharedMemory *dst, SharedMemory *src) {
+    if (src->user_count > dst->max_users || src->group_count > dst->max_groups) {
+        fprintf(stderr, "Capacités insuffisantes : %d utilisateurs et %d groupes à conserver\n",
+                src->user_count, src->group_count);
         return -1;
     }
+
+    for (int i = 0; i < src->user_count; i++) {
+        *shm_user(dst, i) = *shm_user(src, i);
+    }
+
+    // Les identifiants d'utilisateurs sont conservés, il suffit de recopier
+    // les ensembles de bits sur la plus petite des deux largeurs
+    int words = src->member_words < dst->member_words ? src->member_words : dst->member_words;
+    for (int i = 0; i < src->group_count; i++) {
+        Group *from = shm_group(src, i);
+        Group *to = shm_group(dst, i);
+        memcpy(to->name, from->name, sizeof(to->name));
+        to->user_count = from->user_count;
+        to->admin_count = from->admin_count;
+        to->active = from->active;
+        memcpy(to->color, from->color, sizeof(to->color));
+        memcpy(group_members(dst, to), group_members(src, from), words * sizeof(uint64_t));
+        memcpy(group_admins(dst, to), group_admins(src, from), words * sizeof(uint64_t));
+
+        // Garder les derniers messages qui tiennent dans le nouvel historique,
+        // avec leurs numéros
+        uint64_t next = from->history_next;
+        uint64_t kept = (uint64_t)(src->history_size < dst->history_size ?
+                                   src->history_size : dst->history_size);
+        to->history_next = next;
+        to->history_first = from->history_first;
+        to->incarnation = from->incarnation;
+        for (uint64_t n = next > kept ? next - kept : 0; n < next; n++) {
+            HistoryEntry *entry = &shm_history(src, i)[n % src->history_size];
+            if (entry->seq == 2 * n + 2) {
+                shm_history(dst, i)[n % dst->history_size] = *entry;
+            }
+        }
+    }
+
+    dst->user_count = src->user_count;
+    dst->group_count = src->group_count;
+    // Les abonnements ne survivent pas au redémarrage, mais la version de
+    // l'annuaire ne doit pas revenir en arrière
+    dst->directory_version = src->directory_version;
+    user_index_rebuild(dst);
+    group_index_rebuild(dst);
     return 0;
 }
 
-int sem_p(int semid) {
-    struct sembuf op;
-    op.sem_num = 0;
-    op.sem_op = -1;  // Décrémente (P operation)
-    op.sem_flg = 0;
-    
-    if (semop(semid, &op, 1) == -1) {
-        perror("Erreur semop P");
+// ========== Verrou de la mémoire partagée ==========
+
+// (Ré)initialise le verrou du segment. Appelé par le serveur à chaque
+// démarrage : un verrou laissé par une instance précédente est remis à zéro.
+int shm_lock_init(SharedMemory *shm) {
+    pthread_mutexattr_t attr;
+    int err = pthread_mutexattr_init(&attr);
+    if (err == 0) {
+        err = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    }
+    if (err == 0) {
+        err = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    }
+    if (err == 0) {
+        err = pthread_mutex_init(&shm->lock, &attr);
+    }
+    pthread_mutexattr_destroy(&attr);
+
+    if (err != 0) {
+        fprintf(stderr, "Erreur pthread_mutex_init: %s\n", strerror(err));
         return -1;
     }
+
+    // Une écriture interrompue a pu laisser le numéro de séquence impair
+    shm->seq += shm->seq & 1;
     return 0;
 }
 
-int sem_v(int semid) {
-    struct sembuf op;
-    op.sem_num = 0;
-    op.sem_op = 1;   // Incrémente (V operation)
-    op.sem_flg = 0;
-    
-    if (semop(semid, &op, 1) == -1) {
-        perror("Erreur semop V");
+int shm_lock(SharedMemory *shm) {
+    int err = pthread_mutex_lock(&shm->lock);
+    if (err == EOWNERDEAD) {
+        // Le détenteur est mort en section critique : les compteurs sont
+        // cohérents mais les index peuvent être à moitié mis à jour
+        fprintf(stderr, "Verrou récupéré après la mort de son détenteur, reconstruction des index\n");
+        user_index_rebuild(shm);
+        group_index_rebuild(shm);
+        __atomic_store_n(&shm->seq, shm->seq + (shm->seq & 1), __ATOMIC_RELEASE);
+        err = pthread_mutex_consistent(&shm->lock);
+    }
+    if (err != 0) {
+        fprintf(stderr, "Erreur pthread_mutex_lock: %s\n", strerror(err));
         return -1;
     }
     return 0;
 }
 
-int sem_destroy(int semid) {
-    if (semctl(semid, 0, IPC_RMID, NULL) == -1) {
-        perror("Erreur semctl IPC_RMID");
+int shm_unlock(SharedMemory *shm) {
+    int err = pthread_mutex_unlock(&shm->lock);
+    if (err != 0) {
+        fprintf(stderr, "Erreur pthread_mutex_unlock: %s\n", strerror(err));
         return -1;
     }
     return 0;
 }
+
+// Section d'écriture : les écrivains s'excluent par le verrou et rendent le
+// numéro de séquence impair le temps de la modification
+int shm_write_begin(SharedMemory *shm) {
+    if (shm_lock(shm) == -1) {
+        return -1;
+    }
+    __atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return 0;
+}
+
+int shm_write_end(SharedMemory *shm) {
+    __atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+    return shm_unlock(shm);
+}
+
+// Section de lecture : attend un numéro pair et le retourne. Le lecteur
+// copie ce dont il a besoin puis appelle shm_read_retry ; si une écriture a
+// eu lieu entre-temps, la copie est à refaire. Un lecteur ne bloque jamais
+// un écrivain, et les valeurs lues avant validation peuvent être incohérentes.
+uint32_t shm_read_begin(const SharedMemory *shm) {
+    uint32_t seq;
+    while ((seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE)) & 1) {
+        sched_yield();
+    }
+    return seq;
+}
+
+int shm_read_retry(const SharedMemory *shm, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&shm->seq, __ATOMIC_RELAXED) != seq;
+}
@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+#include "messaging.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// ========== Décodeur du journal binaire ==========
+
+// Lit server.events (et server.events.data) produits par ./server -b et les
+// affiche en texte ou en CSV, éventuellement filtrés par type d'événement
+// et par intervalle de temps.
+
+typedef struct {
+    char **names;
+    int count;
+} NameTable;
+
+typedef struct {
+    const unsigned char *base;
+    size_t size;
+} Mapping;
+
+static int map_file(const char *path, Mapping *map) {
+    map->base = NULL;
+    map->size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror(path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("Erreur fstat");
+        close(fd);
+        return -1;
+    }
+
+    map->size = (size_t)st.st_size;
+    if (map->size > 0) {
+        void *base = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            perror("Erreur mmap");
+            close(fd);
+            return -1;
+        }
+        map->base = base;
+    }
+    close(fd);
+    return 0;
+}
+
+static void name_set(NameTable *table, int id, const char *name, size_t len) {
+    if (id < 0) {
+        return;
+    }
+    if (id >= table->count) {
+        int new_count = table->count > 0 ? table->count : 64;
+        while (new_count <= id) {
+            new_count *= 2;
+        }
+        char **grown = realloc(table->names, new_count * sizeof(char *));
+        if (grown == NULL) {
+            perror("Erreur realloc");
+            return;
+        }
+        memset(grown + table->count, 0, (new_count - table->count) * sizeof(char *));
+        table->names = grown;
+        table->count = new_count;
+    }
+    free(table->names[id]);
+    table->names[id] = strndup(name, len);
+}
+
+static const char *name_get(const NameTable *table, int id) {
+    if (id < 0 || id >= table->count || table->names[id] == NULL) {
+        return "";
+    }
+    return table->names[id];
+}
+
+// Accepte un nombre de secondes depuis l'époque ou "AAAA-MM-JJ HH:MM:SS"
+static int parse_time(const char *str, uint64_t *ns) {
+    char *end;
+    unsigned long long seconds = strtoull(str, &end, 10);
+
+    if (*end != '\0') {
+        struct tm tm_info;
+        memset(&tm_info, 0, sizeof(tm_info));
+        end = strptime(str, "%Y-%m-%d %H:%M:%S", &tm_info);
+        if (end == NULL || *end != '\0') {
+            return -1;
+        }
+        tm_info.tm_isdst = -1;
+        seconds = (unsigned long long)mktime(&tm_info);
+    }
+    *ns = seconds * 1000000000ull;
+    return 0;
+}
+
+// Liste de types séparés par des virgules : JOIN,PUBLIC,...
+static int parse_types(char *list, int *selected) {
+    for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+        int type;
+        for (type = 0; type < EVT_COUNT; type++) {
+            if (strcmp(name, log_event_name(type)) == 0) {
+                break;
+            }
+        }
+        if (type == EVT_COUNT) {
+            fprintf(stderr, "Type d'événement inconnu : %s\n", name);
+            return -1;
+        }
+        selected[type] = 1;
+    }
+    return 0;
+}
+
+static void print_csv_field(const char *str, size_t len) {
+    putchar('"');
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] == '"') {
+            putchar('"');
+        }
+        putchar(str[i]);
+    }
+    putchar('"');
+}
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-c] [-t TYPE[,TYPE...]] [-s début] [-e fin] [fichier]\n", prog);
+    fprintf(stderr, "  -c  sortie CSV (texte par défaut)\n");
+    fprintf(stderr, "  -t  types à afficher (ex. JOIN,PUBLIC)\n");
+    fprintf(stderr, "  -s  -e  bornes : secondes depuis l'époque ou \"AAAA-MM-JJ HH:MM:SS\"\n");
+    fprintf(stderr, "  fichier : %s par défaut\n", SERVER_EVENT_FILE);
+}
+
+int main(int argc, char **argv) {
+    const char *path = SERVER_EVENT_FILE;
+    int csv = 0;
+    int selected[EVT_COUNT] = { 0 };
+    int filter_types = 0;
+    uint64_t start_ns = 0;
+    uint64_t end_ns = UINT64_MAX;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ct:s:e:")) != -1) {
+        switch (opt) {
+            case 'c':
+                csv = 1;
+                break;
+            case 't':
+                if (parse_types(optarg, selected) == -1) {
+                    return EXIT_FAILURE;
+                }
+                filter_types = 1;
+                break;
+            case 's':
+            case 'e':
+                if (parse_time(optarg, opt == 's' ? &start_ns : &end_ns) == -1) {
+                    fprintf(stderr, "Date invalide : %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc) {
+        path = argv[optind];
+    }
+
+    // Sans -t, les enregistrements techniques ne sont pas affichés
+    if (!filter_types) {
+        for (int type = 0; type < EVT_COUNT; type++) {
+            selected[type] = 1;
+        }
+        selected[EVT_SESSION] = 0;
+        selected[EVT_USER_NAME] = 0;
+        selected[EVT_GROUP_NAME] = 0;
+    }
+
+    char data_path[512];
+    snprintf(data_path, sizeof(data_path), "%s.data", path);
+
+    Mapping events, data;
+    if (map_file(path, &events) == -1 || map_file(data_path, &data) == -1) {
+        return EXIT_FAILURE;
+    }
+
+    const EventLogHeader *header = (const EventLogHeader *)events.base;
+    if (events.size < sizeof(EventLogHeader) ||
+        memcmp(header->magic, EVENT_LOG_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != EVENT_LOG_VERSION ||
+        header->record_size != sizeof(EventRecord)) {
+        fprintf(stderr, "%s n'est pas un journal binaire reconnu\n", path);
+        return EXIT_FAILURE;
+    }
+
+    NameTable users = { NULL, 0 };
+    NameTable groups = { NULL, 0 };
+    uint64_t anchor_real = 0;   // Heure murale de la session courante
+    uint64_t anchor_mono = 0;
+    size_t record_count = (events.size - sizeof(EventLogHeader)) / sizeof(EventRecord);
+    const EventRecord *records = (const EventRecord *)(events.base + sizeof(EventLogHeader));
+
+    if (csv) {
+        printf("time,type,user_id,user,target_id,target,group_id,group,content\n");
+    }
+
+    for (size_t i = 0; i < record_count; i++) {
+        const EventRecord *rec = &records[i];
+        const char *content = "";
+        size_t content_len = 0;
+
+        if (rec->content_len > 0 && rec->content_offset + rec->content_len <= data.size) {
+            content = (const char *)data.base + rec->content_offset;
+            content_len = rec->content_len;
+        }
+
+        // Les enregistrements techniques s'appliquent aux suivants
+        switch (rec->type) {
+            case EVT_SESSION: {
+                char anchor[32];
+                size_t len = content_len < sizeof(anchor) - 1 ? content_len : sizeof(anchor) - 1;
+                memcpy(anchor, content, len);
+                anchor[len] = '\0';
+                anchor_real = strtoull(anchor, NULL, 10);
+                anchor_mono = rec->timestamp_ns;
+                break;
+            }
+            case EVT_USER_NAME:
+                name_set(&users, rec->user_id, content, content_len);
+                break;
+            case EVT_GROUP_NAME:
+                name_set(&groups, rec->group_id, content, content_len);
+                break;
+            default:
+                break;
+        }
+
+        uint64_t real_ns = anchor_real + (rec->timestamp_ns - anchor_mono);
+        if (rec->type >= EVT_COUNT || !selected[rec->type] ||
+            real_ns < start_ns || real_ns > end_ns) {
+            continue;
+        }
+
+        time_t seconds = (time_t)(real_ns / 1000000000ull);
+        struct tm tm_info;
+        char time_str[64];
+        localtime_r(&seconds, &tm_info);
+        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm_info);
+        int millis = (int)(real_ns / 1000000ull % 1000);
+
+        const char *user = name_get(&users, rec->user_id);
+        const char *target = name_get(&users, rec->target_id);
+        const char *group = name_get(&groups, rec->group_id);
+
+        if (csv) {
+            printf("%s.%03d,%s,%d,", time_str, millis, log_event_name(rec->type), rec->user_id);
+            print_csv_field(user, strlen(user));
+            printf(",%d,", rec->target_id);
+            print_csv_field(target, strlen(target));
+            printf(",%d,", rec->group_id);
+            print_csv_field(group, strlen(group));
+            putchar(',');
+            print_csv_field(content, content_len);
+            putchar('\n');
+        } else {
+            printf("[%s.%03d] [%s]", time_str, millis, log_event_name(rec->type));
+            if (rec->user_id >= 0) {
+                printf(" user=%s", user);
+            }
+            if (rec->target_id >= 0) {
+                printf(" target=%s", target);
+            }
+            if (rec->group_id >= 0) {
+                printf(" group=%s", group);
+            }
+            if (content_len > 0) {
+                printf(" %.*s", (int)content_len, content);
+            }
+            putchar('\n');
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
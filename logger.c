@@ -0,0 +1,329 @@
+#include "messaging.h"
+#include <pthread.h>
+
+// ========== Journal asynchrone ==========
+
+// Les workers déposent des enregistrements de taille fixe dans un anneau
+// sans verrou (plusieurs producteurs, un consommateur) ; un thread de fond
+// les formate et les écrit par lots, avec un seul fflush par lot.
+//
+// Chaque case porte un numéro de séquence : seq == pos quand elle est libre
+// pour l'écriture de rang pos, seq == pos + 1 quand elle est publiée. Quand
+// l'anneau est plein, l'entrée est abandonnée et comptée : la mémoire reste
+// bornée et les workers ne bloquent jamais sur le disque.
+//
+// En format binaire, chaque entrée devient un EventRecord de taille fixe et
+// son contenu éventuel est ajouté au fichier .data ; rien n'est formaté.
+
+typedef struct {
+    size_t seq;
+    int type;
+    int user_id;
+    int target_id;
+    int group_id;
+    time_t timestamp;        // Horloge murale (format texte)
+    uint64_t monotonic_ns;   // Horloge monotone (format binaire)
+    char details[LOG_DETAILS_SIZE];
+} LogRecord;
+
+static struct {
+    LogRecord *ring;
+    size_t mask;
+    size_t head;         // Prochain rang à réserver (producteurs)
+    size_t tail;         // Prochain rang à lire (thread de fond seul)
+    uint64_t dropped;    // Entrées perdues, file pleine
+    uint64_t reported;   // Pertes déjà signalées dans le fichier
+    int format;
+    FILE *file;          // server.log ou enregistrements binaires
+    FILE *data;          // Contenu du journal binaire
+    uint64_t data_offset;
+    pthread_t thread;
+    int running;
+    int stop;
+} g_log;
+
+static const char *g_event_names[EVT_COUNT] = {
+    [EVT_SERVER] = "SERVER",
+    [EVT_LOG] = "LOG",
+    [EVT_SESSION] = "SESSION",
+    [EVT_USER_NAME] = "USER_NAME",
+    [EVT_GROUP_NAME] = "GROUP_NAME",
+    [EVT_CONNECT] = "CONNECT",
+    [EVT_DISCONNECT] = "DISCONNECT",
+    [EVT_JOIN] = "JOIN",
+    [EVT_JOIN_FAIL] = "JOIN_FAIL",
+    [EVT_LEAVE] = "LEAVE",
+    [EVT_PUBLIC] = "PUBLIC",
+    [EVT_PRIVATE] = "PRIVATE",
+    [EVT_CREATE_GROUP] = "CREATE_GROUP",
+    [EVT_MERGE_GROUPS] = "MERGE_GROUPS",
+    [EVT_MERGE_GROUPS_DENIED] = "MERGE_GROUPS_DENIED",
+    [EVT_CHANGE_COLOR] = "CHANGE_COLOR",
+    [EVT_CHANGE_COLOR_DENIED] = "CHANGE_COLOR_DENIED",
+    [EVT_KICK_USER] = "KICK_USER",
+    [EVT_KICK_DENIED] = "KICK_DENIED",
+    [EVT_PROMOTE_ADMIN] = "PROMOTE_ADMIN",
+    [EVT_PROMOTE_DENIED] = "PROMOTE_DENIED",
+    [EVT_DEMOTE_ADMIN] = "DEMOTE_ADMIN",
+    [EVT_DEMOTE_DENIED] = "DEMOTE_DENIED",
+};
+
+const char *log_event_name(int type) {
+    if (type < 0 || type >= EVT_COUNT || g_event_names[type] == NULL) {
+        return "UNKNOWN";
+    }
+    return g_event_names[type];
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void logger_write(const LogRecord *rec) {
+    if (g_log.format == LOG_FORMAT_BINARY) {
+        EventRecord out;
+        size_t len = strnlen(rec->details, LOG_DETAILS_SIZE);
+
+        memset(&out, 0, sizeof(out));
+        out.timestamp_ns = rec->monotonic_ns;
+        out.content_offset = g_log.data_offset;
+        out.user_id = rec->user_id;
+        out.target_id = rec->target_id;
+        out.group_id = rec->group_id;
+        out.content_len = (uint32_t)len;
+        out.type = (uint32_t)rec->type;
+
+        if (len > 0) {
+            fwrite(rec->details, 1, len, g_log.data);
+            g_log.data_offset += len;
+        }
+        fwrite(&out, sizeof(out), 1, g_log.file);
+        return;
+    }
+
+    struct tm tm_info;
+    char time_str[64];
+
+    localtime_r(&rec->timestamp, &tm_info);
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm_info);
+    fprintf(g_log.file, "[%s] [%s] %s\n", time_str, log_event_name(rec->type), rec->details);
+}
+
+// Écrit toutes les entrées publiées ; retourne leur nombre
+static int logger_drain(void) {
+    int count = 0;
+
+    while (1) {
+        LogRecord *rec = &g_log.ring[g_log.tail & g_log.mask];
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != g_log.tail + 1) {
+            break;
+        }
+        logger_write(rec);
+        // Rendre la case au tour suivant de l'anneau
+        __atomic_store_n(&rec->seq, g_log.tail + g_log.mask + 1, __ATOMIC_RELEASE);
+        g_log.tail++;
+        count++;
+    }
+
+    uint64_t dropped = __atomic_load_n(&g_log.dropped, __ATOMIC_RELAXED);
+    if (dropped != g_log.reported) {
+        LogRecord lost;
+        memset(&lost, 0, sizeof(lost));
+        lost.type = EVT_LOG;
+        lost.user_id = lost.target_id = lost.group_id = -1;
+        lost.timestamp = time(NULL);
+        lost.monotonic_ns = monotonic_ns();
+        snprintf(lost.details, sizeof(lost.details), "%llu entrée(s) perdue(s), file du journal pleine",
+                 (unsigned long long)(dropped - g_log.reported));
+        logger_write(&lost);
+        g_log.reported = dropped;
+        count++;
+    }
+
+    if (count > 0) {
+        if (g_log.data != NULL) {
+            fflush(g_log.data);
+        }
+        fflush(g_log.file);
+    }
+    return count;
+}
+
+static void *logger_run(void *arg) {
+    (void)arg;
+    struct timespec pause = { 0, LOG_FLUSH_INTERVAL_MS * 1000000L };
+
+    while (!__atomic_load_n(&g_log.stop, __ATOMIC_ACQUIRE)) {
+        if (logger_drain() == 0) {
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    // Vidage final : les producteurs sont arrêtés
+    logger_drain();
+    return NULL;
+}
+
+// Ouvre le journal binaire et son fichier .data en ajout ; l'en-tête n'est
+// écrit que dans un fichier vide
+static int logger_open_binary(const char *path) {
+    char data_path[512];
+    snprintf(data_path, sizeof(data_path), "%s.data", path);
+
+    g_log.file = fopen(path, "ab");
+    g_log.data = fopen(data_path, "ab");
+    if (g_log.file == NULL || g_log.data == NULL) {
+        perror("Erreur lors de l'ouverture du journal binaire");
+        return -1;
+    }
+
+    fseek(g_log.data, 0, SEEK_END);
+    g_log.data_offset = (uint64_t)ftell(g_log.data);
+
+    fseek(g_log.file, 0, SEEK_END);
+    if (ftell(g_log.file) == 0) {
+        EventLogHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic));
+        header.version = EVENT_LOG_VERSION;
+        header.record_size = sizeof(EventRecord);
+        fwrite(&header, sizeof(header), 1, g_log.file);
+    }
+    return 0;
+}
+
+// Ouvre le journal path dans le format demandé et démarre le thread de
+// fond ; capacity est arrondie à une puissance de 2
+int logger_start(const char *path, int format, int capacity) {
+    size_t size = 1;
+    while (size < (size_t)capacity) {
+        size <<= 1;
+    }
+
+    g_log.format = format;
+    g_log.data = NULL;
+    if (format == LOG_FORMAT_BINARY) {
+        if (logger_open_binary(path) == -1) {
+            logger_stop();
+            return -1;
+        }
+    } else {
+        g_log.file = fopen(path, "a");
+        if (g_log.file == NULL) {
+            perror("Erreur lors de l'ouverture du fichier de log");
+            return -1;
+        }
+    }
+
+    g_log.ring = malloc(size * sizeof(LogRecord));
+    if (g_log.ring == NULL) {
+        perror("Erreur malloc");
+        logger_stop();
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        g_log.ring[i].seq = i;
+    }
+    g_log.mask = size - 1;
+    g_log.head = 0;
+    g_log.tail = 0;
+    g_log.dropped = 0;
+    g_log.reported = 0;
+    g_log.stop = 0;
+
+    int err = pthread_create(&g_log.thread, NULL, logger_run, NULL);
+    if (err != 0) {
+        fprintf(stderr, "Erreur pthread_create: %s\n", strerror(err));
+        logger_stop();
+        return -1;
+    }
+    g_log.running = 1;
+
+    if (format == LOG_FORMAT_BINARY) {
+        // Ancre pour convertir les horodatages monotones en heure murale
+        struct timespec now;
+        char anchor[32];
+        clock_gettime(CLOCK_REALTIME, &now);
+        snprintf(anchor, sizeof(anchor), "%llu",
+                 (unsigned long long)now.tv_sec * 1000000000ull + (unsigned long long)now.tv_nsec);
+        log_post(EVT_SESSION, -1, -1, -1, anchor);
+    }
+    return 0;
+}
+
+// Format du journal en cours, ou -1 si aucun journal n'est ouvert
+int logger_format(void) {
+    return g_log.running ? g_log.format : -1;
+}
+
+// Dépose une entrée sans bloquer ; retourne -1 si elle est perdue. En
+// format binaire, details est le contenu brut de l'événement.
+int log_post(LogEventType type, int user_id, int target_id, int group_id, const char *details) {
+    if (!g_log.running) {
+        return -1;
+    }
+
+    size_t pos = __atomic_load_n(&g_log.head, __ATOMIC_RELAXED);
+    LogRecord *rec;
+
+    while (1) {
+        rec = &g_log.ring[pos & g_log.mask];
+        size_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            // Case libre : la réserver (pos est rechargé en cas d'échec)
+            if (__atomic_compare_exchange_n(&g_log.head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Anneau plein : abandonner l'entrée la plus récente
+            __atomic_fetch_add(&g_log.dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        } else {
+            pos = __atomic_load_n(&g_log.head, __ATOMIC_RELAXED);
+        }
+    }
+
+    rec->type = type;
+    rec->user_id = user_id;
+    rec->target_id = target_id;
+    rec->group_id = group_id;
+    if (g_log.format == LOG_FORMAT_BINARY) {
+        rec->monotonic_ns = monotonic_ns();
+    } else {
+        rec->timestamp = time(NULL);
+    }
+    strncpy(rec->details, details != NULL ? details : "", LOG_DETAILS_SIZE - 1);
+    rec->details[LOG_DETAILS_SIZE - 1] = '\0';
+
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+uint64_t logger_dropped(void) {
+    return __atomic_load_n(&g_log.dropped, __ATOMIC_RELAXED);
+}
+
+// Écrit les entrées restantes, arrête le thread de fond et ferme le
+// journal. À appeler une fois que plus aucun thread ne dépose d'entrée.
+void logger_stop(void) {
+    if (g_log.running) {
+        __atomic_store_n(&g_log.stop, 1, __ATOMIC_RELEASE);
+        pthread_join(g_log.thread, NULL);
+        g_log.running = 0;
+    }
+    free(g_log.ring);
+    g_log.ring = NULL;
+    if (g_log.data != NULL) {
+        fclose(g_log.data);
+        g_log.data = NULL;
+    }
+    if (g_log.file != NULL) {
+        fclose(g_log.file);
+        g_log.file = NULL;
+    }
+}
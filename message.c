@@ -29,6 +29,161 @@ void message_create(Message *msg, MessageType type, const char *sender,
     msg->timestamp = time(NULL);
 }
 
+// Format sur le réseau (entiers en big-endian) :
+//   [0] version  [1] type  [2] champs présents  [3] drapeaux
+//   [4..11] horodatage (64 bits)
+//   si WIRE_FLAG_SEQ : session (32 bits), numéro de séquence (32 bits)
+//   si WIRE_FLAG_ACK : session acquittée, prochain numéro attendu, masque
+//   des numéros suivants déjà reçus (32 bits chacun) ; voir reliable.c
+//   puis, pour chaque champ présent : sender, recipient, group (longueur
+//   sur 1 octet + octets), content (longueur sur 2 octets + octets)
+// Seuls les champs non vides sont transmis, sans '\0' final.
+// Un datagramme de type MSG_BUNDLE (sans champs) regroupe après son en-tête
+// plusieurs messages encodés, chacun précédé de sa longueur sur 2 octets.
+static unsigned char *wire_put_string(unsigned char *p, const char *str, size_t len, int wide) {
+    if (wide) {
+        *p++ = (unsigned char)(len >> 8);
+    }
+    *p++ = (unsigned char)(len & 0xff);
+    memcpy(p, str, len);
+    return p + len;
+}
+
+static const unsigned char *wire_get_string(const unsigned char *p, const unsigned char *end,
+                                            char *dest, size_t dest_size, int wide) {
+    size_t len;
+
+    if (p + (wide ? 2 : 1) > end) {
+        return NULL;
+    }
+    if (wide) {
+        len = ((size_t)p[0] << 8) | p[1];
+        p += 2;
+    } else {
+        len = *p++;
+    }
+
+    if (len >= dest_size || p + len > end) {
+        return NULL;
+    }
+    memcpy(dest, p, len);
+    dest[len] = '\0';
+    return p + len;
+}
+
+ssize_t message_encode(const Message *msg, unsigned char *buf, size_t size) {
+    size_t sender_len = strnlen(msg->sender, MAX_USERNAME - 1);
+    size_t recipient_len = strnlen(msg->recipient, MAX_USERNAME - 1);
+    size_t group_len = strnlen(msg->group, MAX_GROUP_NAME - 1);
+    size_t content_len = strnlen(msg->content, MAX_MESSAGE - 1);
+
+    unsigned char fields = 0;
+    size_t needed = WIRE_HEADER_SIZE;
+    if (sender_len > 0)    { fields |= WIRE_FIELD_SENDER;    needed += 1 + sender_len; }
+    if (recipient_len > 0) { fields |= WIRE_FIELD_RECIPIENT; needed += 1 + recipient_len; }
+    if (group_len > 0)     { fields |= WIRE_FIELD_GROUP;     needed += 1 + group_len; }
+    if (content_len > 0)   { fields |= WIRE_FIELD_CONTENT;   needed += 2 + content_len; }
+
+    if (needed > size) {
+        return -1;
+    }
+
+    unsigned char *p = buf;
+    *p++ = WIRE_VERSION;
+    *p++ = (unsigned char)msg->type;
+    *p++ = fields;
+    *p++ = 0;
+
+    uint64_t ts = (uint64_t)(int64_t)msg->timestamp;
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        *p++ = (unsigned char)(ts >> shift);
+    }
+
+    if (fields & WIRE_FIELD_SENDER)    p = wire_put_string(p, msg->sender, sender_len, 0);
+    if (fields & WIRE_FIELD_RECIPIENT) p = wire_put_string(p, msg->recipient, recipient_len, 0);
+    if (fields & WIRE_FIELD_GROUP)     p = wire_put_string(p, msg->group, group_len, 0);
+    if (fields & WIRE_FIELD_CONTENT)   p = wire_put_string(p, msg->content, content_len, 1);
+
+    return p - buf;
+}
+
+int message_decode(Message *msg, const unsigned char *buf, size_t len) {
+    const unsigned char *end = buf + len;
+    const unsigned char *p = buf;
+
+    if (len < WIRE_HEADER_SIZE || buf[0] != WIRE_VERSION) {
+        return -1;
+    }
+
+    msg->type = (MessageType)buf[1];
+    unsigned char fields = buf[2];
+    unsigned char flags = buf[3];
+    p += 4;
+
+    uint64_t ts = 0;
+    for (int i = 0; i < 8; i++) {
+        ts = (ts << 8) | *p++;
+    }
+    msg->timestamp = (time_t)(int64_t)ts;
+
+    // Les blocs de la couche de fiabilité ont déjà été traités
+    size_t extra = ((flags & WIRE_FLAG_SEQ) ? WIRE_SEQ_SIZE : 0) +
+                   ((flags & WIRE_FLAG_ACK) ? WIRE_ACK_SIZE : 0);
+    if (len < WIRE_HEADER_SIZE + extra) {
+        return -1;
+    }
+    p += extra;
+
+    msg->sender[0] = '\0';
+    msg->recipient[0] = '\0';
+    msg->group[0] = '\0';
+    msg->content[0] = '\0';
+
+    if (p != NULL && (fields & WIRE_FIELD_SENDER))
+        p = wire_get_string(p, end, msg->sender, MAX_USERNAME, 0);
+    if (p != NULL && (fields & WIRE_FIELD_RECIPIENT))
+        p = wire_get_string(p, end, msg->recipient, MAX_USERNAME, 0);
+    if (p != NULL && (fields & WIRE_FIELD_GROUP))
+        p = wire_get_string(p, end, msg->group, MAX_GROUP_NAME, 0);
+    if (p != NULL && (fields & WIRE_FIELD_CONTENT))
+        p = wire_get_string(p, end, msg->content, MAX_MESSAGE, 1);
+
+    return (p == NULL) ? -1 : 0;
+}
+
+// Décode un datagramme, message seul ou MSG_BUNDLE, dans msgs ; retourne
+// le nombre de messages décodés (au plus max_count), ou -1 s'il est invalide
+int message_decode_all(Message *msgs, int max_count, const unsigned char *buf, size_t len) {
+    if (len < WIRE_HEADER_SIZE || buf[0] != WIRE_VERSION || max_count < 1) {
+        return -1;
+    }
+    if (buf[1] != MSG_BUNDLE) {
+        return (message_decode(&msgs[0], buf, len) < 0) ? -1 : 1;
+    }
+
+    size_t offset = WIRE_HEADER_SIZE + ((buf[3] & WIRE_FLAG_SEQ) ? WIRE_SEQ_SIZE : 0) +
+                    ((buf[3] & WIRE_FLAG_ACK) ? WIRE_ACK_SIZE : 0);
+    int count = 0;
+
+    while (offset < len && count < max_count) {
+        if (offset + 2 > len) {
+            return -1;
+        }
+        size_t item_len = ((size_t)buf[offset] << 8) | buf[offset + 1];
+        offset += 2;
+        if (offset + item_len > len || message_decode(&msgs[count], buf + offset, item_len) < 0) {
+            return -1;
+        }
+        offset += item_len;
+        count++;
+    }
+
+    if (offset < len) {
+        fprintf(stderr, "Datagramme groupé : messages au-delà du %de ignorés\n", max_count);
+    }
+    return count;
+}
+
 void message_display(const Message *msg, const char *color) {
     char time_str[64];
     struct tm *tm_info = localtime(&msg->timestamp);
@@ -77,48 +232,70 @@ void message_display(const Message *msg, const char *color) {
     }
 }
 
-int message_send_to_group(int sockfd, SharedMemory *shm, Message *msg) {
+// Ajoute à l'outbox un envoi de msg à chaque membre actif du groupe
+// msg->group ; exclude (facultatif) est ignoré dans la diffusion. Le message
+// n'est copié qu'une fois, quelle que soit la taille du groupe. Utilisable
+// dans une section de lecture : retourne le nombre de destinataires ou -1.
+static int message_fan_out(Outbox *ob, SharedMemory *shm, Message *msg, const char *exclude) {
     Group *group = group_find(shm, msg->group);
     if (group == NULL) {
-        fprintf(stderr, "Groupe %s non trouvé\n", msg->group);
         return -1;
     }
-    
-    int sent_count = 0;
-    
-    // Envoyer le message à tous les utilisateurs du groupe sauf l'envoyeur
-    for (int i = 0; i < group->user_count; i++) {
-        if (strcmp(group->users[i], msg->sender) != 0) {
-            User *user = user_find(shm, group->users[i]);
-            if (user != NULL && user->active) {
-                if (socket_send(sockfd, msg, &user->addr) >= 0) {
-                    sent_count++;
-                }
+
+    int msg_index = -1;
+    int count = 0;
+    int exclude_id = (exclude != NULL) ? user_get_id(shm, exclude) : -1;
+    const uint64_t *members = group_members(shm, group);
+    int words = shm->member_words;
+
+    for (int id = bitset_next(members, words, 0); id >= 0;
+         id = bitset_next(members, words, id + 1)) {
+        // Une lecture concurrente d'une écriture peut voir un bit incohérent
+        if (id == exclude_id || id >= shm->max_users) {
+            continue;
+        }
+        User *user = shm_user(shm, id);
+        if (user->active) {
+            if (msg_index < 0 && (msg_index = outbox_message(ob, msg)) < 0) {
+                return -1;
+            }
+            if (outbox_send_to(ob, msg_index, user->username, &user->addr) == 0) {
+                count++;
             }
         }
     }
-    
-    printf("Message envoyé à %d utilisateur(s) du groupe %s\n", sent_count, msg->group);
-    return sent_count;
+    return count;
+}
+
+int message_send_to_group(Outbox *ob, SharedMemory *shm, Message *msg) {
+    // Envoyer le message à tous les utilisateurs du groupe sauf l'envoyeur
+    return message_fan_out(ob, shm, msg, msg->sender);
 }
 
-int message_send_private(int sockfd, SharedMemory *shm, Message *msg) {
+int message_send_to_members(Outbox *ob, SharedMemory *shm, Message *msg) {
+    // Envoyer le message à tous les utilisateurs du groupe, envoyeur compris
+    return message_fan_out(ob, shm, msg, NULL);
+}
+
+int message_send_private(Outbox *ob, SharedMemory *shm, Message *msg) {
     User *recipient = user_find(shm, msg->recipient);
     if (recipient == NULL) {
-        fprintf(stderr, "Utilisateur %s non trouvé\n", msg->recipient);
-        return -1;
-    }
-    
-    if (!recipient->active) {
-        fprintf(stderr, "Utilisateur %s non connecté\n", msg->recipient);
         return -1;
     }
-    
-    if (socket_send(sockfd, msg, &recipient->addr) < 0) {
-        fprintf(stderr, "Erreur d'envoi du message privé à %s\n", msg->recipient);
-        return -1;
+    return outbox_send(ob, msg, recipient->username, &recipient->addr);
+}
+
+// Types traités en lecture seule (seqlock), sans prendre le verrou du segment
+int message_is_read_only(MessageType type) {
+    switch (type) {
+        case MSG_PUBLIC:
+        case MSG_PRIVATE:
+        case MSG_LIST_USERS:
+        case MSG_LIST_GROUPS:
+        case MSG_HISTORY:
+        case MSG_HISTORY_SINCE:
+            return 1;
+        default:
+            return 0;
     }
-    
-    printf("Message privé envoyé à %s\n", msg->recipient);
-    return 0;
 }
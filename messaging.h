@@ -3,25 +3,96 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
-#include <sys/sem.h>
 #include <arpa/inet.h>
 #include <time.h>
 #include <errno.h>
+#include <pthread.h>
 
 // Constantes
 #define MAX_USERNAME 32
 #define MAX_MESSAGE 256
 #define MAX_GROUP_NAME 32
-#define MAX_CLIENTS 50
-#define MAX_GROUPS 10
+#define ADDR_STR_LEN 32          // "ip:port", "unix:@xxxxx" ou "ring:N" (voir addr_format)
+#define MAX_CLIENTS 50           // Capacité par défaut (option -u du serveur)
+#define MAX_GROUPS 10            // Capacité par défaut (option -g du serveur)
+#define CAPACITY_LIMIT 1000000   // Capacité maximale acceptée pour -u et -g
+#define HISTORY_SIZE 32          // Messages publics conservés par groupe (option -H du serveur)
+#define HISTORY_LIMIT 4096       // Valeur maximale acceptée pour -H
+#define LIST_PAGE_CHUNKS 16      // Morceaux de liste envoyés par requête /users ou /groups
+#define DIRECTORY_PENDING_MAX 256 // Changements reçus en avance gardés par la réplique du client
+#define HASH_TOMBSTONE (-1)      // Case d'index libérée (à sauter lors d'une recherche)
+#define SHM_MAGIC 0x4d534731     // "MSG1" : en-tête de mémoire partagée valide
+#define SHM_LAYOUT_VERSION 7
 #define PORT_BASE 8000
+#define SERVER_MAX_EVENTS 16     // Événements epoll traités par réveil
+#define SERVER_MAX_WORKERS 64    // Nombre maximal de workers (option -w)
+#define RECV_BATCH_SIZE 64       // Datagrammes reçus par appel à recvmmsg
+#define SEND_BATCH_SIZE 64       // Datagrammes envoyés par appel à sendmmsg
+#define SEND_PENDING_MAX 1024    // Envois retenus au plus avant un envoi anticipé (option -d)
+#define LOG_RING_SIZE 4096       // Entrées en attente dans le journal asynchrone
+#define LOG_FLUSH_INTERVAL_MS 10 // Attente du thread du journal quand la file est vide
+#define LOG_DETAILS_SIZE 512
+#define EVENT_LOG_MAGIC "MSGEVT1"  // En-tête du journal binaire (8 octets avec le '\0')
+#define EVENT_LOG_VERSION 1
+#define SERVER_LOG_FILE "server.log"
+#define SERVER_EVENT_FILE "server.events"  // Journal binaire (option -b du serveur)
+#define STORE_DIR "store"        // Segments du stockage des messages
+#define STORE_SEGMENT_SIZE (4 << 20)
+#define STORE_RECORD_MAGIC 0x4d534752  // "MSGR" : enregistrement complet
+#define STORE_INDEX_INTERVAL 64  // Un point d'index par canal tous les N messages
+#define STORE_QUERY_MAX 100      // Messages renvoyés au plus par /history ou /since
+#define STORE_NONE UINT64_MAX    // Offset absent (début ou fin de chaîne)
+#define WAL_DIR "state"          // Journal des modifications et checkpoints
+#define WAL_SYNC_INTERVAL_MS 20  // Écriture et fdatasync du journal par lots
+#define WAL_CHECKPOINT_INTERVAL 60        // Secondes entre deux checkpoints
+#define WAL_CHECKPOINT_BYTES (1 << 20)    // ... ou dès que le journal dépasse cette taille
+#define WAL_CHECKPOINT_MAGIC 0x4d53434b   // "MSCK"
+#define RELIABLE_WINDOW 32       // Datagrammes fiables non acquittés par pair
+#define RELIABLE_BACKLOG_MAX 1024 // Datagrammes en attente d'une place dans la fenêtre
+#define RELIABLE_TICK_MS 10      // Période du thread de retransmission
+#define RELIABLE_RTO_INITIAL_MS 200
+#define RELIABLE_RTO_MIN_MS 20
+#define RELIABLE_RTO_MAX_MS 2000
+#define RELIABLE_MAX_RETRIES 8   // Au-delà, le pair est considéré injoignable
+#define RELIABLE_DUP_ACKS 3      // ACK sans progrès avant retransmission rapide
+#define RELIABLE_DRAIN_MS 500    // Attente des derniers ACK à l'arrêt
+#define RELIABLE_IDLE_MS 60000   // Pair sans échange ni envoi en attente libéré après ce délai
+#define RELIABLE_BUCKETS 256
+#define SENDQ_SIZE 256           // Messages en attente par destinataire (option -q du serveur)
+#define SENDQ_LIMIT 65536        // Valeur maximale acceptée pour -q
+#define SENDQ_BUCKETS 256
+#define SENDQ_LOCAL_RETRY_MS 2   // Délai avant de réessayer un client local à la file pleine
+#define SENDQ_PENDING_NET 1      // Retours de sendq_pending
+#define SENDQ_PENDING_LOCAL 2
+#define RING_CELLS 64            // Datagrammes par anneau d'un client local (puissance de 2)
+#define RING_SLOTS_LIMIT 256     // Valeur maximale acceptée pour -l
+#define RING_SPIN 1000           // Tours d'attente active sur des anneaux vides avant de dormir
+#define RING_POLL_BATCHES 16     // Lots lus d'affilée dans les anneaux avant de revenir à epoll
+#define RING_MAGIC 0x52494e47    // "RING" : segment d'anneaux valide
 #define SHM_KEY_FILE "shm_key.txt"
-#define SEM_KEY_FILE "sem_key.txt"
+
+// Encodage réseau des messages (voir message_encode)
+#define WIRE_VERSION 1
+#define WIRE_HEADER_SIZE 12      // version, type, champs, drapeaux, horodatage
+#define WIRE_SEQ_SIZE 8          // Session et numéro de séquence (WIRE_FLAG_SEQ)
+#define WIRE_ACK_SIZE 12         // Session, ACK cumulatif et sélectif (WIRE_FLAG_ACK)
+#define WIRE_MESSAGE_MAX_SIZE (WIRE_HEADER_SIZE + 3 * MAX_USERNAME + 2 + MAX_MESSAGE)
+#define WIRE_MAX_SIZE 1472       // Datagramme le plus long : MTU Ethernet moins IP et UDP
+#define BUNDLE_SIZE 1400         // Taille visée des datagrammes groupés (option -m du serveur)
+#define BUNDLE_MAX_MESSAGES (WIRE_MAX_SIZE / (WIRE_HEADER_SIZE + 2))
+#define SEND_DELAY_LIMIT_MS 1000 // Valeur maximale acceptée pour -d
+#define WIRE_FIELD_SENDER    0x01
+#define WIRE_FIELD_RECIPIENT 0x02
+#define WIRE_FIELD_GROUP     0x04
+#define WIRE_FIELD_CONTENT   0x08
+#define WIRE_FLAG_SEQ        0x01  // Datagramme fiable, à acquitter
+#define WIRE_FLAG_ACK        0x02  // Porte un acquittement
 
 // Codes couleur ANSI
 #define COLOR_RESET   "\x1b[0m"
@@ -51,9 +122,127 @@ typedef enum {
     MSG_LIST_USERS_RESPONSE,  // Réponse du serveur avec la liste des utilisateurs
     MSG_LIST_GROUPS_RESPONSE, // Réponse du serveur avec la liste des groupes
     MSG_CONNECT,       // Test de connexion au serveur
-    MSG_CONNECT_ACK    // Accusé de réception de connexion
+    MSG_CONNECT_ACK,   // Accusé de réception de connexion
+    MSG_HISTORY,       // Derniers messages du canal (nombre dans content)
+    MSG_HISTORY_SINCE, // Messages du canal depuis une date (secondes dans content)
+    MSG_HISTORY_END,   // Fin d'une réponse d'historique (nombre dans content)
+    MSG_ACK,           // Acquittement seul (couche de fiabilité, jamais remis)
+    MSG_BUNDLE,        // Plusieurs messages pour un même destinataire (jamais remis tel quel)
+    MSG_SUBSCRIBE,     // Abonnement à l'annuaire (réponse : version courante dans content)
+    MSG_DIRECTORY      // Changement de l'annuaire poussé aux abonnés ("<version> <entrée>")
 } MessageType;
 
+// Événements du journal (voir logger.c). Les noms affichés sont ceux de
+// log_event_name ; les valeurs sont écrites telles quelles dans le journal
+// binaire : ajouter les nouveaux types à la fin.
+typedef enum {
+    EVT_SERVER,
+    EVT_LOG,             // Pertes d'entrées du journal
+    EVT_SESSION,         // Binaire : ancre horloge murale / monotone
+    EVT_USER_NAME,       // Binaire : nom associé à un identifiant d'utilisateur
+    EVT_GROUP_NAME,      // Binaire : nom associé à un emplacement de groupe
+    EVT_CONNECT,
+    EVT_DISCONNECT,
+    EVT_JOIN,
+    EVT_JOIN_FAIL,
+    EVT_LEAVE,
+    EVT_PUBLIC,
+    EVT_PRIVATE,
+    EVT_CREATE_GROUP,
+    EVT_MERGE_GROUPS,
+    EVT_MERGE_GROUPS_DENIED,
+    EVT_CHANGE_COLOR,
+    EVT_CHANGE_COLOR_DENIED,
+    EVT_KICK_USER,
+    EVT_KICK_DENIED,
+    EVT_PROMOTE_ADMIN,
+    EVT_PROMOTE_DENIED,
+    EVT_DEMOTE_ADMIN,
+    EVT_DEMOTE_DENIED,
+    EVT_COUNT
+} LogEventType;
+
+// Format du journal du serveur
+#define LOG_FORMAT_TEXT 0    // server.log : une ligne de texte par événement
+#define LOG_FORMAT_BINARY 1  // server.events : enregistrements de taille fixe
+
+// Journal binaire : un EventLogHeader puis des EventRecord, dans l'ordre
+// d'écriture et dans le boutisme de la machine. Le contenu de longueur
+// variable (texte d'un message, nom) est ajouté au fichier compagnon
+// <fichier>.data, à l'offset content_offset.
+typedef struct {
+    char magic[8];           // EVENT_LOG_MAGIC
+    uint32_t version;        // EVENT_LOG_VERSION
+    uint32_t record_size;    // sizeof(EventRecord)
+} EventLogHeader;
+
+typedef struct {
+    uint64_t timestamp_ns;   // CLOCK_MONOTONIC (voir EVT_SESSION)
+    uint64_t content_offset;
+    int32_t user_id;         // -1 si aucun
+    int32_t target_id;       // Utilisateur visé (privé, exclusion, promotion...)
+    int32_t group_id;        // Emplacement du groupe
+    uint32_t content_len;
+    uint32_t type;           // LogEventType
+    uint32_t reserved;
+} EventRecord;
+
+// Stockage des messages (voir store.c) : segments de STORE_SEGMENT_SIZE
+// octets, projetés en mémoire et remplis à la suite. Un offset désigne un
+// enregistrement par segment * STORE_SEGMENT_SIZE + position. Les messages
+// d'un même canal (groupe, ou destinataire pour les privés) sont chaînés
+// dans les deux sens. Un magic nul marque la fin des données d'un segment.
+typedef struct {
+    uint32_t magic;          // STORE_RECORD_MAGIC, écrit en dernier
+    uint32_t size;           // Taille de l'enregistrement, multiple de 8
+    int64_t timestamp;       // Heure d'arrivée au serveur
+    uint64_t prev;           // Message précédent du canal ou STORE_NONE
+    uint64_t next;           // Message suivant, renseigné à son ajout
+    uint8_t type;            // MSG_PUBLIC ou MSG_PRIVATE
+    uint8_t sender_len;
+    uint8_t recipient_len;
+    uint8_t group_len;
+    uint16_t content_len;
+    uint16_t reserved;
+    char data[];             // sender, recipient, group, content (sans '\0')
+} StoreRecord;
+
+// Journal des modifications (voir wal.c) : une opération par modification
+// réussie de la mémoire partagée, rejouée au démarrage par les mêmes
+// fonctions user_* / group_* par-dessus le dernier checkpoint. Les valeurs
+// sont écrites dans le journal : ajouter les nouvelles opérations à la fin.
+typedef enum {
+    WAL_USER_ADD,            // utilisateur, adresse
+    WAL_USER_REMOVE,         // utilisateur
+    WAL_GROUP_CREATE,        // groupe, créateur
+    WAL_GROUP_ADD_USER,      // groupe, utilisateur
+    WAL_GROUP_REMOVE_USER,   // groupe, utilisateur
+    WAL_GROUP_MERGE,         // groupe conservé, groupe absorbé
+    WAL_GROUP_ADD_ADMIN,     // groupe, utilisateur
+    WAL_GROUP_REMOVE_ADMIN,  // groupe, utilisateur
+    WAL_GROUP_KICK,          // groupe, utilisateur
+    WAL_GROUP_COLOR          // groupe, code couleur
+} WalOp;
+
+// Enregistrement du journal : cet en-tête puis des champs (longueur sur un
+// octet puis octets). checksum couvre tout ce qui suit ; un enregistrement
+// incomplet ou corrompu termine la relecture.
+typedef struct {
+    uint32_t checksum;       // FNV-1a
+    uint16_t size;           // Taille totale de l'enregistrement
+    uint8_t op;              // WalOp
+    uint8_t field_count;
+} WalRecord;
+
+// Checkpoint : cet en-tête puis une copie du segment. Le journal de même
+// génération contient les opérations postérieures.
+typedef struct {
+    uint32_t magic;          // WAL_CHECKPOINT_MAGIC
+    uint32_t reserved;
+    uint64_t generation;
+    uint64_t size;           // Taille de la copie du segment
+} CheckpointHeader;
+
 // Structure pour un message
 typedef struct {
     MessageType type;
@@ -75,73 +264,480 @@ typedef struct {
     time_t last_activity;
 } User;
 
+// Réplique de l'annuaire tenue par un client abonné (voir directory.c).
+// Une entrée reprend celle de /users ("nom:groupe") ou de /groups
+// ("nom:membres:admins") : name avant le premier ':', value après.
+typedef struct {
+    char name[MAX_GROUP_NAME];
+    char value[MAX_GROUP_NAME];
+    int active;                   // 0 : retirée, l'emplacement reste indexé
+} DirectoryEntry;
+
+typedef struct {
+    DirectoryEntry *entries;
+    int count;
+    int capacity;
+    int *index;                   // Index haché nom -> emplacement + 1
+    int index_size;               // Puissance de 2, au moins 2 * capacity
+} DirectoryTable;
+
+typedef struct {
+    int ready;                    // Listes chargées, changements appliqués à la suite
+    uint32_t version;             // Dernier changement appliqué
+    DirectoryTable users;
+    DirectoryTable groups;
+    // Changements arrivés avant un précédent encore manquant
+    int pending_count;
+    uint32_t pending_versions[DIRECTORY_PENDING_MAX];
+    char pending[DIRECTORY_PENDING_MAX][MAX_MESSAGE];
+} Directory;
+
+// Copie d'un destinataire prise hors verrou (voir shm_read_begin)
+typedef struct {
+    char username[MAX_USERNAME];
+    struct sockaddr_in addr;
+} Recipient;
+
+// Envois, affichages et entrées du journal différés : préparés sous le
+// verrou, exécutés par outbox_flush après la section critique
+typedef struct {
+    int msg;                      // Index dans Outbox.msgs
+    char username[MAX_USERNAME];  // Pour signaler un échec d'envoi
+    struct sockaddr_in addr;
+} OutboxSend;
+
+typedef struct {
+    int type;                     // LogEventType
+    int user_id;                  // Identifiants : journal binaire seulement
+    int target_id;
+    int group_id;
+    char details[LOG_DETAILS_SIZE];
+} OutboxLog;
+
+// Politique appliquée quand la file d'un destinataire est pleine (option -p)
+typedef enum {
+    SENDQ_DROP_OLDEST,            // Écarter le plus ancien message en attente
+    SENDQ_DROP_NEWEST,            // Écarter le nouveau message
+    SENDQ_DISCONNECT              // Vider la file et déconnecter l'utilisateur
+} SendQueuePolicy;
+
+// File d'envoi d'un destinataire : messages refusés par le tampon
+// d'émission du socket (EAGAIN), envoyés quand il redevient disponible
+typedef struct SendQueue {
+    struct SendQueue *next;       // Chaîne de la table
+    struct SendQueue *active_next;  // Liste des files non vides
+    char username[MAX_USERNAME];
+    struct sockaddr_in addr;
+    Message *items;               // Anneau de sendq_capacity messages
+    int head;
+    int depth;
+    int max_depth;
+    int active;                   // Présente dans la liste des files non vides
+    int disconnect;               // À déconnecter (SENDQ_DISCONNECT)
+    uint64_t drops;
+} SendQueue;
+
+// Files d'envoi d'un worker, par destinataire. Seul le worker les remplit ;
+// le verrou n'est disputé que par sendq_dump et par sendq_forget (appelé
+// par le worker qui traite la déconnexion du destinataire)
+typedef struct {
+    pthread_mutex_t lock;
+    SendQueue *buckets[SENDQ_BUCKETS];
+    SendQueue *active;            // Files non vides, vidées à tour de rôle
+    SendQueue *active_tail;
+    int disconnect_count;
+    uint64_t drops;               // Pertes des files déjà libérées
+} SendQueues;
+
+typedef struct {
+    Message *msgs;
+    int msg_count;
+    int msg_capacity;
+    OutboxSend *sends;
+    int send_count;
+    int send_capacity;
+    OutboxLog *logs;
+    int log_count;
+    int log_capacity;
+    char *text;                   // Sortie console accumulée
+    size_t text_len;
+    size_t text_capacity;
+    SendQueues *queues;           // Files du worker (NULL : pas de mise en file)
+    uint64_t send_deadline_us;    // Échéance des envois retenus (0 : aucun)
+} Outbox;
+
+typedef struct {
+    int msg_count;
+    int send_count;
+} OutboxMark;
+
+// Entrée de l'historique d'un groupe. Le message numéro n est rangé dans la
+// case n % history_size ; seq vaut 2n + 1 pendant son écriture puis 2n + 2.
+// Un lecteur qui ne retrouve pas 2n + 2 avant et après sa copie l'ignore.
+typedef struct {
+    uint64_t seq;
+    int64_t timestamp;
+    char sender[MAX_USERNAME];
+    char content[MAX_MESSAGE];
+} HistoryEntry;
+
 // Structure pour un groupe
+// Les membres et administrateurs sont désignés par leur identifiant
+// (emplacement dans la table des utilisateurs), un bit par utilisateur.
+// bits[] contient l'ensemble des membres puis celui des administrateurs,
+// chacun de SharedMemory.member_words mots (voir group_members/group_admins)
 typedef struct {
     char name[MAX_GROUP_NAME];
     int user_count;
-    char users[MAX_CLIENTS][MAX_USERNAME];
     int admin_count;                         // Nombre d'administrateurs
-    char admins[MAX_CLIENTS][MAX_USERNAME];  // Liste des administrateurs
     int active;
     char color[16];  // Couleur du groupe (partagée par tous les membres)
+    uint64_t history_next;  // Numéro du prochain message de l'historique
+    uint64_t history_first; // Premier numéro de cette incarnation du groupe
+    uint32_t incarnation;   // +1 à chaque création ou libération de l'emplacement
+    uint64_t bits[];
 } Group;
 
+// Opérations sur les ensembles de bits des groupes
+static inline int bitset_test(const uint64_t *bits, int id) {
+    return (bits[id / 64] >> (id % 64)) & 1;
+}
+
+static inline void bitset_set(uint64_t *bits, int id) {
+    bits[id / 64] |= (uint64_t)1 << (id % 64);
+}
+
+static inline void bitset_clear(uint64_t *bits, int id) {
+    bits[id / 64] &= ~((uint64_t)1 << (id % 64));
+}
+
+// Retourne le premier identifiant >= from présent dans l'ensemble, ou -1
+static inline int bitset_next(const uint64_t *bits, int nwords, int from) {
+    for (int word = from / 64; word < nwords; word++) {
+        uint64_t w = bits[word];
+        if (word == from / 64) {
+            w &= ~(uint64_t)0 << (from % 64);
+        }
+        if (w != 0) {
+            return word * 64 + __builtin_ctzll(w);
+        }
+    }
+    return -1;
+}
+
+static inline int bitset_count(const uint64_t *bits, int nwords) {
+    int count = 0;
+    for (int word = 0; word < nwords; word++) {
+        count += __builtin_popcountll(bits[word]);
+    }
+    return count;
+}
+
 // Structure de la mémoire partagée
+// Le segment commence par cet en-tête, qui décrit la disposition des tables
+// qui le suivent. Les capacités sont choisies au démarrage du serveur et
+// les clients qui s'attachent lisent les décalages ici.
 typedef struct {
-    User users[MAX_CLIENTS];
-    Group groups[MAX_GROUPS];
+    uint32_t magic;            // SHM_MAGIC
+    uint32_t version;          // SHM_LAYOUT_VERSION
+    size_t total_size;         // Taille du segment
+    // Verrou du segment : mutex partagé entre processus et robuste, pris
+    // sans appel système tant qu'il n'est pas contendu (futex)
+    pthread_mutex_t lock;
+    // Numéro de séquence (seqlock) : impair pendant une écriture. Les
+    // lecteurs ne prennent pas le verrou, ils relisent si le numéro a changé.
+    uint32_t seq;
+    int max_users;
+    int max_groups;
+    int member_words;          // Mots de 64 bits par ensemble de membres
+    int user_hash_size;        // Puissance de 2, au moins 2 * max_users
+    int group_hash_size;       // Puissance de 2, au moins 2 * max_groups
+    int history_size;          // Entrées d'historique par groupe (0 : aucun)
+    size_t group_stride;       // Taille d'un Group avec ses ensembles de bits
+    size_t users_offset;       // User[max_users]
+    size_t groups_offset;      // Group[max_groups] (pas de group_stride)
+    // Index haché (adressage ouvert, sondage linéaire) nom -> emplacement ;
+    // chaque case contient l'index + 1, 0 pour une case vide
+    size_t user_index_offset;  // int[user_hash_size]
+    // Index haché des groupes actifs (même codage, HASH_TOMBSTONE pour une
+    // case libérée) et pile des emplacements de groupes désactivés
+    size_t group_index_offset; // int[group_hash_size]
+    size_t group_free_offset;  // int[max_groups]
+    // Historique des messages publics : history_size entrées par
+    // emplacement de groupe, dans l'ordre des emplacements
+    size_t history_offset;     // HistoryEntry[max_groups * history_size]
+    // Abonnés aux changements de l'annuaire (MSG_SUBSCRIBE), un bit par
+    // utilisateur
+    size_t subscribers_offset; // uint64_t[member_words]
     int user_count;
     int group_count;
+    int group_free_count;
+    // Générations des annuaires, incrémentées à chaque changement visible
+    // dans /users (utilisateurs actifs et leur groupe) ou /groups (groupes,
+    // membres et admins) : le serveur garde ces listes découpées en cache
+    // tant qu'elles n'ont pas bougé
+    uint32_t user_generation;
+    uint32_t group_generation;
+    // Version de l'annuaire, incrémentée à chaque entrée poussée aux
+    // abonnés (voir directory.c)
+    uint32_t directory_version;
 } SharedMemory;
 
-// Union pour semctl
-union semun {
-    int val;
-    struct semid_ds *buf;
-    unsigned short *array;
-};
+// Accès aux tables du segment
+static inline User *shm_user(SharedMemory *shm, int idx) {
+    return (User *)((char *)shm + shm->users_offset) + idx;
+}
+
+static inline Group *shm_group(SharedMemory *shm, int idx) {
+    return (Group *)((char *)shm + shm->groups_offset + (size_t)idx * shm->group_stride);
+}
+
+static inline int shm_group_slot(SharedMemory *shm, Group *group) {
+    return (int)(((char *)group - ((char *)shm + shm->groups_offset)) / shm->group_stride);
+}
+
+static inline int *shm_user_index(SharedMemory *shm) {
+    return (int *)((char *)shm + shm->user_index_offset);
+}
+
+static inline int *shm_group_index(SharedMemory *shm) {
+    return (int *)((char *)shm + shm->group_index_offset);
+}
+
+static inline int *shm_group_free(SharedMemory *shm) {
+    return (int *)((char *)shm + shm->group_free_offset);
+}
+
+static inline HistoryEntry *shm_history(SharedMemory *shm, int group_idx) {
+    return (HistoryEntry *)((char *)shm + shm->history_offset) + (size_t)group_idx * shm->history_size;
+}
+
+static inline uint64_t *shm_subscribers(SharedMemory *shm) {
+    return (uint64_t *)((char *)shm + shm->subscribers_offset);
+}
+
+static inline uint64_t *group_members(SharedMemory *shm, Group *group) {
+    (void)shm;
+    return group->bits;
+}
+
+static inline uint64_t *group_admins(SharedMemory *shm, Group *group) {
+    return group->bits + shm->member_words;
+}
+
+// ========== Clients locaux (voir ring.c) ==========
+
+// Un client lancé sur la machine du serveur peut échanger ses datagrammes
+// par une paire d'anneaux dans un second segment partagé au lieu de l'UDP.
+// Il n'a alors pas d'adresse IP : son sockaddr_in porte AF_RING, le numéro
+// de son emplacement dans sin_port et la génération de l'emplacement dans
+// sin_addr, et circule comme une adresse UDP (User, outbox, files).
+#define AF_RING AF_MAX
+
+static inline int addr_is_ring(const struct sockaddr_in *addr) {
+    return addr->sin_family == AF_RING;
+}
+
+// Client joint par le socket local du serveur (option -x, voir network.c) :
+// AF_UNIX et son adresse abstraite dans sin_addr
+static inline int addr_is_unix(const struct sockaddr_in *addr) {
+    return addr->sin_family == AF_UNIX;
+}
+
+typedef enum {
+    RING_FREE,
+    RING_CLAIMED
+} RingState;
+
+// Anneau à un seul producteur et un seul consommateur, sans verrou : head
+// n'est écrit que par le consommateur, tail que par le producteur, chacun
+// sur sa ligne de cache. Un consommateur qui s'endort le signale dans
+// sleeping et attend que tail change (futex) ; le producteur ne fait
+// d'appel système que dans ce cas.
+typedef struct {
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+    uint32_t sleeping;
+    uint32_t drops;               // Datagrammes perdus, anneau vers le serveur plein
+    struct {
+        uint32_t len;
+        unsigned char data[WIRE_MAX_SIZE];
+    } cells[RING_CELLS];
+} Ring;
+
+typedef struct {
+    uint32_t state;               // RingState
+    uint32_t generation;          // +1 à chaque attribution de l'emplacement
+    pid_t owner;                  // Processus du client
+    Ring to_server;
+    Ring to_client;
+} RingSlot;
+
+// Le serveur consomme tous les anneaux to_server depuis un seul worker ;
+// quand il dort, un client qui dépose un datagramme incrémente doorbell et
+// le réveille (futex)
+typedef struct {
+    uint32_t magic;               // RING_MAGIC
+    int slot_count;
+    uint32_t doorbell;
+    uint32_t server_sleeping;
+    RingSlot slots[];
+} RingSegment;
 
 // Prototypes des fonctions - Gestion IPC
 int shm_create(key_t key, size_t size);
 int shm_attach(int shmid, SharedMemory **shm);
 int shm_detach(SharedMemory *shm);
 int shm_destroy(int shmid);
-
-int sem_create(key_t key);
-int sem_init(int semid, int value);
-int sem_p(int semid);  // Verrouiller
-int sem_v(int semid);  // Déverrouiller
-int sem_destroy(int semid);
+size_t shm_layout_init(SharedMemory *layout, int max_users, int max_groups, int history_size);
+int shm_layout_check(const SharedMemory *shm, size_t segment_size);
+int shm_migrate(SharedMemory *dst, SharedMemory *src);
+int shm_lock_init(SharedMemory *shm);
+int shm_lock(SharedMemory *shm);    // Verrouiller
+int shm_unlock(SharedMemory *shm);  // Déverrouiller
+int shm_write_begin(SharedMemory *shm);
+int shm_write_end(SharedMemory *shm);
+uint32_t shm_read_begin(const SharedMemory *shm);
+int shm_read_retry(const SharedMemory *shm, uint32_t seq);
 
 // Prototypes des fonctions - Gestion réseau
 int socket_create_udp(void);
+const char *addr_format(const struct sockaddr_in *addr, char *buf, size_t size);
+int socket_set_reuseport(int sockfd);
 int socket_bind_udp(int sockfd, int port);
 ssize_t socket_send(int sockfd, Message *msg, struct sockaddr_in *dest_addr);
-ssize_t socket_receive(int sockfd, Message *msg, struct sockaddr_in *src_addr);
+int socket_send_multi(int sockfd, Message **msgs, struct sockaddr_in *dest_addrs,
+                      int count, int *status);
+void socket_set_bundle_size(int size);
+int socket_receive(int sockfd, Message *msgs, int max_count, struct sockaddr_in *src_addr);
+int socket_receive_batch(int sockfd, Message *msgs, struct sockaddr_in *src_addrs, int max_count);
+int socket_bind_unix(const char *path);
+int socket_connect_unix(const char *path, struct sockaddr_in *addr);
+int socket_receive_unix_batch(int sockfd, Message *msgs, struct sockaddr_in *src_addrs, int max_count);
+
+// Prototypes des fonctions - Clients locaux (voir ring.c)
+int ring_start(key_t key, int slot_count, int notify_fd);
+void ring_stop(void);
+int ring_attach(key_t key);
+int ring_claim(struct sockaddr_in *addr);
+void ring_release(void);
+int ring_enabled(void);
+int ring_send(const struct sockaddr_in *addr, const unsigned char *buf, size_t len);
+int ring_poll(Message *msgs, struct sockaddr_in *src_addrs, int max_count);
+int ring_server_sleep(void);
+void ring_server_wake(void);
+int ring_receive(Message *msgs, int max_count, int timeout_ms);
+void ring_dump(FILE *out);
+
+// Prototypes des fonctions - Fiabilité (voir reliable.c)
+int reliable_start(int sockfd);
+void reliable_stop(int drain_ms);
+int reliable_enabled(void);
+void reliable_forget(const struct sockaddr_in *addr);
+ssize_t reliable_track(const struct sockaddr_in *addr, const unsigned char *wire, size_t len,
+                       unsigned char *out);
+int reliable_receive(int sockfd, const unsigned char *buf, size_t len,
+                     const struct sockaddr_in *addr, unsigned char *ack, size_t *ack_len);
 
 // Prototypes des fonctions - Gestion utilisateurs
 int user_add(SharedMemory *shm, const char *username, struct sockaddr_in *addr, int port);
 int user_remove(SharedMemory *shm, const char *username);
 User* user_find(SharedMemory *shm, const char *username);
+int user_get_id(SharedMemory *shm, const char *username);
+void user_index_rebuild(SharedMemory *shm);
+int user_snapshot(SharedMemory *shm, const char *username, Recipient *out);
 int user_set_color(SharedMemory *shm, const char *username, const char *color);
 
 // Prototypes des fonctions - Gestion groupes
 int group_create(SharedMemory *shm, const char *group_name, const char *creator);
 int group_add_user(SharedMemory *shm, const char *group_name, const char *username);
 int group_remove_user(SharedMemory *shm, const char *group_name, const char *username);
+int group_remove_member(SharedMemory *shm, Group *group, const char *username);
 Group* group_find(SharedMemory *shm, const char *group_name);
+void group_index_rebuild(SharedMemory *shm);
 int group_merge(SharedMemory *shm, const char *group1, const char *group2);
-int group_is_admin(Group *group, const char *username);
-int group_add_admin(Group *group, const char *username);
-int group_remove_admin(Group *group, const char *username);
+int group_is_admin(SharedMemory *shm, Group *group, const char *username);
+int group_add_admin(SharedMemory *shm, Group *group, const char *username);
+int group_remove_admin(SharedMemory *shm, Group *group, const char *username);
 int group_kick_user(SharedMemory *shm, const char *group_name, const char *username);
+void group_history_append(SharedMemory *shm, int slot, uint32_t incarnation, const Message *msg);
+int group_history_replay(Outbox *ob, SharedMemory *shm, Group *group,
+                         const char *username, const struct sockaddr_in *addr);
 
 // Prototypes des fonctions - Gestion messages
 void message_create(Message *msg, MessageType type, const char *sender, 
                    const char *recipient, const char *group, const char *content);
+ssize_t message_encode(const Message *msg, unsigned char *buf, size_t size);
+int message_decode(Message *msg, const unsigned char *buf, size_t len);
+int message_decode_all(Message *msgs, int max_count, const unsigned char *buf, size_t len);
 void message_display(const Message *msg, const char *color);
-int message_send_to_group(int sockfd, SharedMemory *shm, Message *msg);
-int message_send_private(int sockfd, SharedMemory *shm, Message *msg);
+int message_send_to_group(Outbox *ob, SharedMemory *shm, Message *msg);
+int message_send_to_members(Outbox *ob, SharedMemory *shm, Message *msg);
+int message_send_private(Outbox *ob, SharedMemory *shm, Message *msg);
+int message_is_read_only(MessageType type);
+
+// Prototypes des fonctions - Envois différés
+void outbox_init(Outbox *ob);
+void outbox_free(Outbox *ob);
+void outbox_reset(Outbox *ob);
+OutboxMark outbox_mark(const Outbox *ob);
+void outbox_rewind(Outbox *ob, OutboxMark mark);
+int outbox_message(Outbox *ob, const Message *msg);
+int outbox_send_to(Outbox *ob, int msg_index, const char *username,
+                   const struct sockaddr_in *addr);
+int outbox_send(Outbox *ob, const Message *msg, const char *username,
+                const struct sockaddr_in *addr);
+void outbox_printf(Outbox *ob, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+void outbox_event(Outbox *ob, SharedMemory *shm, LogEventType type,
+                  const char *user, const char *target, const char *group,
+                  const char *content, const char *format, ...)
+    __attribute__((format(printf, 8, 9)));
+void outbox_configure(int bundle_size, int delay_ms);
+void outbox_flush(Outbox *ob, int sockfd);
+void outbox_send_pending(Outbox *ob, int sockfd);
+int outbox_send_timeout(const Outbox *ob);
+
+// Prototypes des fonctions - Files d'envoi (voir sendq.c)
+int sendq_configure(int capacity, const char *policy);
+void sendq_init(SendQueues *queues);
+void sendq_free(SendQueues *queues);
+int sendq_blocked(SendQueues *queues, const struct sockaddr_in *addr);
+void sendq_push(SendQueues *queues, const char *username,
+                const struct sockaddr_in *addr, const Message *msg);
+int sendq_drain(SendQueues *queues, int sockfd);
+int sendq_pending(SendQueues *queues);
+int sendq_take_disconnects(SendQueues *queues, Message *msgs,
+                           struct sockaddr_in *addrs, int max_count);
+void sendq_forget(SendQueues *queues, const struct sockaddr_in *addr);
+void sendq_dump(SendQueues *queues, int worker_id, FILE *out);
+
+// Prototypes des fonctions - Annuaire poussé aux abonnés (voir directory.c)
+uint32_t directory_subscribe(SharedMemory *shm, const char *username);
+void directory_publish_user(Outbox *ob, SharedMemory *shm, const char *username);
+void directory_publish_group(Outbox *ob, SharedMemory *shm, const char *group_name);
+void directory_init(Directory *dir);
+void directory_free(Directory *dir);
+int directory_load(Directory *dir, int users, const char *list);
+void directory_rebase(Directory *dir, uint32_t version);
+int directory_receive(Directory *dir, const char *content);
+char *directory_list(const Directory *dir, int users, size_t *len);
+
+// Prototypes des fonctions - Stockage des messages
+int store_open(const char *dir);
+int store_append(const Message *msg);
+int store_history(Outbox *ob, MessageType type, const char *channel, int count,
+                  const char *username, const struct sockaddr_in *addr);
+int store_since(Outbox *ob, MessageType type, const char *channel, time_t since,
+                const char *username, const struct sockaddr_in *addr);
+void store_close(void);
+
+// Prototypes des fonctions - Journal des modifications
+int wal_recover(const char *dir, SharedMemory *shm);
+int wal_start(const char *dir, SharedMemory *shm);
+void wal_append(WalOp op, const char *arg1, const char *arg2);
+void wal_append_user(const char *username, const struct sockaddr_in *addr);
+void wal_stop(void);
 
 // Prototypes des fonctions - Utilitaires
 void display_prompt(const char *username, const char *group, const char *color);
@@ -151,4 +747,13 @@ const char* get_timestamp_str(time_t timestamp);
 void clear_screen(void);
 void log_event(FILE *logfile, const char *event_type, const char *details);
 
+// Prototypes des fonctions - Journal asynchrone
+int logger_start(const char *path, int format, int capacity);
+int logger_format(void);
+int log_post(LogEventType type, int user_id, int target_id, int group_id, const char *details);
+const char *log_event_name(int type);
+uint64_t logger_dropped(void);
+void logger_stop(void);
+unsigned int hash_string(const char *str);
+
 #endif // MESSAGING_H
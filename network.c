@@ -1,4 +1,9 @@
+#define _GNU_SOURCE
 #include "messaging.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <stddef.h>
 
 // ========== Gestion des sockets UDP ==========
 
@@ -11,6 +16,17 @@ int socket_create_udp(void) {
     return sockfd;
 }
 
+// Permet à plusieurs sockets de se lier au même port ; le noyau répartit
+// alors les datagrammes entrants entre eux selon l'adresse source
+int socket_set_reuseport(int sockfd) {
+    int enable = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+        perror("Erreur setsockopt SO_REUSEPORT");
+        return -1;
+    }
+    return 0;
+}
+
 int socket_bind_udp(int sockfd, int port) {
     struct sockaddr_in servaddr;
     
@@ -28,10 +44,257 @@ int socket_bind_udp(int sockfd, int port) {
     return 0;
 }
 
+// Écrit dans buf l'adresse d'un pair selon son transport : "ip:port" pour
+// UDP, "unix:@xxxxx" (nom abstrait) pour le socket local, "ring:N" pour
+// l'emplacement d'anneau N. Retourne buf.
+const char *addr_format(const struct sockaddr_in *addr, char *buf, size_t size) {
+    if (addr_is_unix(addr)) {
+        snprintf(buf, size, "unix:@%05x", (unsigned int)addr->sin_addr.s_addr);
+    } else if (addr_is_ring(addr)) {
+        snprintf(buf, size, "ring:%d", ntohs(addr->sin_port));
+    } else {
+        char ip_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr->sin_addr, ip_str, sizeof(ip_str));
+        snprintf(buf, size, "%s:%d", ip_str, ntohs(addr->sin_port));
+    }
+    return buf;
+}
+
+// ========== Socket local (AF_UNIX) ==========
+
+// Le serveur lancé avec -x <chemin> écoute aussi sur un socket AF_UNIX
+// SOCK_DGRAM ; un client qui reçoit un chemin à la place de l'adresse IP
+// s'y connecte. Le client se lie à une adresse abstraite choisie par le
+// noyau ("\0" suivi de 5 chiffres hexadécimaux) : le serveur la range dans
+// un sockaddr_in de famille AF_UNIX (valeur dans sin_addr), qui circule
+// comme une adresse UDP, et la reconstruit pour l'envoi. Un même processus
+// n'a qu'un socket local : g_unix_sockfd.
+
+#define UNIX_AUTOBIND_DIGITS 5
+
+static int g_unix_sockfd = -1;
+static int g_unix_connected = 0;   // Client : un seul destinataire, le serveur
+
+// Adresse abstraite d'un client -> sockaddr_in AF_UNIX ; -1 pour une autre
+// forme d'adresse (chemin, socket non lié), à laquelle on ne peut répondre
+static int unix_name_encode(const struct sockaddr_un *name, socklen_t len,
+                            struct sockaddr_in *addr) {
+    char digits[UNIX_AUTOBIND_DIGITS + 1];
+    char *end;
+
+    if (len != offsetof(struct sockaddr_un, sun_path) + 1 + UNIX_AUTOBIND_DIGITS ||
+        name->sun_path[0] != '\0') {
+        return -1;
+    }
+    memcpy(digits, name->sun_path + 1, UNIX_AUTOBIND_DIGITS);
+    digits[UNIX_AUTOBIND_DIGITS] = '\0';
+    unsigned long value = strtoul(digits, &end, 16);
+    if (*end != '\0') {
+        return -1;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_UNIX;
+    addr->sin_addr.s_addr = (uint32_t)value;
+    return 0;
+}
+
+static socklen_t unix_name_decode(const struct sockaddr_in *addr, struct sockaddr_un *name) {
+    char digits[UNIX_AUTOBIND_DIGITS + 1];
+
+    memset(name, 0, sizeof(*name));
+    name->sun_family = AF_UNIX;
+    snprintf(digits, sizeof(digits), "%05x", (unsigned int)addr->sin_addr.s_addr);
+    memcpy(name->sun_path + 1, digits, UNIX_AUTOBIND_DIGITS);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + UNIX_AUTOBIND_DIGITS;
+}
+
+static int unix_path_set(struct sockaddr_un *name, const char *path) {
+    memset(name, 0, sizeof(*name));
+    name->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(name->sun_path)) {
+        fprintf(stderr, "Chemin de socket trop long : %s\n", path);
+        return -1;
+    }
+    strcpy(name->sun_path, path);
+    return 0;
+}
+
+// Serveur : crée le socket local lié à path (remplace un socket laissé par
+// un serveur précédent) ; retourne son descripteur, non bloquant
+int socket_bind_unix(const char *path) {
+    struct sockaddr_un name;
+    if (unix_path_set(&name, path) == -1) {
+        return -1;
+    }
+
+    int sockfd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        perror("Erreur création socket local");
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(sockfd, (struct sockaddr *)&name, sizeof(name)) < 0) {
+        perror("Erreur bind socket local");
+        close(sockfd);
+        return -1;
+    }
+
+    g_unix_sockfd = sockfd;
+    printf("Socket local lié à %s\n", path);
+    return sockfd;
+}
+
+// Client : crée le socket local, le lie à une adresse abstraite et le
+// connecte au serveur ; addr reçoit l'adresse qui désigne le serveur
+int socket_connect_unix(const char *path, struct sockaddr_in *addr) {
+    struct sockaddr_un name;
+    if (unix_path_set(&name, path) == -1) {
+        return -1;
+    }
+
+    int sockfd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        perror("Erreur création socket local");
+        return -1;
+    }
+
+    // Une adresse réduite à la famille : le noyau en choisit une abstraite
+    sa_family_t family = AF_UNIX;
+    if (bind(sockfd, (struct sockaddr *)&family, sizeof(family)) < 0) {
+        perror("Erreur bind socket local");
+        close(sockfd);
+        return -1;
+    }
+    if (connect(sockfd, (struct sockaddr *)&name, sizeof(name)) < 0) {
+        perror("Erreur connexion au socket local");
+        close(sockfd);
+        return -1;
+    }
+
+    g_unix_sockfd = sockfd;
+    g_unix_connected = 1;
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_UNIX;
+    return sockfd;
+}
+
+// Envoie un datagramme à un pair local
+static ssize_t unix_send(const struct sockaddr_in *dest_addr, const unsigned char *buf, size_t len) {
+    if (g_unix_connected) {
+        // File du serveur pleine : attendre (100 ms au plus) qu'il la vide
+        ssize_t n = send(g_unix_sockfd, buf, len, MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = { .fd = g_unix_sockfd, .events = POLLOUT };
+            if (poll(&pfd, 1, 100) > 0) {
+                n = send(g_unix_sockfd, buf, len, MSG_DONTWAIT);
+            }
+        }
+        return n;
+    }
+    struct sockaddr_un name;
+    socklen_t name_len = unix_name_decode(dest_addr, &name);
+    return sendto(g_unix_sockfd, buf, len, MSG_DONTWAIT, (struct sockaddr *)&name, name_len);
+}
+
+// Reçoit jusqu'à max_count datagrammes du socket local (voir
+// socket_receive_batch) ; src_addrs[i] reçoit l'adresse AF_UNIX du client
+int socket_receive_unix_batch(int sockfd, Message *msgs, struct sockaddr_in *src_addrs, int max_count) {
+    struct mmsghdr hdrs[RECV_BATCH_SIZE];
+    struct iovec iovs[RECV_BATCH_SIZE];
+    unsigned char bufs[RECV_BATCH_SIZE][WIRE_MAX_SIZE];
+    struct sockaddr_un from[RECV_BATCH_SIZE];
+
+    if (max_count > RECV_BATCH_SIZE) {
+        max_count = RECV_BATCH_SIZE;
+    }
+
+    memset(hdrs, 0, sizeof(struct mmsghdr) * max_count);
+    for (int i = 0; i < max_count; i++) {
+        iovs[i].iov_base = bufs[i];
+        iovs[i].iov_len = WIRE_MAX_SIZE;
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+        hdrs[i].msg_hdr.msg_name = &from[i];
+        hdrs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+    }
+
+    int n = recvmmsg(sockfd, hdrs, max_count, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("Erreur recvmmsg socket local");
+        }
+        return -1;
+    }
+
+    // Pas de couche fiable : un socket local ne perd pas de datagramme
+    int count = 0;
+    for (int i = 0; i < n && count < max_count; i++) {
+        struct sockaddr_in src;
+        if ((hdrs[i].msg_hdr.msg_flags & MSG_TRUNC) ||
+            unix_name_encode(&from[i], hdrs[i].msg_hdr.msg_namelen, &src) == -1) {
+            fprintf(stderr, "Datagramme local ignoré (%u octets, expéditeur sans adresse abstraite)\n",
+                    hdrs[i].msg_len);
+            continue;
+        }
+
+        int decoded = message_decode_all(&msgs[count], max_count - count, bufs[i], hdrs[i].msg_len);
+        if (decoded < 0) {
+            fprintf(stderr, "Datagramme invalide ignoré (%u octets)\n", hdrs[i].msg_len);
+            continue;
+        }
+        for (int j = 0; j < decoded; j++) {
+            src_addrs[count++] = src;
+        }
+    }
+    return count;
+}
+
+// ========== Envoi et réception ==========
+
 ssize_t socket_send(int sockfd, Message *msg, struct sockaddr_in *dest_addr) {
     socklen_t len = sizeof(*dest_addr);
+    unsigned char buf[WIRE_MAX_SIZE];
+    unsigned char wire[WIRE_MAX_SIZE];
+
+    ssize_t size = message_encode(msg, wire, sizeof(wire));
+    if (size < 0) {
+        fprintf(stderr, "Erreur d'encodage du message\n");
+        return -1;
+    }
+
+    // Client local : l'anneau ne perd rien tant qu'il suit, pas de couche fiable
+    if (addr_is_ring(dest_addr)) {
+        if (ring_send(dest_addr, wire, (size_t)size) == -1) {
+            perror("Erreur envoi local");
+            return -1;
+        }
+        return size;
+    }
+    // De même pour le socket local
+    if (addr_is_unix(dest_addr)) {
+        ssize_t n = unix_send(dest_addr, wire, (size_t)size);
+        if (n < 0) {
+            perror("Erreur envoi socket local");
+        }
+        return n;
+    }
 
-    ssize_t n = sendto(sockfd, msg, sizeof(Message), 0,
+    const unsigned char *out = wire;
+    if (reliable_enabled()) {
+        // 0 : en attente d'une place dans la fenêtre, envoyé plus tard
+        size = reliable_track(dest_addr, wire, (size_t)size, buf);
+        if (size <= 0) {
+            if (size < 0) {
+                perror("Erreur envoi fiable");
+            }
+            return size;
+        }
+        out = buf;
+    }
+
+    ssize_t n = sendto(sockfd, out, size, 0,
                        (struct sockaddr *)dest_addr, len);
 
     if (n < 0) {
@@ -42,10 +305,288 @@ ssize_t socket_send(int sockfd, Message *msg, struct sockaddr_in *dest_addr) {
     return n;
 }
 
-ssize_t socket_receive(int sockfd, Message *msg, struct sockaddr_in *src_addr) {
+// Taille visée des datagrammes groupés (0 : un message par datagramme)
+static int g_bundle_size = 0;
+
+void socket_set_bundle_size(int size) {
+    g_bundle_size = size;
+}
+
+static int same_addr(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+    return a->sin_family == b->sin_family &&
+           a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+// Encode dans out le datagramme qui commence à msgs[*pos] : le message seul,
+// ou un MSG_BUNDLE avec les messages suivants destinés à la même adresse
+// tant qu'ils tiennent dans g_bundle_size octets. Avance *pos après le
+// dernier message utilisé ; retourne la taille, ou -1 si msgs[*pos] ne peut
+// pas être encodé.
+// cache garde l'encodage du dernier message placé en tête : un même message
+// diffusé à plusieurs destinataires n'est encodé qu'une fois.
+static ssize_t datagram_build(Message **msgs, struct sockaddr_in *dest_addrs, int count,
+                              int *pos, unsigned char *out,
+                              const Message **cache_msg, unsigned char *cache, ssize_t *cache_len) {
+    const size_t body = WIRE_HEADER_SIZE + 2;   // Premier message d'un MSG_BUNDLE
+    const Message *first = msgs[*pos];
+
+    if (first != *cache_msg) {
+        *cache_len = message_encode(first, cache, WIRE_MESSAGE_MAX_SIZE);
+        *cache_msg = first;
+    }
+    if (*cache_len < 0) {
+        (*pos)++;
+        return -1;
+    }
+    memcpy(out + body, cache, (size_t)*cache_len);
+
+    size_t offset = body + (size_t)*cache_len;
+    int end = *pos + 1;
+    while (g_bundle_size > 0 && end < count && same_addr(&dest_addrs[end], &dest_addrs[*pos]) &&
+           offset + 2 < (size_t)g_bundle_size) {
+        ssize_t len = message_encode(msgs[end], out + offset + 2, (size_t)g_bundle_size - offset - 2);
+        if (len < 0) {
+            break;
+        }
+        out[offset] = (unsigned char)(len >> 8);
+        out[offset + 1] = (unsigned char)(len & 0xff);
+        offset += 2 + (size_t)len;
+        end++;
+    }
+
+    int used = end - *pos;
+    *pos = end;
+    if (used == 1) {
+        memmove(out, out + body, (size_t)*cache_len);
+        return *cache_len;
+    }
+
+    memset(out, 0, WIRE_HEADER_SIZE);
+    out[0] = WIRE_VERSION;
+    out[1] = MSG_BUNDLE;
+    out[body - 2] = (unsigned char)(*cache_len >> 8);
+    out[body - 1] = (unsigned char)(*cache_len & 0xff);
+    return (ssize_t)offset;
+}
+
+// Envoie les datagrammes hdrs[0..k) par sendmmsg sur sockfd ; hdrs[d]
+// porte msgs[first[d]] .. msgs[end[d] - 1]. Remplit status et retourne le
+// nombre de messages envoyés. local : socket AF_UNIX, où EAGAIN signifie
+// que la file du destinataire est pleine.
+// Rapproche de hdrs[from] les datagrammes suivants (jusqu'à k) destinés au
+// même client local, sans changer l'ordre des autres ; retourne leur nombre
+static int unix_gather_peer(struct mmsghdr *hdrs, int *first, int *end, int from, int k) {
+    const struct msghdr *blocked = &hdrs[from].msg_hdr;
+    int pos = from + 1;
+
+    for (int d = from + 1; d < k; d++) {
+        const struct msghdr *h = &hdrs[d].msg_hdr;
+        if (h->msg_namelen != blocked->msg_namelen ||
+            memcmp(h->msg_name, blocked->msg_name, h->msg_namelen) != 0) {
+            continue;
+        }
+        struct mmsghdr hdr = hdrs[d];
+        int f = first[d];
+        int e = end[d];
+        for (int j = d; j > pos; j--) {
+            hdrs[j] = hdrs[j - 1];
+            first[j] = first[j - 1];
+            end[j] = end[j - 1];
+        }
+        hdrs[pos] = hdr;
+        first[pos] = f;
+        end[pos] = e;
+        pos++;
+    }
+    return pos - from - 1;
+}
+
+static int datagrams_send(int sockfd, struct mmsghdr *hdrs, int k, int *first,
+                          int *end, int reliable, int local, int *status) {
+    int sent_count = 0;
+    int done = 0;
+
+    while (done < k) {
+        int n = sendmmsg(sockfd, hdrs + done, k - done, MSG_DONTWAIT);
+        int sent = n;
+        int failed = 0;
+        int err = 0;
+        if (n < 0) {
+            err = errno;
+            sent = 0;
+            if (local && (err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS)) {
+                // File de réception de ce client local pleine : ses
+                // datagrammes restants échouent avec lui pour que
+                // l'appelant les mette en file dans l'ordre, les suivants
+                // vont peut-être à d'autres clients
+                failed = 1 + unix_gather_peer(hdrs, first, end, done, k);
+            } else if (err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS) {
+                // Tampon d'émission plein : inutile de tenter les suivants.
+                // En mode fiable ils sont déjà dans la fenêtre et seront
+                // retransmis ; sinon l'appelant peut les mettre en file
+                if (reliable) {
+                    sent = k - done;
+                } else {
+                    failed = k - done;
+                }
+            } else {
+                // Le premier datagramme restant a échoué : le noter et passer au suivant
+                failed = 1;
+            }
+        }
+
+        for (int d = done; d < done + sent + failed; d++) {
+            for (int i = first[d]; i < end[d]; i++) {
+                if (status != NULL) {
+                    status[i] = (d < done + sent) ? 0 : err;
+                }
+            }
+            if (d < done + sent) {
+                sent_count += end[d] - first[d];
+            }
+        }
+        done += sent + failed;
+    }
+    return sent_count;
+}
+
+// Envoie msgs[i] à dest_addrs[i] par lots d'un sendmmsg. Les messages
+// consécutifs destinés à la même adresse partagent un datagramme (voir
+// socket_set_bundle_size). Ceux destinés à un client local passent par son
+// anneau (voir ring.c) ou par le socket local, chacun par son transport.
+// status[i] reçoit 0 ou l'errno de l'envoi de msgs[i] ; retourne le nombre
+// de messages envoyés.
+int socket_send_multi(int sockfd, Message **msgs, struct sockaddr_in *dest_addrs,
+                      int count, int *status) {
+    // Les datagrammes UDP sont rangés depuis le début de hdrs, ceux du
+    // socket local depuis la fin
+    struct mmsghdr hdrs[SEND_BATCH_SIZE];
+    struct iovec iovs[SEND_BATCH_SIZE];
+    unsigned char bufs[SEND_BATCH_SIZE][WIRE_MAX_SIZE];
+    struct sockaddr_un names[SEND_BATCH_SIZE];
+    unsigned char wire[WIRE_MAX_SIZE];
+    unsigned char cache[WIRE_MESSAGE_MAX_SIZE];
+    const Message *cache_msg = NULL;
+    ssize_t cache_len = -1;
+    int first[SEND_BATCH_SIZE];   // hdrs[k] porte msgs[first[k]] .. msgs[end[k] - 1]
+    int end[SEND_BATCH_SIZE];
+    // Clients d'anneau dont l'anneau était plein : leurs datagrammes
+    // suivants échouent aussi, pour rester derrière celui qui attend
+    struct sockaddr_in ring_full[SEND_BATCH_SIZE];
+    int ring_full_count = 0;
+    int reliable = reliable_enabled();
+    int sent_count = 0;
+    int pos = 0;
+
+    while (pos < count) {
+        int k = 0;
+        int local = SEND_BATCH_SIZE;
+        memset(hdrs, 0, sizeof(hdrs));
+        while (k < local && pos < count) {
+            int start = pos;
+            int ring = addr_is_ring(&dest_addrs[start]);
+            int unix_peer = addr_is_unix(&dest_addrs[start]);
+            int h = unix_peer ? local - 1 : k;
+            // En mode fiable, chaque datagramme UDP reçoit ensuite son numéro
+            ssize_t size = datagram_build(msgs, dest_addrs, count, &pos,
+                                          (reliable && !ring && !unix_peer) ? wire : bufs[h],
+                                          &cache_msg, cache, &cache_len);
+            if (size < 0) {
+                if (status != NULL) {
+                    status[start] = EINVAL;
+                }
+                continue;
+            }
+
+            if (ring) {
+                int err = 0;
+                for (int r = 0; r < ring_full_count && err == 0; r++) {
+                    if (ring_full[r].sin_port == dest_addrs[start].sin_port &&
+                        ring_full[r].sin_addr.s_addr == dest_addrs[start].sin_addr.s_addr) {
+                        err = EAGAIN;
+                    }
+                }
+                if (err == 0 && ring_send(&dest_addrs[start], bufs[h], (size_t)size) == -1) {
+                    err = errno;
+                    if (err == EAGAIN && ring_full_count < SEND_BATCH_SIZE) {
+                        ring_full[ring_full_count++] = dest_addrs[start];
+                    }
+                }
+                for (int i = start; i < pos; i++) {
+                    if (status != NULL) {
+                        status[i] = err;
+                    }
+                }
+                sent_count += (err == 0) ? pos - start : 0;
+                continue;
+            }
+
+            if (reliable && !unix_peer) {
+                ssize_t n = reliable_track(&dest_addrs[start], wire, (size_t)size, bufs[h]);
+                if (n <= 0) {
+                    // 0 : en attente d'une place dans la fenêtre
+                    int err = (n == 0) ? 0 : errno;
+                    for (int i = start; i < pos; i++) {
+                        if (status != NULL) {
+                            status[i] = err;
+                        }
+                    }
+                    sent_count += (n == 0) ? pos - start : 0;
+                    continue;
+                }
+                size = n;
+            }
+            iovs[h].iov_base = bufs[h];
+            iovs[h].iov_len = (size_t)size;
+            hdrs[h].msg_hdr.msg_iov = &iovs[h];
+            hdrs[h].msg_hdr.msg_iovlen = 1;
+            if (!unix_peer) {
+                hdrs[h].msg_hdr.msg_name = &dest_addrs[start];
+                hdrs[h].msg_hdr.msg_namelen = sizeof(dest_addrs[start]);
+            } else if (!g_unix_connected) {
+                hdrs[h].msg_hdr.msg_namelen = unix_name_decode(&dest_addrs[start], &names[h]);
+                hdrs[h].msg_hdr.msg_name = &names[h];
+            }
+            first[h] = start;
+            end[h] = pos;
+            if (unix_peer) {
+                local--;
+            } else {
+                k++;
+            }
+        }
+
+        // Remettre les datagrammes du socket local dans l'ordre des messages
+        for (int a = local, b = SEND_BATCH_SIZE - 1; a < b; a++, b--) {
+            struct mmsghdr hdr = hdrs[a];
+            int f = first[a];
+            int e = end[a];
+            hdrs[a] = hdrs[b];
+            first[a] = first[b];
+            end[a] = end[b];
+            hdrs[b] = hdr;
+            first[b] = f;
+            end[b] = e;
+        }
+
+        sent_count += datagrams_send(sockfd, hdrs, k, first, end, reliable, 0, status);
+        if (local < SEND_BATCH_SIZE) {
+            sent_count += datagrams_send(g_unix_sockfd, hdrs + local, SEND_BATCH_SIZE - local,
+                                         first + local, end + local, 0, 1, status);
+        }
+    }
+
+    return sent_count;
+}
+
+// Reçoit un datagramme et le décode dans msgs (un MSG_BUNDLE en contient
+// jusqu'à BUNDLE_MAX_MESSAGES). Retourne le nombre de messages, 0 pour un
+// datagramme sans message à remettre, -1 si rien n'est disponible.
+int socket_receive(int sockfd, Message *msgs, int max_count, struct sockaddr_in *src_addr) {
     socklen_t len = sizeof(*src_addr);
+    unsigned char buf[WIRE_MAX_SIZE];
 
-    ssize_t n = recvfrom(sockfd, msg, sizeof(Message), 0,
+    ssize_t n = recvfrom(sockfd, buf, sizeof(buf), 0,
                          (struct sockaddr *)src_addr, &len);
 
     if (n < 0) {
@@ -55,5 +596,124 @@ ssize_t socket_receive(int sockfd, Message *msg, struct sockaddr_in *src_addr) {
         return -1;
     }
 
-    return n;
+    // Socket local : pas de couche fiable, l'expéditeur est le serveur
+    if (sockfd == g_unix_sockfd) {
+        memset(src_addr, 0, sizeof(*src_addr));
+        src_addr->sin_family = AF_UNIX;
+    }
+
+    // Acquitter les datagrammes fiables ; les ACK et doublons s'arrêtent là
+    unsigned char ack[WIRE_HEADER_SIZE + WIRE_ACK_SIZE];
+    size_t ack_len = 0;
+    int deliver = 1;
+    if (sockfd != g_unix_sockfd) {
+        deliver = reliable_receive(sockfd, buf, (size_t)n, src_addr, ack, &ack_len);
+    }
+    if (ack_len > 0) {
+        sendto(sockfd, ack, ack_len, 0, (struct sockaddr *)src_addr, len);
+    }
+    if (!deliver) {
+        return 0;
+    }
+
+    int count = message_decode_all(msgs, max_count, buf, n);
+    if (count < 0) {
+        fprintf(stderr, "Datagramme invalide ignoré (%zd octets)\n", n);
+        return 0;
+    }
+
+    return count;
+}
+
+// Reçoit jusqu'à max_count datagrammes et retourne le nombre de messages
+// décodés dans msgs (au plus max_count : les messages d'un MSG_BUNDLE qui
+// dépassent sont perdus, les clients n'en envoient pas).
+int socket_receive_batch(int sockfd, Message *msgs, struct sockaddr_in *src_addrs, int max_count) {
+    struct mmsghdr hdrs[RECV_BATCH_SIZE];
+    struct iovec iovs[RECV_BATCH_SIZE];
+    unsigned char bufs[RECV_BATCH_SIZE][WIRE_MAX_SIZE];
+    struct sockaddr_in from[RECV_BATCH_SIZE];
+
+    if (max_count > RECV_BATCH_SIZE) {
+        max_count = RECV_BATCH_SIZE;
+    }
+
+    memset(hdrs, 0, sizeof(struct mmsghdr) * max_count);
+    for (int i = 0; i < max_count; i++) {
+        iovs[i].iov_base = bufs[i];
+        iovs[i].iov_len = WIRE_MAX_SIZE;
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+        hdrs[i].msg_hdr.msg_name = &from[i];
+        hdrs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+    }
+
+    // Un seul appel système pour récupérer jusqu'à max_count datagrammes
+    int n = recvmmsg(sockfd, hdrs, max_count, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("Erreur recvmmsg");
+        }
+        return -1;
+    }
+
+    // Décoder les datagrammes en ignorant ceux qui sont tronqués ou invalides.
+    // Les datagrammes fiables sont acquittés après le lot, un seul ACK par
+    // pair : le dernier, qui couvre aussi les précédents
+    unsigned char acks[RECV_BATCH_SIZE][WIRE_HEADER_SIZE + WIRE_ACK_SIZE];
+    struct sockaddr_in ack_addrs[RECV_BATCH_SIZE];
+    int ack_count = 0;
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        const struct sockaddr_in src = from[i];
+        size_t ack_len = 0;
+        if (hdrs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            fprintf(stderr, "Datagramme invalide ignoré (%u octets)\n", hdrs[i].msg_len);
+            continue;
+        }
+
+        int deliver = reliable_receive(sockfd, bufs[i], hdrs[i].msg_len, &src,
+                                       acks[ack_count], &ack_len);
+        if (ack_len > 0) {
+            int a = 0;
+            while (a < ack_count && (ack_addrs[a].sin_addr.s_addr != src.sin_addr.s_addr ||
+                                     ack_addrs[a].sin_port != src.sin_port)) {
+                a++;
+            }
+            if (a < ack_count) {
+                memcpy(acks[a], acks[ack_count], ack_len);
+            } else {
+                ack_addrs[ack_count++] = src;
+            }
+        }
+        if (!deliver || count == max_count) {
+            continue;
+        }
+
+        int decoded = message_decode_all(&msgs[count], max_count - count, bufs[i], hdrs[i].msg_len);
+        if (decoded < 0) {
+            fprintf(stderr, "Datagramme invalide ignoré (%u octets)\n", hdrs[i].msg_len);
+            continue;
+        }
+        for (int j = 0; j < decoded; j++) {
+            src_addrs[count++] = src;
+        }
+    }
+
+    if (ack_count > 0) {
+        for (int a = 0; a < ack_count; a++) {
+            iovs[a].iov_base = acks[a];
+            iovs[a].iov_len = WIRE_HEADER_SIZE + WIRE_ACK_SIZE;
+            memset(&hdrs[a], 0, sizeof(hdrs[a]));
+            hdrs[a].msg_hdr.msg_iov = &iovs[a];
+            hdrs[a].msg_hdr.msg_iovlen = 1;
+            hdrs[a].msg_hdr.msg_name = &ack_addrs[a];
+            hdrs[a].msg_hdr.msg_namelen = sizeof(ack_addrs[a]);
+        }
+        if (sendmmsg(sockfd, hdrs, ack_count, 0) < 0) {
+            perror("Erreur sendmmsg (ACK)");
+        }
+    }
+
+    return count;
 }
@@ -0,0 +1,298 @@
+#define _GNU_SOURCE
+#include "messaging.h"
+#include <stdarg.h>
+
+// ========== Envois et traces différés ==========
+
+// Les gestionnaires remplissent l'outbox pendant qu'ils lisent ou modifient
+// la mémoire partagée ; les sendmmsg, printf et écritures du journal n'ont
+// lieu qu'au vidage, une fois la section critique terminée.
+
+// Regroupement des envois (voir outbox_configure)
+static int g_bundle = 0;
+static uint64_t g_send_delay_us = 0;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// bundle_size : taille visée des datagrammes regroupant plusieurs messages
+// pour un même destinataire (0 : un message par datagramme).
+// delay_ms : durée pendant laquelle les envois sont retenus pour en
+// regrouper davantage (0 : envoi à chaque vidage de l'outbox).
+void outbox_configure(int bundle_size, int delay_ms) {
+    socket_set_bundle_size(bundle_size);
+    g_bundle = (bundle_size > 0);
+    g_send_delay_us = (uint64_t)delay_ms * 1000;
+}
+
+void outbox_init(Outbox *ob) {
+    memset(ob, 0, sizeof(*ob));
+}
+
+void outbox_free(Outbox *ob) {
+    free(ob->msgs);
+    free(ob->sends);
+    free(ob->logs);
+    free(ob->text);
+    outbox_init(ob);
+}
+
+void outbox_reset(Outbox *ob) {
+    ob->msg_count = 0;
+    ob->send_count = 0;
+    ob->send_deadline_us = 0;
+    ob->log_count = 0;
+    ob->text_len = 0;
+}
+
+OutboxMark outbox_mark(const Outbox *ob) {
+    OutboxMark mark = { ob->msg_count, ob->send_count };
+    return mark;
+}
+
+// Oublie les envois ajoutés depuis mark (lecture à recommencer)
+void outbox_rewind(Outbox *ob, OutboxMark mark) {
+    ob->msg_count = mark.msg_count;
+    ob->send_count = mark.send_count;
+}
+
+// Agrandit un tableau pour contenir au moins needed éléments
+static int outbox_reserve(void **items, int *capacity, int needed, size_t item_size) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    int new_capacity = *capacity > 0 ? *capacity * 2 : SEND_BATCH_SIZE;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void *grown = realloc(*items, (size_t)new_capacity * item_size);
+    if (grown == NULL) {
+        perror("Erreur realloc");
+        return -1;
+    }
+    *items = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+// Copie msg dans l'outbox et retourne son index, ou -1
+int outbox_message(Outbox *ob, const Message *msg) {
+    if (outbox_reserve((void **)&ob->msgs, &ob->msg_capacity,
+                       ob->msg_count + 1, sizeof(Message)) == -1) {
+        return -1;
+    }
+    ob->msgs[ob->msg_count] = *msg;
+    return ob->msg_count++;
+}
+
+// Ajoute un envoi du message d'index msg_index (voir outbox_message)
+int outbox_send_to(Outbox *ob, int msg_index, const char *username,
+                   const struct sockaddr_in *addr) {
+    if (msg_index < 0 ||
+        outbox_reserve((void **)&ob->sends, &ob->send_capacity,
+                       ob->send_count + 1, sizeof(OutboxSend)) == -1) {
+        return -1;
+    }
+    OutboxSend *send = &ob->sends[ob->send_count++];
+    send->msg = msg_index;
+    strncpy(send->username, username, MAX_USERNAME - 1);
+    send->username[MAX_USERNAME - 1] = '\0';
+    send->addr = *addr;
+    return 0;
+}
+
+int outbox_send(Outbox *ob, const Message *msg, const char *username,
+                const struct sockaddr_in *addr) {
+    return outbox_send_to(ob, outbox_message(ob, msg), username, addr);
+}
+
+void outbox_printf(Outbox *ob, const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+
+    size_t needed = ob->text_len + (size_t)len + 1;
+    if (needed > ob->text_capacity) {
+        size_t new_capacity = ob->text_capacity > 0 ? ob->text_capacity * 2 : 1024;
+        while (new_capacity < needed) {
+            new_capacity *= 2;
+        }
+        char *grown = realloc(ob->text, new_capacity);
+        if (grown == NULL) {
+            perror("Erreur realloc");
+            return;
+        }
+        ob->text = grown;
+        ob->text_capacity = new_capacity;
+    }
+
+    va_start(args, format);
+    vsnprintf(ob->text + ob->text_len, (size_t)len + 1, format, args);
+    va_end(args);
+    ob->text_len += (size_t)len;
+}
+
+// Ajoute un événement du journal. En format texte, seul format est utilisé
+// (un événement sans format n'est pas journalisé) ; en format binaire, rien
+// n'est formaté : les noms sont résolus en identifiants et content est
+// conservé tel quel.
+void outbox_event(Outbox *ob, SharedMemory *shm, LogEventType type,
+                  const char *user, const char *target, const char *group,
+                  const char *content, const char *format, ...) {
+    int log_format = logger_format();
+    if (log_format == -1 || (log_format == LOG_FORMAT_TEXT && format == NULL)) {
+        return;
+    }
+
+    if (outbox_reserve((void **)&ob->logs, &ob->log_capacity,
+                       ob->log_count + 1, sizeof(OutboxLog)) == -1) {
+        return;
+    }
+    OutboxLog *log = &ob->logs[ob->log_count++];
+    log->type = type;
+    log->user_id = -1;
+    log->target_id = -1;
+    log->group_id = -1;
+
+    if (log_format == LOG_FORMAT_BINARY) {
+        Group *g = (group != NULL) ? group_find(shm, group) : NULL;
+        log->user_id = (user != NULL) ? user_get_id(shm, user) : -1;
+        log->target_id = (target != NULL) ? user_get_id(shm, target) : -1;
+        log->group_id = (g != NULL) ? shm_group_slot(shm, g) : -1;
+        strncpy(log->details, content != NULL ? content : "", sizeof(log->details) - 1);
+        log->details[sizeof(log->details) - 1] = '\0';
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(log->details, sizeof(log->details), format, args);
+    va_end(args);
+}
+
+// Ordre d'envoi : par destinataire, puis dans l'ordre d'ajout
+static int send_compare(const void *a, const void *b, void *arg) {
+    const OutboxSend *sends = arg;
+    const OutboxSend *sa = &sends[*(const int *)a];
+    const OutboxSend *sb = &sends[*(const int *)b];
+
+    if (sa->addr.sin_family != sb->addr.sin_family) {
+        return sa->addr.sin_family < sb->addr.sin_family ? -1 : 1;
+    }
+    if (sa->addr.sin_addr.s_addr != sb->addr.sin_addr.s_addr) {
+        return sa->addr.sin_addr.s_addr < sb->addr.sin_addr.s_addr ? -1 : 1;
+    }
+    if (sa->addr.sin_port != sb->addr.sin_port) {
+        return sa->addr.sin_port < sb->addr.sin_port ? -1 : 1;
+    }
+    return *(const int *)a - *(const int *)b;
+}
+
+// Envoie tous les messages retenus, par lots de SEND_BATCH_SIZE (un
+// sendmmsg par lot). Les envois sont d'abord rangés par destinataire pour
+// que socket_send_multi regroupe les messages d'un même destinataire dans
+// un seul datagramme.
+// Avec des files d'envoi, un message refusé par le tampon d'émission, ou
+// destiné à quelqu'un qui a déjà des messages en attente, rejoint la file
+// de son destinataire (voir sendq.c).
+void outbox_send_pending(Outbox *ob, int sockfd) {
+    Message *msgs[SEND_BATCH_SIZE];
+    struct sockaddr_in addrs[SEND_BATCH_SIZE];
+    OutboxSend *sends[SEND_BATCH_SIZE];
+    int status[SEND_BATCH_SIZE];
+    int *order = NULL;
+    int pos = 0;
+
+    if (g_bundle && ob->send_count > 1) {
+        order = malloc((size_t)ob->send_count * sizeof(int));
+        if (order != NULL) {
+            for (int i = 0; i < ob->send_count; i++) {
+                order[i] = i;
+            }
+            qsort_r(order, ob->send_count, sizeof(int), send_compare, ob->sends);
+        }
+    }
+
+    while (pos < ob->send_count) {
+        int n = 0;
+        while (n < SEND_BATCH_SIZE && pos < ob->send_count) {
+            OutboxSend *send = &ob->sends[order != NULL ? order[pos] : pos];
+            pos++;
+            if (ob->queues != NULL && sendq_blocked(ob->queues, &send->addr)) {
+                sendq_push(ob->queues, send->username, &send->addr, &ob->msgs[send->msg]);
+                continue;
+            }
+            msgs[n] = &ob->msgs[send->msg];
+            addrs[n] = send->addr;
+            sends[n] = send;
+            n++;
+        }
+        if (n == 0) {
+            continue;
+        }
+
+        socket_send_multi(sockfd, msgs, addrs, n, status);
+        for (int i = 0; i < n; i++) {
+            if (ob->queues != NULL && (status[i] == EAGAIN || status[i] == EWOULDBLOCK ||
+                                       status[i] == ENOBUFS)) {
+                sendq_push(ob->queues, sends[i]->username, &sends[i]->addr, msgs[i]);
+            } else if (status[i] != 0) {
+                fprintf(stderr, "Échec d'envoi à %s: %s\n",
+                        sends[i]->username, strerror(status[i]));
+            }
+        }
+    }
+
+    free(order);
+    ob->msg_count = 0;
+    ob->send_count = 0;
+    ob->send_deadline_us = 0;
+}
+
+// Millisecondes avant l'envoi des messages retenus (0 : à faire
+// maintenant), ou -1 s'il n'y en a aucun
+int outbox_send_timeout(const Outbox *ob) {
+    if (ob->send_count == 0) {
+        return -1;
+    }
+    uint64_t now = now_us();
+    if (ob->send_deadline_us <= now) {
+        return 0;
+    }
+    // Arrondi au-dessus : epoll_wait compte en millisecondes
+    return (int)((ob->send_deadline_us - now + 999) / 1000);
+}
+
+// Affiche et dépose dans le journal asynchrone le contenu de l'outbox, puis
+// envoie les messages, ou les retient jusqu'à l'échéance fixée par
+// outbox_configure pour regrouper ceux qui suivront (l'appelant appelle
+// outbox_send_pending quand outbox_send_timeout atteint 0).
+void outbox_flush(Outbox *ob, int sockfd) {
+    if (ob->send_count > 0) {
+        if (g_send_delay_us == 0 || ob->send_count >= SEND_PENDING_MAX) {
+            outbox_send_pending(ob, sockfd);
+        } else if (ob->send_deadline_us == 0) {
+            ob->send_deadline_us = now_us() + g_send_delay_us;
+        }
+    }
+
+    if (ob->text_len > 0) {
+        fwrite(ob->text, 1, ob->text_len, stdout);
+    }
+
+    for (int i = 0; i < ob->log_count; i++) {
+        OutboxLog *log = &ob->logs[i];
+        log_post(log->type, log->user_id, log->target_id, log->group_id, log->details);
+    }
+
+    ob->log_count = 0;
+    ob->text_len = 0;
+}
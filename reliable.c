@@ -0,0 +1,654 @@
+#define _GNU_SOURCE
+#include "messaging.h"
+#include <sys/socket.h>
+
+// ========== Couche de fiabilité ==========
+
+// Livraison fiable optionnelle au-dessus d'UDP, par pair (adresse et port) :
+//   - l'émetteur numérote ses datagrammes dans une session tirée au hasard
+//     (WIRE_FLAG_SEQ) et en garde une copie tant qu'ils ne sont pas
+//     acquittés, au plus RELIABLE_WINDOW à la fois ; les suivants attendent
+//     dans une file ;
+//   - le récepteur répond par un MSG_ACK portant le prochain numéro attendu
+//     et un masque des RELIABLE_WINDOW numéros suivants déjà reçus, et
+//     ignore les doublons ;
+//   - un thread retransmet les datagrammes dont le délai (calculé à partir
+//     du RTT mesuré) a expiré, et abandonne un pair après
+//     RELIABLE_MAX_RETRIES tentatives ;
+//   - ce même thread libère les pairs abandonnés, déconnectés
+//     (reliable_forget) ou inactifs depuis RELIABLE_IDLE_MS : un client qui
+//     revient d'un autre port ne laisse pas derrière lui son ancien état.
+// Les datagrammes sont remis dès leur arrivée, sans attendre les numéros
+// manquants : une perte ne retarde pas les autres conversations.
+// La réception est toujours active ; reliable_start active l'émission
+// fiable pour tous les envois de socket_send et socket_send_multi.
+
+typedef struct {
+    uint32_t seq;
+    int acked;
+    int retries;
+    uint64_t sent_us;        // Premier envoi (mesure du RTT)
+    uint64_t deadline_us;    // Prochaine retransmission
+    size_t len;
+    unsigned char data[WIRE_MAX_SIZE];
+} ReliableSlot;
+
+typedef struct ReliableQueued {
+    struct ReliableQueued *next;
+    size_t len;
+    unsigned char data[];    // Datagramme encodé, sans bloc de séquence
+} ReliableQueued;
+
+typedef struct ReliablePeer {
+    struct ReliablePeer *next;   // Chaîne de la table, puis des pairs retirés
+    struct sockaddr_in addr;
+    pthread_mutex_t lock;
+    int refs;                    // Utilisations en cours (peer_get/peer_put)
+    int forgotten;               // À retirer au prochain passage (reliable_forget)
+    uint64_t active_us;          // Dernier envoi ou dernière réception
+
+    // Émission
+    uint32_t send_session;
+    uint32_t send_next;          // Prochain numéro attribué
+    uint32_t send_una;           // Plus ancien numéro non acquitté
+    ReliableSlot *window;        // Alloué au premier envoi fiable
+    ReliableQueued *queue_head;
+    ReliableQueued *queue_tail;
+    int queue_count;
+    int dup_acks;
+    uint64_t srtt_us;
+    uint64_t rttvar_us;
+    uint64_t rto_us;
+
+    // Réception
+    int recv_started;
+    uint32_t recv_session;
+    uint32_t recv_next;          // Prochain numéro attendu
+    uint32_t recv_mask;          // Bit i : recv_next + 1 + i déjà reçu
+} ReliablePeer;
+
+static struct {
+    pthread_mutex_t lock;        // Protège les chaînes de la table
+    ReliablePeer *buckets[RELIABLE_BUCKETS];
+    ReliablePeer *retired;       // Retirés de la table, encore utilisés
+    int enabled;
+    int sockfd;                  // Socket des retransmissions
+    pthread_t thread;
+    int running;
+    int stop;
+    uint64_t retransmits;
+    uint64_t give_ups;
+    uint64_t ticks;              // Passages complets du thread
+    int pending;                 // Datagrammes non acquittés au dernier passage
+} g_reliable = { .lock = PTHREAD_MUTEX_INITIALIZER, .sockfd = -1 };
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// Différence signée entre numéros de séquence (gère le rebouclage)
+static int32_t seq_diff(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b);
+}
+
+static void put_u32(unsigned char *p, uint32_t value) {
+    p[0] = (unsigned char)(value >> 24);
+    p[1] = (unsigned char)(value >> 16);
+    p[2] = (unsigned char)(value >> 8);
+    p[3] = (unsigned char)value;
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint32_t new_session(const ReliablePeer *peer) {
+    uint64_t seed = now_us() ^ ((uint64_t)getpid() << 32) ^ (uintptr_t)peer;
+    seed ^= seed >> 33;
+    seed *= 0xff51afd7ed558ccdull;
+    seed ^= seed >> 33;
+    return (uint32_t)seed;
+}
+
+// ========== Table des pairs ==========
+
+// Seul le thread de retransmission retire des pairs de la table et les
+// libère, une fois que plus personne ne s'en sert : un pointeur obtenu par
+// peer_get reste valable jusqu'au peer_put correspondant. Les autres
+// threads n'ajoutent qu'en tête de chaîne.
+
+static unsigned int peer_bucket(const struct sockaddr_in *addr) {
+    return (addr->sin_addr.s_addr * 2654435761u ^ addr->sin_port) % RELIABLE_BUCKETS;
+}
+
+static ReliablePeer *peer_find(unsigned int bucket, const struct sockaddr_in *addr) {
+    ReliablePeer *peer = g_reliable.buckets[bucket];
+    while (peer != NULL &&
+           (peer->addr.sin_addr.s_addr != addr->sin_addr.s_addr ||
+            peer->addr.sin_port != addr->sin_port)) {
+        peer = peer->next;
+    }
+    return peer;
+}
+
+static ReliablePeer *peer_get(const struct sockaddr_in *addr) {
+    unsigned int bucket = peer_bucket(addr);
+
+    pthread_mutex_lock(&g_reliable.lock);
+    ReliablePeer *peer = peer_find(bucket, addr);
+
+    if (peer == NULL) {
+        peer = calloc(1, sizeof(ReliablePeer));
+        if (peer == NULL) {
+            perror("Erreur calloc");
+        } else {
+            peer->addr = *addr;
+            pthread_mutex_init(&peer->lock, NULL);
+            peer->send_session = new_session(peer);
+            peer->rto_us = RELIABLE_RTO_INITIAL_MS * 1000ull;
+            peer->next = g_reliable.buckets[bucket];
+            g_reliable.buckets[bucket] = peer;
+        }
+    }
+    if (peer != NULL) {
+        // De nouveau utilisé : une déconnexion antérieure ne vaut plus
+        __atomic_store_n(&peer->forgotten, 0, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&peer->refs, 1, __ATOMIC_ACQ_REL);
+    }
+    pthread_mutex_unlock(&g_reliable.lock);
+    return peer;
+}
+
+static void peer_put(ReliablePeer *peer) {
+    __atomic_sub_fetch(&peer->refs, 1, __ATOMIC_ACQ_REL);
+}
+
+// ========== Émission ==========
+
+static void peer_sendto(int sockfd, ReliablePeer *peer, const unsigned char *buf, size_t len) {
+    if (sockfd >= 0) {
+        sendto(sockfd, buf, len, 0, (struct sockaddr *)&peer->addr, sizeof(peer->addr));
+    }
+}
+
+// Numérote le datagramme wire et en garde une copie dans la fenêtre ;
+// retourne la case utilisée. L'appelant a vérifié qu'il reste de la place.
+static ReliableSlot *peer_push(ReliablePeer *peer, const unsigned char *wire, size_t len) {
+    uint32_t seq = peer->send_next++;
+    ReliableSlot *slot = &peer->window[seq % RELIABLE_WINDOW];
+    unsigned char *p = slot->data;
+
+    memcpy(p, wire, WIRE_HEADER_SIZE);
+    p[3] |= WIRE_FLAG_SEQ;
+    put_u32(p + WIRE_HEADER_SIZE, peer->send_session);
+    put_u32(p + WIRE_HEADER_SIZE + 4, seq);
+    memcpy(p + WIRE_HEADER_SIZE + WIRE_SEQ_SIZE, wire + WIRE_HEADER_SIZE, len - WIRE_HEADER_SIZE);
+
+    slot->seq = seq;
+    slot->acked = 0;
+    slot->retries = 0;
+    slot->len = len + WIRE_SEQ_SIZE;
+    slot->sent_us = now_us();
+    slot->deadline_us = slot->sent_us + peer->rto_us;
+    return slot;
+}
+
+static int peer_window_full(const ReliablePeer *peer) {
+    return peer->send_next - peer->send_una >= RELIABLE_WINDOW;
+}
+
+// Fait entrer dans la fenêtre les datagrammes en attente et les envoie
+static void peer_release(int sockfd, ReliablePeer *peer) {
+    while (peer->queue_head != NULL && !peer_window_full(peer)) {
+        ReliableQueued *queued = peer->queue_head;
+        peer->queue_head = queued->next;
+        if (peer->queue_head == NULL) {
+            peer->queue_tail = NULL;
+        }
+        peer->queue_count--;
+
+        ReliableSlot *slot = peer_push(peer, queued->data, queued->len);
+        peer_sendto(sockfd, peer, slot->data, slot->len);
+        free(queued);
+    }
+}
+
+// Oublie tout ce qui reste à émettre et change de session : le récepteur
+// repartira du numéro 0
+static void peer_reset_send(ReliablePeer *peer) {
+    while (peer->queue_head != NULL) {
+        ReliableQueued *queued = peer->queue_head;
+        peer->queue_head = queued->next;
+        free(queued);
+    }
+    peer->queue_tail = NULL;
+    peer->queue_count = 0;
+    peer->send_session = new_session(peer);
+    peer->send_next = 0;
+    peer->send_una = 0;
+    peer->dup_acks = 0;
+    peer->srtt_us = 0;
+    peer->rttvar_us = 0;
+    peer->rto_us = RELIABLE_RTO_INITIAL_MS * 1000ull;
+}
+
+static void peer_free(ReliablePeer *peer) {
+    peer_reset_send(peer);
+    pthread_mutex_destroy(&peer->lock);
+    free(peer->window);
+    free(peer);
+}
+
+// Estimation du délai de retransmission (RFC 6298)
+static void peer_rtt_sample(ReliablePeer *peer, uint64_t sample_us) {
+    if (peer->srtt_us == 0) {
+        peer->srtt_us = sample_us;
+        peer->rttvar_us = sample_us / 2;
+    } else {
+        uint64_t delta = peer->srtt_us > sample_us ? peer->srtt_us - sample_us
+                                                   : sample_us - peer->srtt_us;
+        peer->rttvar_us = (3 * peer->rttvar_us + delta) / 4;
+        peer->srtt_us = (7 * peer->srtt_us + sample_us) / 8;
+    }
+
+    peer->rto_us = peer->srtt_us + 4 * peer->rttvar_us;
+    if (peer->rto_us < RELIABLE_RTO_MIN_MS * 1000ull) {
+        peer->rto_us = RELIABLE_RTO_MIN_MS * 1000ull;
+    } else if (peer->rto_us > RELIABLE_RTO_MAX_MS * 1000ull) {
+        peer->rto_us = RELIABLE_RTO_MAX_MS * 1000ull;
+    }
+}
+
+// Retransmet une case et arme son prochain délai
+static void peer_retransmit(int sockfd, ReliablePeer *peer, ReliableSlot *slot, uint64_t now) {
+    slot->retries++;
+    slot->deadline_us = now + peer->rto_us;
+    peer_sendto(sockfd, peer, slot->data, slot->len);
+    __atomic_add_fetch(&g_reliable.retransmits, 1, __ATOMIC_RELAXED);
+}
+
+// Applique un ACK : next est le prochain numéro attendu par le pair, le
+// bit i de mask signale la réception de next + 1 + i
+static void peer_on_ack(int sockfd, ReliablePeer *peer, uint32_t session,
+                        uint32_t next, uint32_t mask) {
+    if (peer->window == NULL || session != peer->send_session ||
+        seq_diff(next, peer->send_next) > 0) {
+        return;
+    }
+
+    uint64_t now = now_us();
+    uint32_t old_una = peer->send_una;
+
+    for (uint32_t seq = peer->send_una; seq != peer->send_next; seq++) {
+        ReliableSlot *slot = &peer->window[seq % RELIABLE_WINDOW];
+        int32_t offset = seq_diff(seq, next);
+        int acked = offset < 0 ||
+                    (offset > 0 && offset <= 32 && ((mask >> (offset - 1)) & 1));
+        if (acked && !slot->acked) {
+            slot->acked = 1;
+            // Algorithme de Karn : pas de mesure sur un datagramme retransmis
+            if (slot->retries == 0) {
+                peer_rtt_sample(peer, now - slot->sent_us);
+            }
+        }
+    }
+
+    while (peer->send_una != peer->send_next &&
+           peer->window[peer->send_una % RELIABLE_WINDOW].acked) {
+        peer->send_una++;
+    }
+
+    if (peer->send_una != old_una) {
+        peer->dup_acks = 0;
+    } else if (peer->send_una != peer->send_next && mask != 0 &&
+               ++peer->dup_acks == RELIABLE_DUP_ACKS) {
+        // Des datagrammes plus récents sont arrivés mais pas le plus ancien :
+        // le retransmettre sans attendre son délai
+        peer_retransmit(sockfd, peer, &peer->window[peer->send_una % RELIABLE_WINDOW], now);
+    }
+
+    peer_release(sockfd, peer);
+}
+
+// Prépare l'envoi fiable vers addr du datagramme wire (produit par
+// message_encode). Retourne la longueur du datagramme numéroté écrit dans
+// out (WIRE_MAX_SIZE octets), 0 s'il attend une place dans la fenêtre (il
+// sera envoyé par la couche de fiabilité), ou -1.
+ssize_t reliable_track(const struct sockaddr_in *addr, const unsigned char *wire, size_t len,
+                       unsigned char *out) {
+    if (len < WIRE_HEADER_SIZE || len + WIRE_SEQ_SIZE > WIRE_MAX_SIZE) {
+        return -1;
+    }
+
+    ReliablePeer *peer = peer_get(addr);
+    if (peer == NULL) {
+        return -1;
+    }
+
+    ssize_t result = -1;
+    pthread_mutex_lock(&peer->lock);
+    peer->active_us = now_us();
+    if (peer->window == NULL) {
+        peer->window = calloc(RELIABLE_WINDOW, sizeof(ReliableSlot));
+        if (peer->window == NULL) {
+            perror("Erreur calloc");
+            pthread_mutex_unlock(&peer->lock);
+            peer_put(peer);
+            return -1;
+        }
+    }
+
+    if (!peer_window_full(peer) && peer->queue_head == NULL) {
+        ReliableSlot *slot = peer_push(peer, wire, len);
+        memcpy(out, slot->data, slot->len);
+        result = (ssize_t)slot->len;
+    } else if (peer->queue_count < RELIABLE_BACKLOG_MAX) {
+        ReliableQueued *queued = malloc(sizeof(ReliableQueued) + len);
+        if (queued == NULL) {
+            perror("Erreur malloc");
+        } else {
+            queued->next = NULL;
+            queued->len = len;
+            memcpy(queued->data, wire, len);
+            if (peer->queue_tail != NULL) {
+                peer->queue_tail->next = queued;
+            } else {
+                peer->queue_head = queued;
+            }
+            peer->queue_tail = queued;
+            peer->queue_count++;
+            result = 0;
+        }
+    } else {
+        errno = ENOBUFS;
+    }
+    pthread_mutex_unlock(&peer->lock);
+    peer_put(peer);
+    return result;
+}
+
+// ========== Réception ==========
+
+// Traite les blocs de fiabilité d'un datagramme reçu de addr. Retourne 1 si
+// le datagramme doit être remis, 0 s'il est consommé (ACK seul, doublon,
+// hors fenêtre ou invalide). Si un acquittement est dû, il est écrit dans
+// ack (WIRE_HEADER_SIZE + WIRE_ACK_SIZE octets) et *ack_len est non nul.
+int reliable_receive(int sockfd, const unsigned char *buf, size_t len,
+                     const struct sockaddr_in *addr, unsigned char *ack, size_t *ack_len) {
+    *ack_len = 0;
+    if (len < WIRE_HEADER_SIZE || buf[0] != WIRE_VERSION) {
+        return 0;
+    }
+
+    unsigned char flags = buf[3];
+    if (!(flags & (WIRE_FLAG_SEQ | WIRE_FLAG_ACK))) {
+        return buf[1] != MSG_ACK;
+    }
+
+    size_t needed = WIRE_HEADER_SIZE + ((flags & WIRE_FLAG_SEQ) ? WIRE_SEQ_SIZE : 0) +
+                    ((flags & WIRE_FLAG_ACK) ? WIRE_ACK_SIZE : 0);
+    if (len < needed) {
+        return 0;
+    }
+
+    ReliablePeer *peer = peer_get(addr);
+    if (peer == NULL) {
+        return 0;
+    }
+
+    const unsigned char *p = buf + WIRE_HEADER_SIZE;
+    int deliver = (buf[1] != MSG_ACK);
+
+    pthread_mutex_lock(&peer->lock);
+    peer->active_us = now_us();
+    if (flags & WIRE_FLAG_SEQ) {
+        uint32_t session = get_u32(p);
+        uint32_t seq = get_u32(p + 4);
+        p += WIRE_SEQ_SIZE;
+
+        if (!peer->recv_started || session != peer->recv_session) {
+            // Nouvelle session : elle commence au numéro 0, sauf si ce pair
+            // nous est inconnu (redémarrage de ce côté) et déjà bien avancé
+            int resume = !peer->recv_started && seq >= RELIABLE_WINDOW;
+            peer->recv_started = 1;
+            peer->recv_session = session;
+            peer->recv_next = resume ? seq : 0;
+            peer->recv_mask = 0;
+        }
+
+        int32_t offset = seq_diff(seq, peer->recv_next);
+        if (offset < 0 || offset >= RELIABLE_WINDOW) {
+            deliver = 0;    // Doublon déjà remis, ou hors fenêtre
+        } else if (offset == 0) {
+            peer->recv_next++;
+            while (peer->recv_mask & 1) {
+                peer->recv_mask >>= 1;
+                peer->recv_next++;
+            }
+            peer->recv_mask >>= 1;
+        } else if ((peer->recv_mask >> (offset - 1)) & 1) {
+            deliver = 0;    // Doublon arrivé dans le désordre
+        } else {
+            peer->recv_mask |= 1u << (offset - 1);
+        }
+
+        // Acquitter même les doublons : l'ACK précédent a pu se perdre
+        memset(ack, 0, WIRE_HEADER_SIZE);
+        ack[0] = WIRE_VERSION;
+        ack[1] = MSG_ACK;
+        ack[3] = WIRE_FLAG_ACK;
+        put_u32(ack + WIRE_HEADER_SIZE, peer->recv_session);
+        put_u32(ack + WIRE_HEADER_SIZE + 4, peer->recv_next);
+        put_u32(ack + WIRE_HEADER_SIZE + 8, peer->recv_mask);
+        *ack_len = WIRE_HEADER_SIZE + WIRE_ACK_SIZE;
+    }
+
+    if (flags & WIRE_FLAG_ACK) {
+        peer_on_ack(sockfd, peer, get_u32(p), get_u32(p + 4), get_u32(p + 8));
+    }
+    pthread_mutex_unlock(&peer->lock);
+    peer_put(peer);
+
+    return deliver;
+}
+
+// ========== Retransmissions ==========
+
+// Retransmet les datagrammes en retard du pair et ajoute à *pending ceux
+// qui restent à acquitter. Retourne 1 si le pair est à retirer : oublié,
+// abandonné après RELIABLE_MAX_RETRIES tentatives, ou inactif sans rien
+// en attente.
+static int peer_tick(ReliablePeer *peer, uint64_t now, int *pending) {
+    int sockfd = g_reliable.sockfd;
+    int remove = __atomic_load_n(&peer->forgotten, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&peer->lock);
+    if (peer->window != NULL && !remove) {
+        for (uint32_t seq = peer->send_una; seq != peer->send_next; seq++) {
+            ReliableSlot *slot = &peer->window[seq % RELIABLE_WINDOW];
+            if (slot->acked || slot->deadline_us > now) {
+                continue;
+            }
+
+            if (slot->retries >= RELIABLE_MAX_RETRIES) {
+                char addr_str[ADDR_STR_LEN];
+                fprintf(stderr, "Fiabilité : %s injoignable, %u datagramme(s) abandonné(s)\n",
+                        addr_format(&peer->addr, addr_str, sizeof(addr_str)),
+                        (unsigned)(peer->send_next - peer->send_una) + (unsigned)peer->queue_count);
+                __atomic_add_fetch(&g_reliable.give_ups, 1, __ATOMIC_RELAXED);
+                remove = 1;
+                break;
+            }
+
+            // Délai exponentiel : le pair ou le lien est peut-être saturé
+            peer->rto_us *= 2;
+            if (peer->rto_us > RELIABLE_RTO_MAX_MS * 1000ull) {
+                peer->rto_us = RELIABLE_RTO_MAX_MS * 1000ull;
+            }
+            peer_retransmit(sockfd, peer, slot, now);
+        }
+        if (!remove) {
+            peer_release(sockfd, peer);
+        }
+    }
+
+    int unacked = (peer->window != NULL) ?
+                  (int)(peer->send_next - peer->send_una) + peer->queue_count : 0;
+    if (!remove && unacked == 0 && now - peer->active_us > RELIABLE_IDLE_MS * 1000ull) {
+        remove = 1;
+    }
+    if (!remove) {
+        *pending += unacked;
+    }
+    pthread_mutex_unlock(&peer->lock);
+    return remove;
+}
+
+// Décroche le pair de la table et le range parmi les pairs retirés
+static void peer_unlink(unsigned int bucket, ReliablePeer *peer) {
+    pthread_mutex_lock(&g_reliable.lock);
+    ReliablePeer **link = &g_reliable.buckets[bucket];
+    while (*link != peer) {
+        link = &(*link)->next;
+    }
+    *link = peer->next;
+    peer->next = g_reliable.retired;
+    g_reliable.retired = peer;
+    pthread_mutex_unlock(&g_reliable.lock);
+}
+
+// Libère les pairs retirés dont plus personne ne se sert ; un pair retiré
+// n'est plus trouvé par peer_get, son compteur ne peut que baisser
+static void peer_collect(void) {
+    pthread_mutex_lock(&g_reliable.lock);
+    ReliablePeer **link = &g_reliable.retired;
+    while (*link != NULL) {
+        ReliablePeer *peer = *link;
+        if (__atomic_load_n(&peer->refs, __ATOMIC_ACQUIRE) == 0) {
+            *link = peer->next;
+            peer_free(peer);
+        } else {
+            link = &peer->next;
+        }
+    }
+    pthread_mutex_unlock(&g_reliable.lock);
+}
+
+// Un passage sur tous les pairs. Ce thread étant le seul à retirer des
+// pairs, il parcourt chaque chaîne hors du verrou à partir de sa tête (les
+// ajouts se font devant) ; le suivant est lu avant un éventuel retrait.
+static void reliable_tick(uint64_t now) {
+    int pending = 0;
+
+    for (unsigned int b = 0; b < RELIABLE_BUCKETS; b++) {
+        pthread_mutex_lock(&g_reliable.lock);
+        ReliablePeer *peer = g_reliable.buckets[b];
+        pthread_mutex_unlock(&g_reliable.lock);
+
+        while (peer != NULL) {
+            ReliablePeer *next = peer->next;
+            if (peer_tick(peer, now, &pending)) {
+                peer_unlink(b, peer);
+            }
+            peer = next;
+        }
+    }
+    peer_collect();
+
+    __atomic_store_n(&g_reliable.pending, pending, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&g_reliable.ticks, 1, __ATOMIC_RELEASE);
+}
+
+static void *reliable_run(void *arg) {
+    (void)arg;
+    struct timespec pause = { 0, RELIABLE_TICK_MS * 1000000L };
+
+    while (!__atomic_load_n(&g_reliable.stop, __ATOMIC_ACQUIRE)) {
+        nanosleep(&pause, NULL);
+        reliable_tick(now_us());
+    }
+    return NULL;
+}
+
+// Le destinataire addr s'est déconnecté : ce qui lui reste à émettre est
+// abandonné et son état libéré au prochain passage du thread (tout de
+// suite s'il ne tourne pas, personne d'autre ne parcourant alors la table)
+void reliable_forget(const struct sockaddr_in *addr) {
+    unsigned int bucket = peer_bucket(addr);
+
+    pthread_mutex_lock(&g_reliable.lock);
+    ReliablePeer *peer = peer_find(bucket, addr);
+    int collect = (peer != NULL && !g_reliable.running);
+    if (collect) {
+        ReliablePeer **link = &g_reliable.buckets[bucket];
+        while (*link != peer) {
+            link = &(*link)->next;
+        }
+        *link = peer->next;
+        peer->next = g_reliable.retired;
+        g_reliable.retired = peer;
+    } else if (peer != NULL) {
+        __atomic_store_n(&peer->forgotten, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&g_reliable.lock);
+
+    if (collect) {
+        peer_collect();
+    }
+}
+
+// ========== Démarrage et arrêt ==========
+
+// Active l'émission fiable ; sockfd sert aux retransmissions (il doit être
+// lié à la même adresse que les sockets d'envoi)
+int reliable_start(int sockfd) {
+    g_reliable.sockfd = sockfd;
+    __atomic_store_n(&g_reliable.stop, 0, __ATOMIC_RELEASE);
+
+    int err = pthread_create(&g_reliable.thread, NULL, reliable_run, NULL);
+    if (err != 0) {
+        fprintf(stderr, "Erreur pthread_create: %s\n", strerror(err));
+        return -1;
+    }
+    g_reliable.running = 1;
+    __atomic_store_n(&g_reliable.enabled, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int reliable_enabled(void) {
+    return __atomic_load_n(&g_reliable.enabled, __ATOMIC_ACQUIRE);
+}
+
+// Attend au plus drain_ms que tous les envois soient acquittés (la
+// réception doit continuer pendant ce temps), puis arrête les
+// retransmissions
+void reliable_stop(int drain_ms) {
+    if (!g_reliable.running) {
+        return;
+    }
+
+    // Le compte publié par le thread date au plus d'un passage : attendre
+    // qu'un passage complet ait commencé après l'appel
+    struct timespec pause = { 0, RELIABLE_TICK_MS * 1000000L };
+    uint64_t ticks = __atomic_load_n(&g_reliable.ticks, __ATOMIC_ACQUIRE);
+    for (int waited = 0; waited < drain_ms; waited += RELIABLE_TICK_MS) {
+        if (__atomic_load_n(&g_reliable.ticks, __ATOMIC_ACQUIRE) >= ticks + 2 &&
+            __atomic_load_n(&g_reliable.pending, __ATOMIC_ACQUIRE) == 0) {
+            break;
+        }
+        nanosleep(&pause, NULL);
+    }
+
+    __atomic_store_n(&g_reliable.enabled, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_reliable.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(g_reliable.thread, NULL);
+    g_reliable.running = 0;
+
+    if (g_reliable.retransmits > 0 || g_reliable.give_ups > 0) {
+        printf("Fiabilité : %llu retransmission(s), %llu pair(s) abandonné(s)\n",
+               (unsigned long long)g_reliable.retransmits,
+               (unsigned long long)g_reliable.give_ups);
+    }
+}
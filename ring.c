@@ -0,0 +1,480 @@
+#include "messaging.h"
+#include <signal.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// ========== Clients locaux : anneaux en mémoire partagée ==========
+
+// Le serveur lancé avec -l <n> crée un second segment (clé
+// ftok(SHM_KEY_FILE, '2')) de n emplacements. Un client lancé avec -l sur
+// la même machine prend un emplacement libre et y échange ses datagrammes
+// (le même format que sur le réseau) : to_server vers le serveur,
+// to_client en retour. Aucun appel système tant que le consommateur est
+// éveillé ; sinon le producteur le réveille par un futex.
+//
+// Côté serveur, seul le worker 0 consomme les anneaux to_server. Il ne dort
+// que dans epoll_wait : un thread attend le futex doorbell et le convertit
+// en écriture sur un eventfd surveillé par ce worker (un eventfd ne se
+// partage pas avec un processus sans lien). Plusieurs workers peuvent
+// produire vers un même client : un verrou par emplacement les sérialise.
+//
+// Un anneau vers le client plein refuse le datagramme (EAGAIN) : le worker
+// le range dans la file d'envoi du client (voir sendq.c), dont la taille
+// et la politique décident des pertes. Vers le serveur, le client attend
+// d'abord un peu qu'une place se libère, puis perd le datagramme (compteur
+// drops). La couche fiable ne s'applique pas à ces clients, aucun
+// datagramme n'étant perdu tant que l'anneau suit.
+
+static RingSegment *g_ring = NULL;
+static int g_ring_server = 0;                      // Processus serveur (sinon client)
+static pthread_mutex_t *g_ring_send_locks = NULL;  // Serveur : un par emplacement
+static int g_ring_next = 0;                        // Serveur : premier emplacement lu par ring_poll
+static int g_ring_notify_fd = -1;
+static int g_ring_stop = 0;
+static pthread_t g_ring_doorbell_thread;
+
+static int g_ring_slot = -1;                       // Client : emplacement pris
+static pthread_mutex_t g_ring_client_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long futex(uint32_t *addr, int op, uint32_t val, const struct timespec *timeout) {
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static size_t ring_segment_size(int slot_count) {
+    return sizeof(RingSegment) + (size_t)slot_count * sizeof(RingSlot);
+}
+
+static void ring_make_addr(struct sockaddr_in *addr, int slot, uint32_t generation) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_RING;
+    addr->sin_port = htons((uint16_t)slot);
+    addr->sin_addr.s_addr = generation;
+}
+
+static int ring_owner_alive(pid_t pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+// Producteur : dépose un datagramme ; -1 si l'anneau est plein
+static int ring_push(Ring *ring, const unsigned char *buf, size_t len) {
+    uint32_t tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= RING_CELLS) {
+        return -1;
+    }
+    memcpy(ring->cells[tail % RING_CELLS].data, buf, len);
+    ring->cells[tail % RING_CELLS].len = (uint32_t)len;
+    // SEQ_CST : ordonné avec la lecture de sleeping qui suit (voir ring_receive)
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+// Consommateur : copie le plus ancien datagramme dans buf ; retourne sa
+// taille, ou -1 si l'anneau est vide
+static ssize_t ring_pop(Ring *ring, unsigned char *buf) {
+    uint32_t head = ring->head;
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    // L'autre extrémité est un processus quelconque : ne pas croire len
+    size_t len = ring->cells[head % RING_CELLS].len;
+    if (len > WIRE_MAX_SIZE) {
+        len = 0;
+    }
+    memcpy(buf, ring->cells[head % RING_CELLS].data, len);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return (ssize_t)len;
+}
+
+static int ring_empty(Ring *ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) ==
+           __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+}
+
+// ========== Serveur ==========
+
+static void *ring_doorbell_run(void *arg) {
+    (void)arg;
+    uint32_t seen = __atomic_load_n(&g_ring->doorbell, __ATOMIC_ACQUIRE);
+
+    while (!__atomic_load_n(&g_ring_stop, __ATOMIC_ACQUIRE)) {
+        futex(&g_ring->doorbell, FUTEX_WAIT, seen, NULL);
+        uint32_t now = __atomic_load_n(&g_ring->doorbell, __ATOMIC_ACQUIRE);
+        if (now != seen) {
+            seen = now;
+            uint64_t one = 1;
+            if (write(g_ring_notify_fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+                perror("Erreur write eventfd");
+            }
+        }
+    }
+    return NULL;
+}
+
+// Crée le segment des anneaux, ou reprend celui d'un serveur précédent de
+// même taille (les clients encore lancés gardent leur emplacement), et
+// démarre le thread qui signale notify_fd quand un client dépose un
+// datagramme pendant que le serveur dort
+int ring_start(key_t key, int slot_count, int notify_fd) {
+    size_t size = ring_segment_size(slot_count);
+    RingSegment *seg = NULL;
+
+    int shmid = shmget(key, 0, 0);
+    if (shmid != -1) {
+        struct shmid_ds ds;
+        if (shmctl(shmid, IPC_STAT, &ds) != -1 && ds.shm_segsz == size) {
+            seg = shmat(shmid, NULL, 0);
+            if (seg == (void *)-1) {
+                seg = NULL;
+            } else if (seg->magic != RING_MAGIC || seg->slot_count != slot_count) {
+                shmdt(seg);
+                seg = NULL;
+            }
+        }
+        if (seg == NULL && shm_destroy(shmid) == -1) {
+            return -1;
+        }
+    }
+
+    if (seg == NULL) {
+        shmid = shm_create(key, size);
+        if (shmid == -1) {
+            return -1;
+        }
+        seg = shmat(shmid, NULL, 0);
+        if (seg == (void *)-1) {
+            perror("Erreur shmat");
+            return -1;
+        }
+        memset(seg, 0, size);
+        seg->slot_count = slot_count;
+        __atomic_store_n(&seg->magic, RING_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    // Libérer les emplacements de clients disparus depuis
+    seg->server_sleeping = 0;
+    for (int slot = 0; slot < slot_count; slot++) {
+        RingSlot *rs = &seg->slots[slot];
+        if (rs->state == RING_CLAIMED && !ring_owner_alive(rs->owner)) {
+            __atomic_store_n(&rs->state, RING_FREE, __ATOMIC_RELEASE);
+        }
+    }
+
+    g_ring_send_locks = malloc((size_t)slot_count * sizeof(pthread_mutex_t));
+    if (g_ring_send_locks == NULL) {
+        perror("Erreur malloc");
+        shmdt(seg);
+        return -1;
+    }
+    for (int slot = 0; slot < slot_count; slot++) {
+        pthread_mutex_init(&g_ring_send_locks[slot], NULL);
+    }
+
+    g_ring = seg;
+    g_ring_server = 1;
+    g_ring_notify_fd = notify_fd;
+    g_ring_stop = 0;
+    if (pthread_create(&g_ring_doorbell_thread, NULL, ring_doorbell_run, NULL) != 0) {
+        perror("Erreur pthread_create");
+        free(g_ring_send_locks);
+        g_ring_send_locks = NULL;
+        shmdt(seg);
+        g_ring = NULL;
+        return -1;
+    }
+    printf("Anneaux locaux : %d emplacements\n", slot_count);
+    return 0;
+}
+
+// Le segment est conservé : un serveur relancé reprend les clients locaux
+void ring_stop(void) {
+    if (g_ring == NULL || !g_ring_server) {
+        return;
+    }
+    __atomic_store_n(&g_ring_stop, 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&g_ring->doorbell, 1, __ATOMIC_RELEASE);
+    futex(&g_ring->doorbell, FUTEX_WAKE, INT_MAX, NULL);
+    pthread_join(g_ring_doorbell_thread, NULL);
+
+    for (int slot = 0; slot < g_ring->slot_count; slot++) {
+        pthread_mutex_destroy(&g_ring_send_locks[slot]);
+    }
+    free(g_ring_send_locks);
+    g_ring_send_locks = NULL;
+    shmdt(g_ring);
+    g_ring = NULL;
+}
+
+int ring_enabled(void) {
+    return g_ring != NULL;
+}
+
+// Lit au plus max_count messages dans les anneaux to_server, en commençant
+// à chaque appel par l'emplacement suivant. src_addrs[i] reçoit l'adresse
+// AF_RING du client. Retourne le nombre de messages.
+int ring_poll(Message *msgs, struct sockaddr_in *src_addrs, int max_count) {
+    unsigned char buf[WIRE_MAX_SIZE];
+    int slot_count = g_ring->slot_count;
+    int count = 0;
+
+    for (int k = 0; k < slot_count && count < max_count; k++) {
+        int slot = (g_ring_next + k) % slot_count;
+        RingSlot *rs = &g_ring->slots[slot];
+        Ring *ring = &rs->to_server;
+
+        if (ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        if (__atomic_load_n(&rs->state, __ATOMIC_ACQUIRE) != RING_CLAIMED) {
+            // Restes d'un client parti
+            __atomic_store_n(&ring->head, __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE),
+                             __ATOMIC_RELEASE);
+            continue;
+        }
+
+        struct sockaddr_in addr;
+        ring_make_addr(&addr, slot, __atomic_load_n(&rs->generation, __ATOMIC_ACQUIRE));
+
+        ssize_t len;
+        while (count < max_count && (len = ring_pop(ring, buf)) >= 0) {
+            int n = message_decode_all(&msgs[count], max_count - count, buf, (size_t)len);
+            if (n < 0) {
+                fprintf(stderr, "Datagramme invalide ignoré (emplacement %d, %zd octets)\n", slot, len);
+                continue;
+            }
+            for (int i = 0; i < n; i++) {
+                src_addrs[count++] = addr;
+            }
+        }
+    }
+    g_ring_next = (g_ring_next + 1) % slot_count;
+    return count;
+}
+
+// Appelé par le worker 0 avant epoll_wait : annonce qu'il va dormir puis
+// revérifie les anneaux. Retourne 1 s'il peut dormir (tout dépôt ultérieur
+// sonnera), 0 si un datagramme est arrivé entre-temps.
+int ring_server_sleep(void) {
+    __atomic_store_n(&g_ring->server_sleeping, 1, __ATOMIC_SEQ_CST);
+    for (int slot = 0; slot < g_ring->slot_count; slot++) {
+        if (!ring_empty(&g_ring->slots[slot].to_server)) {
+            __atomic_store_n(&g_ring->server_sleeping, 0, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void ring_server_wake(void) {
+    __atomic_store_n(&g_ring->server_sleeping, 0, __ATOMIC_RELAXED);
+}
+
+// Affiche l'état des emplacements pris
+void ring_dump(FILE *out) {
+    if (g_ring == NULL) {
+        return;
+    }
+    for (int slot = 0; slot < g_ring->slot_count; slot++) {
+        RingSlot *rs = &g_ring->slots[slot];
+        if (__atomic_load_n(&rs->state, __ATOMIC_ACQUIRE) != RING_CLAIMED) {
+            continue;
+        }
+        fprintf(out, "  emplacement %d  pid %d  vers serveur %u/%d perdus %u  vers client %u/%d\n",
+                slot, (int)rs->owner,
+                rs->to_server.tail - rs->to_server.head, RING_CELLS, rs->to_server.drops,
+                rs->to_client.tail - rs->to_client.head, RING_CELLS);
+    }
+}
+
+// ========== Client ==========
+
+// S'attache au segment d'un serveur lancé avec -l
+int ring_attach(key_t key) {
+    int shmid = shmget(key, 0, 0);
+    if (shmid == -1) {
+        return -1;
+    }
+
+    struct shmid_ds ds;
+    if (shmctl(shmid, IPC_STAT, &ds) == -1 || ds.shm_segsz < sizeof(RingSegment)) {
+        return -1;
+    }
+    RingSegment *seg = shmat(shmid, NULL, 0);
+    if (seg == (void *)-1) {
+        perror("Erreur shmat");
+        return -1;
+    }
+    if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != RING_MAGIC ||
+        seg->slot_count < 1 || ring_segment_size(seg->slot_count) != ds.shm_segsz) {
+        fprintf(stderr, "Segment des anneaux locaux invalide\n");
+        shmdt(seg);
+        return -1;
+    }
+    g_ring = seg;
+    return 0;
+}
+
+// Attend (100 ms au plus) que le serveur ait lu to_server
+static void ring_drain_to_server(RingSlot *rs) {
+    for (int i = 0; i < 100 && !ring_empty(&rs->to_server); i++) {
+        usleep(1000);
+    }
+}
+
+// Prend un emplacement libre, ou celui d'un client disparu sans le rendre,
+// et remplit addr avec l'adresse qui désigne le serveur
+int ring_claim(struct sockaddr_in *addr) {
+    pid_t self = getpid();
+
+    for (int slot = 0; slot < g_ring->slot_count; slot++) {
+        RingSlot *rs = &g_ring->slots[slot];
+        uint32_t state = __atomic_load_n(&rs->state, __ATOMIC_ACQUIRE);
+        pid_t owner = rs->owner;
+
+        if (state == RING_CLAIMED && ring_owner_alive(owner)) {
+            continue;
+        }
+        if (state == RING_CLAIMED) {
+            // Reprise : un seul client l'emporte en réécrivant owner
+            if (!__atomic_compare_exchange_n(&rs->owner, &owner, self, 0,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                continue;
+            }
+        } else {
+            if (!__atomic_compare_exchange_n(&rs->state, &state, RING_CLAIMED, 0,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                continue;
+            }
+            __atomic_store_n(&rs->owner, self, __ATOMIC_RELEASE);
+        }
+
+        // Les restes de l'occupant précédent sont lus sous son adresse ;
+        // puis nouvelle génération : les envois du serveur à cet occupant
+        // sont refusés, ceux déjà déposés sont écartés
+        ring_drain_to_server(rs);
+        __atomic_fetch_add(&rs->generation, 1, __ATOMIC_ACQ_REL);
+        __atomic_store_n(&rs->to_client.head, __atomic_load_n(&rs->to_client.tail, __ATOMIC_ACQUIRE),
+                         __ATOMIC_RELEASE);
+        __atomic_store_n(&rs->to_client.sleeping, 0, __ATOMIC_RELAXED);
+
+        g_ring_slot = slot;
+        memset(addr, 0, sizeof(*addr));
+        addr->sin_family = AF_RING;
+        addr->sin_port = htons((uint16_t)slot);
+        return 0;
+    }
+
+    fprintf(stderr, "Aucun emplacement local libre (%d)\n", g_ring->slot_count);
+    return -1;
+}
+
+// Rend l'emplacement une fois les derniers envois lus par le serveur. Le
+// segment reste attaché jusqu'à la sortie : le thread de réception peut
+// encore lire l'anneau.
+void ring_release(void) {
+    if (g_ring == NULL || g_ring_server) {
+        return;
+    }
+    if (g_ring_slot < 0) {
+        shmdt(g_ring);
+        g_ring = NULL;
+        return;
+    }
+    RingSlot *rs = &g_ring->slots[g_ring_slot];
+    if (__atomic_load_n(&rs->owner, __ATOMIC_ACQUIRE) == getpid()) {
+        ring_drain_to_server(rs);
+        __atomic_store_n(&rs->owner, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&rs->state, RING_FREE, __ATOMIC_RELEASE);
+    }
+}
+
+// ========== Envoi et réception ==========
+
+// Dépose un datagramme encodé dans l'anneau de addr : vers le client pour
+// le serveur, vers le serveur pour un client. Retourne -1 si addr ne
+// désigne plus un client (ENOTCONN) ou, côté serveur, si l'anneau du client
+// est plein (EAGAIN, à réessayer). Un client perd le datagramme si
+// l'anneau vers le serveur reste plein, et retourne 0.
+int ring_send(const struct sockaddr_in *addr, const unsigned char *buf, size_t len) {
+    int slot = ntohs(addr->sin_port);
+
+    if (g_ring == NULL || slot >= g_ring->slot_count || len > WIRE_MAX_SIZE) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    RingSlot *rs = &g_ring->slots[slot];
+
+    if (g_ring_server) {
+        // Client parti ou emplacement repris par un autre
+        if (__atomic_load_n(&rs->state, __ATOMIC_ACQUIRE) != RING_CLAIMED ||
+            __atomic_load_n(&rs->generation, __ATOMIC_ACQUIRE) != addr->sin_addr.s_addr) {
+            errno = ENOTCONN;
+            return -1;
+        }
+        pthread_mutex_lock(&g_ring_send_locks[slot]);
+        int pushed = ring_push(&rs->to_client, buf, len);
+        pthread_mutex_unlock(&g_ring_send_locks[slot]);
+        if (pushed == -1) {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (__atomic_load_n(&rs->to_client.sleeping, __ATOMIC_SEQ_CST)) {
+            futex(&rs->to_client.tail, FUTEX_WAKE, 1, NULL);
+        }
+    } else {
+        // Un client peut attendre (100 ms au plus) que le serveur lui fasse
+        // de la place ; un worker ne bloque jamais pour un client lent
+        pthread_mutex_lock(&g_ring_client_lock);
+        int pushed = ring_push(&rs->to_server, buf, len);
+        for (int i = 0; pushed == -1 && i < 100; i++) {
+            usleep(1000);
+            pushed = ring_push(&rs->to_server, buf, len);
+        }
+        pthread_mutex_unlock(&g_ring_client_lock);
+        if (pushed == -1) {
+            __atomic_fetch_add(&rs->to_server.drops, 1, __ATOMIC_RELAXED);
+        } else if (__atomic_load_n(&g_ring->server_sleeping, __ATOMIC_SEQ_CST)) {
+            __atomic_fetch_add(&g_ring->doorbell, 1, __ATOMIC_RELEASE);
+            futex(&g_ring->doorbell, FUTEX_WAKE, 1, NULL);
+        }
+    }
+    return 0;
+}
+
+// Client : attend un datagramme du serveur (RING_SPIN tours, puis futex
+// jusqu'à timeout_ms) et le décode dans msgs ; retourne le nombre de
+// messages, 0 si rien n'est arrivé
+int ring_receive(Message *msgs, int max_count, int timeout_ms) {
+    Ring *ring = &g_ring->slots[g_ring_slot].to_client;
+    unsigned char buf[WIRE_MAX_SIZE];
+    int slept = 0;
+
+    for (int spin = 0; ; spin++) {
+        ssize_t len = ring_pop(ring, buf);
+        if (len >= 0) {
+            int n = message_decode_all(msgs, max_count, buf, (size_t)len);
+            if (n < 0) {
+                fprintf(stderr, "Datagramme invalide ignoré (%zd octets)\n", len);
+                continue;
+            }
+            return n;
+        }
+        if (slept) {
+            return 0;
+        }
+        if (spin < RING_SPIN) {
+            continue;
+        }
+
+        // S'annoncer endormi puis revérifier : un dépôt postérieur voit
+        // sleeping et réveille, un dépôt antérieur est vu ici
+        __atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+        if (tail == ring->head) {
+            struct timespec ts = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L };
+            futex(&ring->tail, FUTEX_WAIT, tail, &ts);
+        }
+        __atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+        slept = 1;
+    }
+}
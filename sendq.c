@@ -0,0 +1,378 @@
+#include "messaging.h"
+
+// ========== Files d'envoi par destinataire ==========
+
+// Quand le tampon d'émission d'un socket est plein, sendmmsg échoue avec
+// EAGAIN : au lieu de perdre le message, outbox_flush le range dans la file
+// de son destinataire, et tous les messages suivants pour ce destinataire
+// la rejoignent pour garder l'ordre. Le worker surveille alors EPOLLOUT et
+// vide les files à tour de rôle (un message par file et par tour) dès que
+// le socket redevient disponible : un destinataire très sollicité n'empêche
+// pas les autres d'être servis. Une file est bornée ; une fois pleine, la
+// politique choisie (option -p du serveur) décide du sort des messages.
+// Une file vidée est libérée (ses pertes restent comptées dans le total du
+// worker) : seuls les destinataires en retard occupent de la mémoire.
+
+static int g_sendq_capacity = SENDQ_SIZE;
+static SendQueuePolicy g_sendq_policy = SENDQ_DROP_OLDEST;
+
+static const char *policy_name(SendQueuePolicy policy) {
+    switch (policy) {
+        case SENDQ_DROP_OLDEST: return "oldest";
+        case SENDQ_DROP_NEWEST: return "newest";
+        case SENDQ_DISCONNECT:  return "disconnect";
+    }
+    return "?";
+}
+
+// policy : "oldest", "newest" ou "disconnect" (NULL : inchangée)
+int sendq_configure(int capacity, const char *policy) {
+    if (capacity < 1 || capacity > SENDQ_LIMIT) {
+        fprintf(stderr, "Taille de file invalide (entre 1 et %d)\n", SENDQ_LIMIT);
+        return -1;
+    }
+    g_sendq_capacity = capacity;
+
+    if (policy != NULL) {
+        SendQueuePolicy p;
+        for (p = SENDQ_DROP_OLDEST; p <= SENDQ_DISCONNECT; p++) {
+            if (strcmp(policy, policy_name(p)) == 0) {
+                break;
+            }
+        }
+        if (p > SENDQ_DISCONNECT) {
+            fprintf(stderr, "Politique de file inconnue : %s (oldest, newest ou disconnect)\n", policy);
+            return -1;
+        }
+        g_sendq_policy = p;
+    }
+    return 0;
+}
+
+void sendq_init(SendQueues *queues) {
+    memset(queues, 0, sizeof(*queues));
+    pthread_mutex_init(&queues->lock, NULL);
+}
+
+void sendq_free(SendQueues *queues) {
+    for (int b = 0; b < SENDQ_BUCKETS; b++) {
+        SendQueue *queue = queues->buckets[b];
+        while (queue != NULL) {
+            SendQueue *next = queue->next;
+            free(queue->items);
+            free(queue);
+            queue = next;
+        }
+    }
+    pthread_mutex_destroy(&queues->lock);
+    memset(queues, 0, sizeof(*queues));
+}
+
+static unsigned int sendq_bucket(const struct sockaddr_in *addr) {
+    return (addr->sin_addr.s_addr * 2654435761u ^ addr->sin_port) % SENDQ_BUCKETS;
+}
+
+// Décroche queue de la table et la libère ; elle ne doit plus figurer dans
+// la liste des files non vides
+static void sendq_release(SendQueues *queues, SendQueue *queue) {
+    SendQueue **link = &queues->buckets[sendq_bucket(&queue->addr)];
+    while (*link != queue) {
+        link = &(*link)->next;
+    }
+    *link = queue->next;
+
+    if (queue->disconnect) {
+        queues->disconnect_count--;
+    }
+    queues->drops += queue->drops;
+    free(queue->items);
+    free(queue);
+}
+
+static SendQueue *sendq_find(SendQueues *queues, const struct sockaddr_in *addr) {
+    SendQueue *queue = queues->buckets[sendq_bucket(addr)];
+    while (queue != NULL &&
+           (queue->addr.sin_family != addr->sin_family ||
+            queue->addr.sin_addr.s_addr != addr->sin_addr.s_addr ||
+            queue->addr.sin_port != addr->sin_port)) {
+        queue = queue->next;
+    }
+    return queue;
+}
+
+// Vrai si des messages attendent déjà pour addr : les suivants doivent
+// passer par la file pour rester dans l'ordre
+int sendq_blocked(SendQueues *queues, const struct sockaddr_in *addr) {
+    pthread_mutex_lock(&queues->lock);
+    SendQueue *queue = sendq_find(queues, addr);
+    int blocked = (queue != NULL && queue->depth > 0);
+    pthread_mutex_unlock(&queues->lock);
+    return blocked;
+}
+
+// Met msg en attente pour le destinataire (username, addr) en appliquant la
+// politique si sa file est pleine
+void sendq_push(SendQueues *queues, const char *username,
+                const struct sockaddr_in *addr, const Message *msg) {
+    pthread_mutex_lock(&queues->lock);
+
+    SendQueue *queue = sendq_find(queues, addr);
+    if (queue == NULL) {
+        queue = calloc(1, sizeof(SendQueue));
+        if (queue == NULL) {
+            perror("Erreur calloc");
+            pthread_mutex_unlock(&queues->lock);
+            return;
+        }
+        unsigned int bucket = sendq_bucket(addr);
+        queue->addr = *addr;
+        queue->next = queues->buckets[bucket];
+        queues->buckets[bucket] = queue;
+    }
+    strncpy(queue->username, username, MAX_USERNAME - 1);
+    queue->username[MAX_USERNAME - 1] = '\0';
+
+    if (queue->items == NULL) {
+        queue->items = malloc((size_t)g_sendq_capacity * sizeof(Message));
+        if (queue->items == NULL) {
+            perror("Erreur malloc");
+            queue->drops++;
+            pthread_mutex_unlock(&queues->lock);
+            return;
+        }
+    }
+
+    if (queue->depth == g_sendq_capacity) {
+        switch (g_sendq_policy) {
+            case SENDQ_DROP_OLDEST:
+                queue->head = (queue->head + 1) % g_sendq_capacity;
+                queue->depth--;
+                queue->drops++;
+                break;
+            case SENDQ_DROP_NEWEST:
+                queue->drops++;
+                pthread_mutex_unlock(&queues->lock);
+                return;
+            case SENDQ_DISCONNECT:
+                queue->drops += (uint64_t)queue->depth + 1;
+                queue->head = 0;
+                queue->depth = 0;
+                if (!queue->disconnect) {
+                    queue->disconnect = 1;
+                    queues->disconnect_count++;
+                }
+                pthread_mutex_unlock(&queues->lock);
+                return;
+        }
+    }
+
+    queue->items[(queue->head + queue->depth) % g_sendq_capacity] = *msg;
+    queue->depth++;
+    if (queue->depth > queue->max_depth) {
+        queue->max_depth = queue->depth;
+    }
+
+    if (!queue->active) {
+        queue->active = 1;
+        queue->active_next = NULL;
+        if (queues->active_tail != NULL) {
+            queues->active_tail->active_next = queue;
+        } else {
+            queues->active = queue;
+        }
+        queues->active_tail = queue;
+    }
+    pthread_mutex_unlock(&queues->lock);
+}
+
+// Retire de la liste des files non vides celles qui ont été vidées, et les
+// libère sauf si une déconnexion reste à demander pour leur destinataire
+static void sendq_prune(SendQueues *queues) {
+    SendQueue **link = &queues->active;
+    queues->active_tail = NULL;
+
+    while (*link != NULL) {
+        SendQueue *queue = *link;
+        if (queue->depth == 0) {
+            queue->active = 0;
+            *link = queue->active_next;
+            if (queue->disconnect) {
+                free(queue->items);
+                queue->items = NULL;
+            } else {
+                sendq_release(queues, queue);
+            }
+        } else {
+            queues->active_tail = queue;
+            link = &queue->active_next;
+        }
+    }
+}
+
+static int send_would_block(int err) {
+    return err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS;
+}
+
+// Envoie autant de messages en attente que le socket en accepte ; retourne
+// 1 s'il en reste (continuer à surveiller EPOLLOUT), 0 sinon
+int sendq_drain(SendQueues *queues, int sockfd) {
+    Message *msgs[SEND_BATCH_SIZE];
+    struct sockaddr_in addrs[SEND_BATCH_SIZE];
+    SendQueue *owners[SEND_BATCH_SIZE];
+    int status[SEND_BATCH_SIZE];
+    int blocked = 0;
+
+    pthread_mutex_lock(&queues->lock);
+    while (queues->active != NULL && !blocked) {
+        // Un lot fait de tours successifs : le i-ème message en attente de
+        // chaque file au tour i. Les messages retenus pour une même file
+        // sont ensuite placés côte à côte pour partir dans un même
+        // datagramme (voir socket_send_multi).
+        SendQueue *taken_from[SEND_BATCH_SIZE];
+        int taken[SEND_BATCH_SIZE];
+        int queue_count = 0;
+        int total = 0;
+        for (int round = 0; total < SEND_BATCH_SIZE; round++) {
+            int added = 0;
+            int q = 0;
+            for (SendQueue *queue = queues->active; queue != NULL && total < SEND_BATCH_SIZE;
+                 queue = queue->active_next, q++) {
+                if (q == queue_count) {
+                    taken_from[queue_count] = queue;
+                    taken[queue_count++] = 0;
+                }
+                if (round < queue->depth) {
+                    taken[q]++;
+                    total++;
+                    added = 1;
+                }
+            }
+            if (!added) {
+                break;
+            }
+        }
+
+        int n = 0;
+        for (int q = 0; q < queue_count; q++) {
+            SendQueue *queue = taken_from[q];
+            for (int i = 0; i < taken[q]; i++) {
+                msgs[n] = &queue->items[(queue->head + i) % g_sendq_capacity];
+                addrs[n] = queue->addr;
+                owners[n] = queue;
+                n++;
+            }
+        }
+
+        socket_send_multi(sockfd, msgs, addrs, n, status);
+
+        // Les messages d'une même file sont dans l'ordre du lot : retirer
+        // ceux qui sont partis (ou définitivement refusés). Après un EAGAIN,
+        // tous les suivants échouent sur le socket UDP, mais seuls ceux du
+        // même destinataire sur le socket local ou son anneau (voir
+        // datagrams_send et socket_send_multi)
+        for (int i = 0; i < n; i++) {
+            if (send_would_block(status[i])) {
+                blocked = 1;
+                continue;
+            }
+            if (status[i] != 0) {
+                fprintf(stderr, "Échec d'envoi à %s: %s\n", owners[i]->username, strerror(status[i]));
+            }
+            owners[i]->head = (owners[i]->head + 1) % g_sendq_capacity;
+            owners[i]->depth--;
+        }
+        sendq_prune(queues);
+    }
+    int pending = (queues->active != NULL);
+    pthread_mutex_unlock(&queues->lock);
+    return pending;
+}
+
+// Retourne SENDQ_PENDING_NET si des messages attendent le socket UDP (à
+// surveiller avec EPOLLOUT), SENDQ_PENDING_LOCAL s'ils attendent un client
+// local : EPOLLOUT ne dit rien de son anneau, ni de sa file sur le socket
+// local qui n'est pas connecté, il faut réessayer après un court délai
+int sendq_pending(SendQueues *queues) {
+    int pending = 0;
+
+    pthread_mutex_lock(&queues->lock);
+    for (SendQueue *queue = queues->active; queue != NULL; queue = queue->active_next) {
+        pending |= (addr_is_unix(&queue->addr) || addr_is_ring(&queue->addr)) ?
+                   SENDQ_PENDING_LOCAL : SENDQ_PENDING_NET;
+    }
+    pthread_mutex_unlock(&queues->lock);
+    return pending;
+}
+
+// Remplit msgs d'une demande de déconnexion (MSG_DISCONNECT) par
+// utilisateur dont la file a débordé avec la politique SENDQ_DISCONNECT ;
+// retourne leur nombre
+int sendq_take_disconnects(SendQueues *queues, Message *msgs,
+                           struct sockaddr_in *addrs, int max_count) {
+    int count = 0;
+
+    pthread_mutex_lock(&queues->lock);
+    for (int b = 0; b < SENDQ_BUCKETS && queues->disconnect_count > 0 && count < max_count; b++) {
+        SendQueue *next;
+        for (SendQueue *queue = queues->buckets[b]; queue != NULL && count < max_count;
+             queue = next) {
+            next = queue->next;
+            if (queue->disconnect) {
+                queue->disconnect = 0;
+                queues->disconnect_count--;
+                message_create(&msgs[count], MSG_DISCONNECT, queue->username, NULL, NULL, "");
+                addrs[count] = queue->addr;
+                count++;
+                if (!queue->active) {
+                    sendq_release(queues, queue);
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&queues->lock);
+    return count;
+}
+
+// Abandonne la file du destinataire addr (utilisateur déconnecté) : ses
+// messages en attente sont comptés comme perdus
+void sendq_forget(SendQueues *queues, const struct sockaddr_in *addr) {
+    pthread_mutex_lock(&queues->lock);
+    SendQueue *queue = sendq_find(queues, addr);
+    if (queue != NULL) {
+        if (queue->active) {
+            SendQueue **link = &queues->active;
+            SendQueue *prev = NULL;
+            while (*link != queue) {
+                prev = *link;
+                link = &(*link)->active_next;
+            }
+            *link = queue->active_next;
+            if (queues->active_tail == queue) {
+                queues->active_tail = prev;
+            }
+        }
+        queue->drops += (uint64_t)queue->depth;
+        sendq_release(queues, queue);
+    }
+    pthread_mutex_unlock(&queues->lock);
+}
+
+// Affiche l'état des files en cours, puis les pertes cumulées des files
+// déjà libérées
+void sendq_dump(SendQueues *queues, int worker_id, FILE *out) {
+    pthread_mutex_lock(&queues->lock);
+    for (int b = 0; b < SENDQ_BUCKETS; b++) {
+        for (SendQueue *queue = queues->buckets[b]; queue != NULL; queue = queue->next) {
+            char addr_str[ADDR_STR_LEN];
+            fprintf(out, "  worker %d  %-16s %s  en attente %d/%d (max %d)  perdus %llu\n",
+                    worker_id, queue->username, addr_format(&queue->addr, addr_str, sizeof(addr_str)),
+                    queue->depth, g_sendq_capacity, queue->max_depth,
+                    (unsigned long long)queue->drops);
+        }
+    }
+    if (queues->drops > 0) {
+        fprintf(out, "  worker %d  files libérées : perdus %llu\n",
+                worker_id, (unsigned long long)queues->drops);
+    }
+    pthread_mutex_unlock(&queues->lock);
+}
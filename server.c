@@ -1,25 +1,100 @@
 #include "messaging.h"
 #include <signal.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+
+// Un worker : son propre socket lié au port du serveur (SO_REUSEPORT), sa
+// boucle epoll et son outbox. Le noyau répartit les datagrammes entre les
+// sockets selon l'adresse source : un client est toujours servi par le
+// même worker, et les workers se synchronisent par le verrou du segment.
+typedef struct {
+    int id;
+    pthread_t thread;
+    int started;
+    int sockfd;
+    int epollfd;
+    int watching_output;          // EPOLLOUT surveillé (files d'envoi non vides)
+    Outbox outbox;
+    SendQueues queues;
+    Message msgs[RECV_BATCH_SIZE];
+    struct sockaddr_in client_addrs[RECV_BATCH_SIZE];
+} Worker;
 
 // Variables globales pour le nettoyage
 static int g_shmid = -1;
-static int g_semid = -1;
 static SharedMemory *g_shm = NULL;
-static int g_sockfd = -1;
-static FILE *g_logfile = NULL;
+static int g_sigfd = -1;
+static int g_stopfd = -1;  // eventfd : réveille les workers pour l'arrêt
+static int g_ringfd = -1;  // eventfd : réveille le worker 0 (clients locaux, voir ring.c)
+static int g_unixfd = -1;  // Socket local AF_UNIX (option -x), lu par le worker 0
+static const char *g_unix_path = NULL;
+static Worker *g_workers = NULL;
+static int g_worker_count = 0;
 
 void cleanup_and_exit(int signum) {
     printf("\n\nArrêt du serveur...\n");
 
-    if (g_logfile != NULL) {
-        log_event(g_logfile, "SERVER", "Arrêt du serveur");
-        fclose(g_logfile);
-        g_logfile = NULL;
+    // Laisser aux clients le temps d'acquitter les derniers envois fiables :
+    // les workers doivent encore recevoir leurs ACK
+    reliable_stop(RELIABLE_DRAIN_MS);
+
+    // Arrêter les workers : chacun termine son lot en cours (verrou
+    // relâché, outbox vidée) avant de sortir de sa boucle
+    if (g_stopfd >= 0) {
+        uint64_t one = 1;
+        if (write(g_stopfd, &one, sizeof(one)) != sizeof(one)) {
+            perror("Erreur write eventfd");
+        }
+    }
+
+    for (int i = 0; i < g_worker_count; i++) {
+        Worker *worker = &g_workers[i];
+        if (worker->started) {
+            pthread_join(worker->thread, NULL);
+        }
+        if (worker->sockfd >= 0) {
+            close(worker->sockfd);
+        }
+        if (worker->epollfd >= 0) {
+            close(worker->epollfd);
+        }
+        outbox_free(&worker->outbox);
+        sendq_free(&worker->queues);
+    }
+    free(g_workers);
+    g_workers = NULL;
+    g_worker_count = 0;
+
+    ring_stop();
+    if (g_ringfd >= 0) {
+        close(g_ringfd);
     }
+    if (g_unixfd >= 0) {
+        close(g_unixfd);
+        unlink(g_unix_path);
+    }
+
+    // Plus aucun worker n'ajoute de message : synchroniser les segments
+    // et le journal des modifications
+    store_close();
+    wal_stop();
 
-    if (g_sockfd >= 0) {
-        close(g_sockfd);
+    // Plus aucun worker ne journalise : vider la file du journal
+    log_post(EVT_SERVER, -1, -1, -1, "Arrêt du serveur");
+    logger_stop();
+    if (logger_dropped() > 0) {
+        printf("Journal : %llu entrée(s) perdue(s)\n", (unsigned long long)logger_dropped());
+    }
+
+    if (g_stopfd >= 0) {
+        close(g_stopfd);
+    }
+
+    if (g_sigfd >= 0) {
+        close(g_sigfd);
     }
 
     if (g_shm != NULL) {
@@ -32,35 +107,245 @@ void cleanup_and_exit(int signum) {
     //     shm_destroy(g_shmid);
     // }
 
-    // Ne pas détruire le sémaphore non plus
-    // if (g_semid >= 0) {
-    //     sem_destroy(g_semid);
-    // }
-
+    (void)signum;
     printf("Nettoyage terminé (mémoire partagée conservée)\n");
     exit(0);
 }
 
-void handle_client_message(int sockfd, SharedMemory *shm, int semid,
+// ========== Listes découpées en morceaux ==========
+
+// Une réponse à MSG_LIST_USERS ou MSG_LIST_GROUPS est une suite d'au plus
+// LIST_PAGE_CHUNKS messages dont le contenu est
+//     "<numéro> <début> <suite>|entrée|entrée|..."
+// numéro : rang du morceau dans la page (à partir de 0) ; début : premier
+// emplacement parcouru par ce morceau ; suite : emplacement où reprendre
+// (contenu de la requête suivante), ou "fin". Les emplacements ne sont
+// jamais déplacés, un curseur reste donc valable entre deux requêtes.
+
+#define LIST_CHUNK_HEADER 24  // "15 1000000 1000000|" au plus (CAPACITY_LIMIT)
+
+typedef int (*ListEntryFn)(SharedMemory *shm, int slot, char *out, size_t size);
+
+// "nom:groupe|" ; 0 pour un emplacement libre
+static int list_user_entry(SharedMemory *shm, int slot, char *out, size_t size) {
+    User *user = shm_user(shm, slot);
+    if (!user->active) {
+        return 0;
+    }
+    return snprintf(out, size, "%.*s:%.*s|",
+                    MAX_USERNAME - 1, user->username,
+                    MAX_GROUP_NAME - 1,
+                    user->current_group[0] ? user->current_group : "aucun");
+}
+
+// "nom:membres:admins|" ; 0 pour un groupe libre ou vide
+static int list_group_entry(SharedMemory *shm, int slot, char *out, size_t size) {
+    Group *group = shm_group(shm, slot);
+    if (!group->active || group->user_count <= 0) {
+        return 0;
+    }
+    return snprintf(out, size, "%.*s:%d:%d|",
+                    MAX_GROUP_NAME - 1, group->name,
+                    group->user_count,
+                    group->admin_count);
+}
+
+// Morceau de liste sans son en-tête
+typedef struct {
+    int start;                // Premier emplacement parcouru
+    int next;                 // Emplacement où reprendre, -1 pour le dernier
+    int entries;
+    size_t len;
+    char body[MAX_MESSAGE - LIST_CHUNK_HEADER];
+} ListChunk;
+
+// Liste complète déjà découpée, valable tant que la génération de son
+// annuaire (SharedMemory.user_generation ou group_generation) n'a pas
+// changé : entre deux modifications, une requête ne coûte qu'une copie des
+// morceaux, sans parcourir les emplacements.
+typedef struct {
+    pthread_mutex_t lock;
+    int valid;
+    uint32_t generation;
+    ListChunk *chunks;
+    int count;
+    int capacity;
+} ListCache;
+
+static ListCache g_list_caches[2] = {   // Utilisateurs, groupes
+    { .lock = PTHREAD_MUTEX_INITIALIZER },
+    { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+
+// Remplit chunk avec les entrées à partir de l'emplacement slot ; retourne
+// l'emplacement suivant le dernier parcouru. À appeler entre
+// shm_read_begin et shm_read_retry.
+static int list_build_chunk(SharedMemory *shm, int slot_count, int slot, ListEntryFn entry_fn,
+                            ListChunk *chunk) {
+    chunk->start = slot;
+    chunk->entries = 0;
+    chunk->len = 0;
+
+    while (slot < slot_count) {
+        char entry[MAX_USERNAME + MAX_GROUP_NAME + 32];
+        int entry_len = entry_fn(shm, slot, entry, sizeof(entry));
+        if (entry_len > 0 && chunk->len + (size_t)entry_len >= sizeof(chunk->body)) {
+            break;  // Morceau plein : cet emplacement ouvre le suivant
+        }
+        if (entry_len > 0) {
+            memcpy(chunk->body + chunk->len, entry, (size_t)entry_len);
+            chunk->len += (size_t)entry_len;
+            chunk->entries++;
+        }
+        slot++;
+    }
+    chunk->body[chunk->len] = '\0';
+    chunk->next = (slot < slot_count) ? slot : -1;
+    return slot;
+}
+
+// Écrit dans out (MAX_MESSAGE octets) le contenu du message d'un morceau
+static void list_format_chunk(const ListChunk *chunk, int number, char *out) {
+    char header[LIST_CHUNK_HEADER + 1];
+    int header_len;
+    if (chunk->next >= 0) {
+        header_len = snprintf(header, sizeof(header), "%d %d %d|", number, chunk->start, chunk->next);
+    } else {
+        header_len = snprintf(header, sizeof(header), "%d %d fin|", number, chunk->start);
+    }
+    memcpy(out, header, (size_t)header_len);
+    memcpy(out + header_len, chunk->body, chunk->len + 1);
+}
+
+static int list_slot_count(SharedMemory *shm, int users) {
+    int slot_count = users ? shm->user_count : shm->group_count;
+    int max_slots = users ? shm->max_users : shm->max_groups;
+    return slot_count < max_slots ? slot_count : max_slots;
+}
+
+// Remplit chunks avec les entrées des emplacements cursor..slot_count - 1,
+// en un seul parcours ; retourne le nombre de morceaux et compte les
+// entrées dans *entries. À appeler entre shm_read_begin et shm_read_retry.
+static int list_build_page(SharedMemory *shm, int users, int cursor,
+                           char chunks[][MAX_MESSAGE], int *entries) {
+    int slot_count = list_slot_count(shm, users);
+    int slot = cursor;
+    int count = 0;
+
+    *entries = 0;
+    do {
+        ListChunk chunk;
+        slot = list_build_chunk(shm, slot_count, slot,
+                                users ? list_user_entry : list_group_entry, &chunk);
+        list_format_chunk(&chunk, count, chunks[count]);
+        *entries += chunk.entries;
+        count++;
+    } while (count < LIST_PAGE_CHUNKS && slot < slot_count);
+    return count;
+}
+
+// Redécoupe toute la liste dans le cache ; retourne -1 si la mémoire manque
+static int list_cache_rebuild(ListCache *cache, SharedMemory *shm, int users) {
+    uint32_t seq;
+    int failed;
+
+    do {
+        seq = shm_read_begin(shm);
+        cache->generation = users ? shm->user_generation : shm->group_generation;
+        int slot_count = list_slot_count(shm, users);
+        int slot = 0;
+        cache->count = 0;
+        failed = 0;
+        do {
+            if (cache->count == cache->capacity) {
+                int capacity = cache->capacity ? 2 * cache->capacity : 16;
+                ListChunk *chunks = realloc(cache->chunks, (size_t)capacity * sizeof(ListChunk));
+                if (chunks == NULL) {
+                    perror("Erreur realloc");
+                    failed = 1;
+                    break;
+                }
+                cache->chunks = chunks;
+                cache->capacity = capacity;
+            }
+            slot = list_build_chunk(shm, slot_count, slot,
+                                    users ? list_user_entry : list_group_entry,
+                                    &cache->chunks[cache->count++]);
+        } while (slot < slot_count);
+    } while (shm_read_retry(shm, seq));
+
+    cache->valid = !failed;
+    return failed ? -1 : 0;
+}
+
+// Copie depuis le cache la page qui commence à l'emplacement cursor, en le
+// redécoupant d'abord si l'annuaire a changé depuis (generation lue par
+// l'appelant). Retourne le nombre de morceaux, ou 0 si aucun morceau du
+// cache ne commence à cursor (curseur d'une version précédente de la liste).
+static int list_page_cached(SharedMemory *shm, int users, uint32_t generation, int cursor,
+                            char chunks[][MAX_MESSAGE], int *entries) {
+    ListCache *cache = &g_list_caches[users ? 0 : 1];
+    int count = 0;
+
+    pthread_mutex_lock(&cache->lock);
+    if ((cache->valid && cache->generation == generation) ||
+        list_cache_rebuild(cache, shm, users) == 0) {
+        // Les débuts des morceaux sont croissants
+        int low = 0, high = cache->count - 1;
+        while (low <= high) {
+            int mid = (low + high) / 2;
+            if (cache->chunks[mid].start < cursor) {
+                low = mid + 1;
+            } else {
+                high = mid - 1;
+            }
+        }
+
+        *entries = 0;
+        if (low < cache->count && cache->chunks[low].start == cursor) {
+            for (int i = low; i < cache->count && count < LIST_PAGE_CHUNKS; i++) {
+                list_format_chunk(&cache->chunks[i], count, chunks[count]);
+                *entries += cache->chunks[i].entries;
+                count++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return count;
+}
+
+// Abandonne les messages en attente pour un destinataire qui se
+// déconnecte : ses files dans tous les workers et son état de fiabilité
+// n'ont plus lieu d'être
+static void workers_forget_peer(const struct sockaddr_in *addr) {
+    for (int i = 0; i < g_worker_count; i++) {
+        sendq_forget(&g_workers[i].queues, addr);
+    }
+    reliable_forget(addr);
+}
+
+// Traite un message qui modifie la mémoire partagée ; l'appelant doit être
+// dans une section d'écriture (shm_write_begin)
+void handle_client_message(Outbox *ob, SharedMemory *shm,
                           Message *msg, struct sockaddr_in *client_addr) {
     // Log de débogage
-    char ip_str[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(client_addr->sin_addr), ip_str, INET_ADDRSTRLEN);
-    printf("[DEBUG HANDLER] Message Type: %d, De: %s (%s:%d)\n",
-           msg->type, msg->sender, ip_str, ntohs(client_addr->sin_port));
-
-    char log_buffer[512];
+    char addr_str[ADDR_STR_LEN];
+    outbox_printf(ob, "[DEBUG HANDLER] Message Type: %d, De: %s (%s)\n",
+           msg->type, msg->sender, addr_format(client_addr, addr_str, sizeof(addr_str)));
 
-    // Verrouiller l'accès à la mémoire partagée
-    sem_p(semid);
 
     switch (msg->type) {
         case MSG_JOIN: {
             // Ajouter l'utilisateur s'il n'existe pas
             User *user = user_find(shm, msg->sender);
+            int user_added = 0;
             if (user == NULL) {
-                user_add(shm, msg->sender, client_addr, ntohs(client_addr->sin_port));
+                if (user_add(shm, msg->sender, client_addr, ntohs(client_addr->sin_port)) >= 0) {
+                    wal_append_user(msg->sender, client_addr);
+                    user_added = 1;
+                }
                 user = user_find(shm, msg->sender);
+                outbox_event(ob, shm, EVT_USER_NAME, msg->sender, NULL, NULL, msg->sender, NULL);
             }
 
             // Vérifier si le groupe existe déjà
@@ -68,7 +353,10 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
             int group_created = 0;
             if (group == NULL) {
                 // Créer le groupe (le créateur devient admin)
-                group_create(shm, msg->group, msg->sender);
+                if (group_create(shm, msg->group, msg->sender) >= 0) {
+                    wal_append(WAL_GROUP_CREATE, msg->group, msg->sender);
+                }
+                outbox_event(ob, shm, EVT_GROUP_NAME, NULL, NULL, msg->group, msg->group, NULL);
                 group = group_find(shm, msg->group);
                 group_created = 1;
             }
@@ -77,8 +365,10 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
             int join_result = group_add_user(shm, msg->group, msg->sender);
 
             if (join_result == 0) {
+                wal_append(WAL_GROUP_ADD_USER, msg->group, msg->sender);
+
                 // Succès : diffuser le message de join au groupe (sauf à l'envoyeur)
-                message_send_to_group(sockfd, shm, msg);
+                message_send_to_group(ob, shm, msg);
 
                 // Envoyer une confirmation au client qui s'est connecté
                 if (user != NULL && group != NULL) {
@@ -102,19 +392,27 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                         snprintf(confirm_content, MAX_MESSAGE, "JOINED:%s", color_name);
                     }
                     message_create(&confirm, MSG_JOIN, msg->sender, NULL, msg->group, confirm_content);
-                    socket_send(sockfd, &confirm, &user->addr);
+                    outbox_send(ob, &confirm, user->username, &user->addr);
+
+                    // Puis les derniers messages du groupe, envoyés avec le même lot
+                    int replayed = group_history_replay(ob, shm, group, user->username, &user->addr);
+                    if (replayed > 0) {
+                        outbox_printf(ob, ">>> %d message(s) d'historique envoyé(s) à %s\n",
+                                      replayed, msg->sender);
+                    }
                 }
 
                 if (group_created) {
-                    printf(">>> %s a créé et rejoint %s (admin)\n", msg->sender, msg->group);
-                    snprintf(log_buffer, sizeof(log_buffer), "%s a créé et rejoint le groupe %s (%s:%d)",
-                            msg->sender, msg->group, ip_str, ntohs(client_addr->sin_port));
+                    outbox_printf(ob, ">>> %s a créé et rejoint %s (admin)\n", msg->sender, msg->group);
+                    outbox_event(ob, shm, EVT_JOIN, msg->sender, NULL, msg->group, NULL,
+                                 "%s a créé et rejoint le groupe %s (%s)",
+                                 msg->sender, msg->group, addr_str);
                 } else {
-                    printf(">>> %s a rejoint %s\n", msg->sender, msg->group);
-                    snprintf(log_buffer, sizeof(log_buffer), "%s a rejoint le groupe %s (%s:%d)",
-                            msg->sender, msg->group, ip_str, ntohs(client_addr->sin_port));
+                    outbox_printf(ob, ">>> %s a rejoint %s\n", msg->sender, msg->group);
+                    outbox_event(ob, shm, EVT_JOIN, msg->sender, NULL, msg->group, NULL,
+                                 "%s a rejoint le groupe %s (%s)",
+                                 msg->sender, msg->group, addr_str);
                 }
-                log_event(g_logfile, "JOIN", log_buffer);
             } else {
                 // Échec : envoyer un message d'erreur au client
                 if (user != NULL) {
@@ -122,75 +420,52 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                     char error_content[MAX_MESSAGE];
                     snprintf(error_content, MAX_MESSAGE, "Échec de connexion au groupe %s", msg->group);
                     message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
-                    socket_send(sockfd, &error_msg, &user->addr);
+                    outbox_send(ob, &error_msg, user->username, &user->addr);
                 }
 
-                printf(">>> Échec : %s n'a pas pu rejoindre %s\n", msg->sender, msg->group);
-                snprintf(log_buffer, sizeof(log_buffer), "Échec : %s n'a pas pu rejoindre %s (%s:%d)",
-                        msg->sender, msg->group, ip_str, ntohs(client_addr->sin_port));
-                log_event(g_logfile, "JOIN_FAIL", log_buffer);
+                outbox_printf(ob, ">>> Échec : %s n'a pas pu rejoindre %s\n", msg->sender, msg->group);
+                outbox_event(ob, shm, EVT_JOIN_FAIL, msg->sender, NULL, NULL, msg->group,
+                             "Échec : %s n'a pas pu rejoindre %s (%s)",
+                             msg->sender, msg->group, addr_str);
+            }
+
+            // Pousser les changements aux abonnés de l'annuaire
+            if (user_added || join_result == 0) {
+                directory_publish_user(ob, shm, msg->sender);
+            }
+            if (join_result == 0) {
+                directory_publish_group(ob, shm, msg->group);
             }
             break;
         }
         
         case MSG_LEAVE: {
             // Retirer l'utilisateur du groupe
-            group_remove_user(shm, msg->group, msg->sender);
+            if (group_remove_user(shm, msg->group, msg->sender) == 0) {
+                wal_append(WAL_GROUP_REMOVE_USER, msg->group, msg->sender);
+                directory_publish_user(ob, shm, msg->sender);
+                directory_publish_group(ob, shm, msg->group);
+            }
 
             // Diffuser le message de leave au groupe
-            message_send_to_group(sockfd, shm, msg);
+            message_send_to_group(ob, shm, msg);
 
-            printf(">>> %s a quitté %s\n", msg->sender, msg->group);
-            snprintf(log_buffer, sizeof(log_buffer), "%s a quitté le groupe %s",
-                    msg->sender, msg->group);
-            log_event(g_logfile, "LEAVE", log_buffer);
+            outbox_printf(ob, ">>> %s a quitté %s\n", msg->sender, msg->group);
+            outbox_event(ob, shm, EVT_LEAVE, msg->sender, NULL, msg->group, NULL,
+                         "%s a quitté le groupe %s",
+                         msg->sender, msg->group);
             break;
         }
         
-        case MSG_PUBLIC: {
-            // Diffuser le message public au groupe
-            message_send_to_group(sockfd, shm, msg);
-
-            printf(">>> [%s] %s: %s\n", msg->group, msg->sender, msg->content);
-            snprintf(log_buffer, sizeof(log_buffer), "[%s] %s: %s",
-                    msg->group, msg->sender, msg->content);
-            log_event(g_logfile, "PUBLIC", log_buffer);
-            break;
-        }
-        
-        case MSG_PRIVATE: {
-            // Envoyer le message privé
-            if (message_send_private(sockfd, shm, msg) == 0) {
-                printf(">>> [PRIVÉ] %s -> %s: %s\n",
-                       msg->sender, msg->recipient, msg->content);
-                snprintf(log_buffer, sizeof(log_buffer), "%s -> %s: %s",
-                        msg->sender, msg->recipient, msg->content);
-                log_event(g_logfile, "PRIVATE", log_buffer);
-            } else {
-                // L'utilisateur n'existe pas, envoyer une erreur à l'expéditeur
-                User *sender = user_find(shm, msg->sender);
-                if (sender != NULL) {
-                    Message error_msg;
-                    char error_content[MAX_MESSAGE];
-                    snprintf(error_content, MAX_MESSAGE,
-                            "Erreur : l'utilisateur '%s' n'existe pas ou n'est pas connecté", msg->recipient);
-                    message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
-                    socket_send(sockfd, &error_msg, &sender->addr);
-                }
-                printf(">>> [PRIVÉ] Échec: utilisateur %s non trouvé\n", msg->recipient);
-            }
-            break;
-        }
-
         case MSG_CHANGE_COLOR: {
             // Vérifier que l'utilisateur est administrateur du groupe
             Group *group = group_find(shm, msg->group);
             if (group == NULL) {
-                printf(">>> Groupe %s non trouvé\n", msg->group);
+                outbox_printf(ob, ">>> Groupe %s non trouvé\n", msg->group);
                 break;
             }
 
-            if (!group_is_admin(group, msg->sender)) {
+            if (!group_is_admin(shm, group, msg->sender)) {
                 // Envoyer un message d'erreur
                 User *user = user_find(shm, msg->sender);
                 if (user != NULL) {
@@ -199,14 +474,13 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                     snprintf(error_content, MAX_MESSAGE,
                             "Seuls les administrateurs peuvent changer la couleur du groupe");
                     message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
-                    socket_send(sockfd, &error_msg, &user->addr);
+                    outbox_send(ob, &error_msg, user->username, &user->addr);
                 }
-                printf(">>> %s (non-admin) a tenté de changer la couleur de %s\n",
+                outbox_printf(ob, ">>> %s (non-admin) a tenté de changer la couleur de %s\n",
                        msg->sender, msg->group);
-                snprintf(log_buffer, sizeof(log_buffer),
-                        "%s (non-admin) a tenté de changer la couleur de %s",
-                        msg->sender, msg->group);
-                log_event(g_logfile, "CHANGE_COLOR_DENIED", log_buffer);
+                outbox_event(ob, shm, EVT_CHANGE_COLOR_DENIED, msg->sender, NULL, msg->group, msg->content,
+                             "%s (non-admin) a tenté de changer la couleur de %s",
+                             msg->sender, msg->group);
                 break;
             }
 
@@ -224,31 +498,28 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
             // Mettre à jour la couleur du groupe
             strncpy(group->color, color_code, 15);
             group->color[15] = '\0';
+            wal_append(WAL_GROUP_COLOR, msg->group, color_code);
 
-            printf(">>> %s (admin) a changé la couleur du groupe %s en %s\n",
+            outbox_printf(ob, ">>> %s (admin) a changé la couleur du groupe %s en %s\n",
                    msg->sender, msg->group, msg->content);
-            snprintf(log_buffer, sizeof(log_buffer),
-                    "%s (admin) a changé la couleur du groupe %s en %s",
-                    msg->sender, msg->group, msg->content);
-            log_event(g_logfile, "CHANGE_COLOR", log_buffer);
+            outbox_event(ob, shm, EVT_CHANGE_COLOR, msg->sender, NULL, msg->group, msg->content,
+                         "%s (admin) a changé la couleur du groupe %s en %s",
+                         msg->sender, msg->group, msg->content);
 
             // Propager le changement de couleur à TOUS les membres du groupe
-            for (int i = 0; i < group->user_count; i++) {
-                User *user = user_find(shm, group->users[i]);
-                if (user != NULL && user->active) {
-                    socket_send(sockfd, msg, &user->addr);
-                }
-            }
+            message_send_to_members(ob, shm, msg);
             break;
         }
 
         case MSG_CREATE_GROUP: {
             // Créer un nouveau groupe (le créateur devient admin)
             if (group_create(shm, msg->content, msg->sender) >= 0) {
-                printf(">>> Groupe %s créé par %s (admin)\n", msg->content, msg->sender);
-                snprintf(log_buffer, sizeof(log_buffer), "Groupe %s créé par %s (admin)",
-                        msg->content, msg->sender);
-                log_event(g_logfile, "CREATE_GROUP", log_buffer);
+                wal_append(WAL_GROUP_CREATE, msg->content, msg->sender);
+                outbox_event(ob, shm, EVT_GROUP_NAME, NULL, NULL, msg->content, msg->content, NULL);
+                outbox_printf(ob, ">>> Groupe %s créé par %s (admin)\n", msg->content, msg->sender);
+                outbox_event(ob, shm, EVT_CREATE_GROUP, msg->sender, NULL, msg->content, NULL,
+                             "Groupe %s créé par %s (admin)",
+                             msg->content, msg->sender);
 
                 // Envoyer confirmation à l'utilisateur
                 Message response;
@@ -256,7 +527,7 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                              msg->sender, NULL, msg->content);
                 User *user = user_find(shm, msg->sender);
                 if (user != NULL) {
-                    socket_send(sockfd, &response, &user->addr);
+                    outbox_send(ob, &response, user->username, &user->addr);
                 }
             }
             break;
@@ -287,13 +558,13 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                                     "Erreur : le groupe '%s' n'existe pas", group2);
                         }
                         message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
-                        socket_send(sockfd, &error_msg, &user->addr);
+                        outbox_send(ob, &error_msg, user->username, &user->addr);
                     }
-                    printf(">>> Un des groupes à fusionner n'existe pas\n");
+                    outbox_printf(ob, ">>> Un des groupes à fusionner n'existe pas\n");
                     break;
                 }
 
-                if (!group_is_admin(g1, msg->sender)) {
+                if (!group_is_admin(shm, g1, msg->sender)) {
                     // Envoyer un message d'erreur
                     User *user = user_find(shm, msg->sender);
                     if (user != NULL) {
@@ -302,30 +573,42 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                         snprintf(error_content, MAX_MESSAGE,
                                 "Seuls les administrateurs de %s peuvent fusionner ce groupe", group1);
                         message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
-                        socket_send(sockfd, &error_msg, &user->addr);
+                        outbox_send(ob, &error_msg, user->username, &user->addr);
                     }
-                    printf(">>> %s (non-admin) a tenté de fusionner %s et %s\n",
+                    outbox_printf(ob, ">>> %s (non-admin) a tenté de fusionner %s et %s\n",
                            msg->sender, group1, group2);
-                    snprintf(log_buffer, sizeof(log_buffer),
-                            "%s (non-admin) a tenté de fusionner %s et %s",
-                            msg->sender, group1, group2);
-                    log_event(g_logfile, "MERGE_GROUPS_DENIED", log_buffer);
+                    outbox_event(ob, shm, EVT_MERGE_GROUPS_DENIED, msg->sender, NULL, group1, group2,
+                                 "%s (non-admin) a tenté de fusionner %s et %s",
+                                 msg->sender, group1, group2);
                     break;
                 }
 
-                // Sauvegarder la liste des utilisateurs de group2 AVANT la fusion
-                char group2_users[MAX_CLIENTS][MAX_USERNAME];
-                int group2_user_count = g2->user_count;
-                for (int i = 0; i < g2->user_count; i++) {
-                    strncpy(group2_users[i], g2->users[i], MAX_USERNAME - 1);
-                    group2_users[i][MAX_USERNAME - 1] = '\0';
+                // Sauvegarder l'ensemble des membres de group2 AVANT la fusion
+                int words = shm->member_words;
+                uint64_t *group2_members = malloc(words * sizeof(uint64_t));
+                if (group2_members == NULL) {
+                    perror("Erreur malloc");
+                    break;
                 }
+                memcpy(group2_members, group_members(shm, g2), words * sizeof(uint64_t));
 
                 if (group_merge(shm, group1, group2) == 0) {
-                    printf(">>> Groupes %s et %s fusionnés par %s (admin)\n", group1, group2, msg->sender);
-                    snprintf(log_buffer, sizeof(log_buffer), "Groupes %s et %s fusionnés par %s (admin)",
-                            group1, group2, msg->sender);
-                    log_event(g_logfile, "MERGE_GROUPS", log_buffer);
+                    wal_append(WAL_GROUP_MERGE, group1, group2);
+
+                    // Annuaire : group2 disparaît, group1 grossit et ses
+                    // nouveaux membres changent de groupe
+                    directory_publish_group(ob, shm, group2);
+                    directory_publish_group(ob, shm, group1);
+                    for (int id = bitset_next(group2_members, words, 0); id >= 0;
+                         id = bitset_next(group2_members, words, id + 1)) {
+                        if (shm_user(shm, id)->active) {
+                            directory_publish_user(ob, shm, shm_user(shm, id)->username);
+                        }
+                    }
+                    outbox_printf(ob, ">>> Groupes %s et %s fusionnés par %s (admin)\n", group1, group2, msg->sender);
+                    outbox_event(ob, shm, EVT_MERGE_GROUPS, msg->sender, NULL, group1, group2,
+                                 "Groupes %s et %s fusionnés par %s (admin)",
+                                 group1, group2, msg->sender);
 
                     // Notifier tous les utilisateurs concernés
                     Message notification;
@@ -334,35 +617,39 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                             "Les groupes %s et %s ont été fusionnés", group1, group2);
                     message_create(&notification, MSG_PUBLIC, "Serveur",
                                  NULL, group1, notif_content);
-                    message_send_to_group(sockfd, shm, &notification);
+                    message_send_to_group(ob, shm, &notification);
 
                     // Envoyer un message MSG_JOIN aux anciens membres de group2
                     // pour qu'ils mettent à jour leur g_current_group côté client
                     Group *merged_group = group_find(shm, group1);
                     if (merged_group != NULL) {
-                        for (int i = 0; i < group2_user_count; i++) {
-                            User *user = user_find(shm, group2_users[i]);
-                            if (user != NULL && user->active) {
-                                Message update_msg;
-                                char update_content[MAX_MESSAGE];
-
-                                // Obtenir le nom de couleur du groupe fusionné
-                                const char *color_name = "green";
-                                if (strcmp(merged_group->color, COLOR_RED) == 0) color_name = "red";
-                                else if (strcmp(merged_group->color, COLOR_GREEN) == 0) color_name = "green";
-                                else if (strcmp(merged_group->color, COLOR_YELLOW) == 0) color_name = "yellow";
-                                else if (strcmp(merged_group->color, COLOR_BLUE) == 0) color_name = "blue";
-                                else if (strcmp(merged_group->color, COLOR_MAGENTA) == 0) color_name = "magenta";
-                                else if (strcmp(merged_group->color, COLOR_CYAN) == 0) color_name = "cyan";
-                                else if (strcmp(merged_group->color, COLOR_WHITE) == 0) color_name = "white";
-
-                                snprintf(update_content, MAX_MESSAGE, "JOINED:%s", color_name);
-                                message_create(&update_msg, MSG_JOIN, group2_users[i], NULL, group1, update_content);
-                                socket_send(sockfd, &update_msg, &user->addr);
+                        // Obtenir le nom de couleur du groupe fusionné
+                        const char *color_name = "green";
+                        if (strcmp(merged_group->color, COLOR_RED) == 0) color_name = "red";
+                        else if (strcmp(merged_group->color, COLOR_GREEN) == 0) color_name = "green";
+                        else if (strcmp(merged_group->color, COLOR_YELLOW) == 0) color_name = "yellow";
+                        else if (strcmp(merged_group->color, COLOR_BLUE) == 0) color_name = "blue";
+                        else if (strcmp(merged_group->color, COLOR_MAGENTA) == 0) color_name = "magenta";
+                        else if (strcmp(merged_group->color, COLOR_CYAN) == 0) color_name = "cyan";
+                        else if (strcmp(merged_group->color, COLOR_WHITE) == 0) color_name = "white";
+
+                        char update_content[MAX_MESSAGE];
+                        snprintf(update_content, MAX_MESSAGE, "JOINED:%s", color_name);
+
+                        // Une mise à jour par ancien membre de group2
+                        Message update;
+                        for (int id = bitset_next(group2_members, words, 0); id >= 0;
+                             id = bitset_next(group2_members, words, id + 1)) {
+                            User *user = shm_user(shm, id);
+                            if (user->active) {
+                                message_create(&update, MSG_JOIN, user->username,
+                                               NULL, group1, update_content);
+                                outbox_send(ob, &update, user->username, &user->addr);
                             }
                         }
                     }
                 }
+                free(group2_members);
             }
             break;
         }
@@ -372,12 +659,12 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
             // Le groupe est dans msg->group
             Group *group = group_find(shm, msg->group);
             if (group == NULL) {
-                printf(">>> Groupe %s non trouvé\n", msg->group);
+                outbox_printf(ob, ">>> Groupe %s non trouvé\n", msg->group);
                 break;
             }
 
             // Vérifier que l'utilisateur qui kick est admin
-            if (!group_is_admin(group, msg->sender)) {
+            if (!group_is_admin(shm, group, msg->sender)) {
                 User *user = user_find(shm, msg->sender);
                 if (user != NULL) {
                     Message error_msg;
@@ -385,14 +672,13 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                     snprintf(error_content, MAX_MESSAGE,
                             "Seuls les administrateurs peuvent exclure des membres");
                     message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
-                    socket_send(sockfd, &error_msg, &user->addr);
+                    outbox_send(ob, &error_msg, user->username, &user->addr);
                 }
-                printf(">>> %s (non-admin) a tenté d'exclure %s de %s\n",
+                outbox_printf(ob, ">>> %s (non-admin) a tenté d'exclure %s de %s\n",
                        msg->sender, msg->content, msg->group);
-                snprintf(log_buffer, sizeof(log_buffer),
-                        "%s (non-admin) a tenté d'exclure %s de %s",
-                        msg->sender, msg->content, msg->group);
-                log_event(g_logfile, "KICK_DENIED", log_buffer);
+                outbox_event(ob, shm, EVT_KICK_DENIED, msg->sender, msg->content, msg->group, NULL,
+                             "%s (non-admin) a tenté d'exclure %s de %s",
+                             msg->sender, msg->content, msg->group);
                 break;
             }
 
@@ -405,19 +691,21 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                     snprintf(error_content, MAX_MESSAGE,
                             "Vous ne pouvez pas vous exclure vous-même");
                     message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
-                    socket_send(sockfd, &error_msg, &user->addr);
+                    outbox_send(ob, &error_msg, user->username, &user->addr);
                 }
                 break;
             }
 
             // Exclure l'utilisateur
             if (group_kick_user(shm, msg->group, msg->content) == 0) {
-                printf(">>> %s (admin) a exclu %s du groupe %s\n",
+                wal_append(WAL_GROUP_KICK, msg->group, msg->content);
+                directory_publish_user(ob, shm, msg->content);
+                directory_publish_group(ob, shm, msg->group);
+                outbox_printf(ob, ">>> %s (admin) a exclu %s du groupe %s\n",
                        msg->sender, msg->content, msg->group);
-                snprintf(log_buffer, sizeof(log_buffer),
-                        "%s (admin) a exclu %s du groupe %s",
-                        msg->sender, msg->content, msg->group);
-                log_event(g_logfile, "KICK_USER", log_buffer);
+                outbox_event(ob, shm, EVT_KICK_USER, msg->sender, msg->content, msg->group, NULL,
+                             "%s (admin) a exclu %s du groupe %s",
+                             msg->sender, msg->content, msg->group);
 
                 // Notifier l'utilisateur exclu
                 User *kicked_user = user_find(shm, msg->content);
@@ -427,7 +715,7 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                     snprintf(notif_content, MAX_MESSAGE,
                             "Vous avez été kick par %s", msg->sender);
                     message_create(&notif, MSG_LEAVE, "Serveur", NULL, msg->group, notif_content);
-                    socket_send(sockfd, &notif, &kicked_user->addr);
+                    outbox_send(ob, &notif, kicked_user->username, &kicked_user->addr);
                 }
 
                 // Notifier le groupe
@@ -437,7 +725,7 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                         "%s a été exclu du groupe par %s", msg->content, msg->sender);
                 message_create(&group_notif, MSG_PUBLIC, "Serveur",
                              NULL, msg->group, group_notif_content);
-                message_send_to_group(sockfd, shm, &group_notif);
+                message_send_to_group(ob, shm, &group_notif);
             }
             break;
         }
@@ -447,12 +735,12 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
             // Le groupe est dans msg->group
             Group *group = group_find(shm, msg->group);
             if (group == NULL) {
-                printf(">>> Groupe %s non trouvé\n", msg->group);
+                outbox_printf(ob, ">>> Groupe %s non trouvé\n", msg->group);
                 break;
             }
 
             // Vérifier que l'utilisateur qui promeut est admin
-            if (!group_is_admin(group, msg->sender)) {
+            if (!group_is_admin(shm, group, msg->sender)) {
                 User *user = user_find(shm, msg->sender);
                 if (user != NULL) {
                     Message error_msg;
@@ -460,14 +748,13 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                     snprintf(error_content, MAX_MESSAGE,
                             "Seuls les administrateurs peuvent promouvoir des membres");
                     message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
-                    socket_send(sockfd, &error_msg, &user->addr);
+                    outbox_send(ob, &error_msg, user->username, &user->addr);
                 }
-                printf(">>> %s (non-admin) a tenté de promouvoir %s dans %s\n",
+                outbox_printf(ob, ">>> %s (non-admin) a tenté de promouvoir %s dans %s\n",
                        msg->sender, msg->content, msg->group);
-                snprintf(log_buffer, sizeof(log_buffer),
-                        "%s (non-admin) a tenté de promouvoir %s dans %s",
-                        msg->sender, msg->content, msg->group);
-                log_event(g_logfile, "PROMOTE_DENIED", log_buffer);
+                outbox_event(ob, shm, EVT_PROMOTE_DENIED, msg->sender, msg->content, msg->group, NULL,
+                             "%s (non-admin) a tenté de promouvoir %s dans %s",
+                             msg->sender, msg->content, msg->group);
                 break;
             }
 
@@ -482,21 +769,22 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                     snprintf(error_content, MAX_MESSAGE,
                             "Erreur : l'utilisateur '%s' n'existe pas", msg->content);
                     message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
-                    socket_send(sockfd, &error_msg, &sender->addr);
+                    outbox_send(ob, &error_msg, sender->username, &sender->addr);
                 }
-                printf(">>> Échec : utilisateur %s n'existe pas\n", msg->content);
+                outbox_printf(ob, ">>> Échec : utilisateur %s n'existe pas\n", msg->content);
                 break;
             }
 
             // Promouvoir l'utilisateur
-            int promote_result = group_add_admin(group, msg->content);
+            int promote_result = group_add_admin(shm, group, msg->content);
             if (promote_result == 0) {
-                printf(">>> %s (admin) a promu %s administrateur du groupe %s\n",
+                wal_append(WAL_GROUP_ADD_ADMIN, msg->group, msg->content);
+                directory_publish_group(ob, shm, msg->group);
+                outbox_printf(ob, ">>> %s (admin) a promu %s administrateur du groupe %s\n",
                        msg->sender, msg->content, msg->group);
-                snprintf(log_buffer, sizeof(log_buffer),
-                        "%s (admin) a promu %s administrateur du groupe %s",
-                        msg->sender, msg->content, msg->group);
-                log_event(g_logfile, "PROMOTE_ADMIN", log_buffer);
+                outbox_event(ob, shm, EVT_PROMOTE_ADMIN, msg->sender, msg->content, msg->group, NULL,
+                             "%s (admin) a promu %s administrateur du groupe %s",
+                             msg->sender, msg->content, msg->group);
 
                 // Notifier l'utilisateur promu
                 User *promoted_user = user_find(shm, msg->content);
@@ -506,7 +794,7 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                     snprintf(notif_content, MAX_MESSAGE,
                             "Vous êtes maintenant administrateur du groupe %s", msg->group);
                     message_create(&notif, MSG_PUBLIC, "Serveur", NULL, NULL, notif_content);
-                    socket_send(sockfd, &notif, &promoted_user->addr);
+                    outbox_send(ob, &notif, promoted_user->username, &promoted_user->addr);
                 }
 
                 // Notifier le groupe
@@ -516,7 +804,7 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                         "%s est maintenant administrateur du groupe", msg->content);
                 message_create(&group_notif, MSG_PUBLIC, "Serveur",
                              NULL, msg->group, group_notif_content);
-                message_send_to_group(sockfd, shm, &group_notif);
+                message_send_to_group(ob, shm, &group_notif);
             } else {
                 // Envoyer message d'erreur (déjà admin ou pas dans le groupe)
                 User *sender = user_find(shm, msg->sender);
@@ -525,7 +813,7 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                     char error_content[MAX_MESSAGE];
 
                     // Vérifier si l'utilisateur est déjà admin
-                    if (group_is_admin(group, msg->content)) {
+                    if (group_is_admin(shm, group, msg->content)) {
                         snprintf(error_content, MAX_MESSAGE,
                                 "Erreur : '%s' est déjà administrateur du groupe", msg->content);
                     } else {
@@ -533,9 +821,9 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                                 "Erreur : '%s' n'est pas membre du groupe", msg->content);
                     }
                     message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
-                    socket_send(sockfd, &error_msg, &sender->addr);
+                    outbox_send(ob, &error_msg, sender->username, &sender->addr);
                 }
-                printf(">>> Échec : impossible de promouvoir %s\n", msg->content);
+                outbox_printf(ob, ">>> Échec : impossible de promouvoir %s\n", msg->content);
             }
             break;
         }
@@ -545,12 +833,12 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
             // Le groupe est dans msg->group
             Group *group = group_find(shm, msg->group);
             if (group == NULL) {
-                printf(">>> Groupe %s non trouvé\n", msg->group);
+                outbox_printf(ob, ">>> Groupe %s non trouvé\n", msg->group);
                 break;
             }
 
             // Vérifier que l'utilisateur qui rétrograde est admin
-            if (!group_is_admin(group, msg->sender)) {
+            if (!group_is_admin(shm, group, msg->sender)) {
                 User *user = user_find(shm, msg->sender);
                 if (user != NULL) {
                     Message error_msg;
@@ -558,14 +846,13 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                     snprintf(error_content, MAX_MESSAGE,
                             "Seuls les administrateurs peuvent rétrograder des administrateurs");
                     message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
-                    socket_send(sockfd, &error_msg, &user->addr);
+                    outbox_send(ob, &error_msg, user->username, &user->addr);
                 }
-                printf(">>> %s (non-admin) a tenté de rétrograder %s dans %s\n",
+                outbox_printf(ob, ">>> %s (non-admin) a tenté de rétrograder %s dans %s\n",
                        msg->sender, msg->content, msg->group);
-                snprintf(log_buffer, sizeof(log_buffer),
-                        "%s (non-admin) a tenté de rétrograder %s dans %s",
-                        msg->sender, msg->content, msg->group);
-                log_event(g_logfile, "DEMOTE_DENIED", log_buffer);
+                outbox_event(ob, shm, EVT_DEMOTE_DENIED, msg->sender, msg->content, msg->group, NULL,
+                             "%s (non-admin) a tenté de rétrograder %s dans %s",
+                             msg->sender, msg->content, msg->group);
                 break;
             }
 
@@ -578,7 +865,7 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                     snprintf(error_content, MAX_MESSAGE,
                             "Vous ne pouvez pas vous rétrograder vous-même");
                     message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
-                    socket_send(sockfd, &error_msg, &user->addr);
+                    outbox_send(ob, &error_msg, user->username, &user->addr);
                 }
                 break;
             }
@@ -594,21 +881,22 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                     snprintf(error_content, MAX_MESSAGE,
                             "Erreur : l'utilisateur '%s' n'existe pas", msg->content);
                     message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
-                    socket_send(sockfd, &error_msg, &sender->addr);
+                    outbox_send(ob, &error_msg, sender->username, &sender->addr);
                 }
-                printf(">>> Échec : utilisateur %s n'existe pas\n", msg->content);
+                outbox_printf(ob, ">>> Échec : utilisateur %s n'existe pas\n", msg->content);
                 break;
             }
 
             // Rétrograder l'utilisateur
-            int demote_result = group_remove_admin(group, msg->content);
+            int demote_result = group_remove_admin(shm, group, msg->content);
             if (demote_result == 0) {
-                printf(">>> %s (admin) a rétrogradé %s dans le groupe %s\n",
+                wal_append(WAL_GROUP_REMOVE_ADMIN, msg->group, msg->content);
+                directory_publish_group(ob, shm, msg->group);
+                outbox_printf(ob, ">>> %s (admin) a rétrogradé %s dans le groupe %s\n",
                        msg->sender, msg->content, msg->group);
-                snprintf(log_buffer, sizeof(log_buffer),
-                        "%s (admin) a rétrogradé %s dans le groupe %s",
-                        msg->sender, msg->content, msg->group);
-                log_event(g_logfile, "DEMOTE_ADMIN", log_buffer);
+                outbox_event(ob, shm, EVT_DEMOTE_ADMIN, msg->sender, msg->content, msg->group, NULL,
+                             "%s (admin) a rétrogradé %s dans le groupe %s",
+                             msg->sender, msg->content, msg->group);
 
                 // Notifier l'utilisateur rétrogradé
                 User *demoted_user = user_find(shm, msg->content);
@@ -618,7 +906,7 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                     snprintf(notif_content, MAX_MESSAGE,
                             "Vous n'êtes plus administrateur du groupe %s", msg->group);
                     message_create(&notif, MSG_PUBLIC, "Serveur", NULL, NULL, notif_content);
-                    socket_send(sockfd, &notif, &demoted_user->addr);
+                    outbox_send(ob, &notif, demoted_user->username, &demoted_user->addr);
                 }
 
                 // Notifier le groupe
@@ -628,7 +916,7 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                         "%s n'est plus administrateur du groupe", msg->content);
                 message_create(&group_notif, MSG_PUBLIC, "Serveur",
                              NULL, msg->group, group_notif_content);
-                message_send_to_group(sockfd, shm, &group_notif);
+                message_send_to_group(ob, shm, &group_notif);
             } else {
                 // Envoyer message d'erreur
                 User *sender = user_find(shm, msg->sender);
@@ -640,7 +928,7 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                     if (group->admin_count <= 1) {
                         snprintf(error_content, MAX_MESSAGE,
                                 "Erreur : impossible de rétrograder le dernier administrateur");
-                    } else if (!group_is_admin(group, msg->content)) {
+                    } else if (!group_is_admin(shm, group, msg->content)) {
                         snprintf(error_content, MAX_MESSAGE,
                                 "Erreur : '%s' n'est pas administrateur du groupe", msg->content);
                     } else {
@@ -648,18 +936,49 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
                                 "Erreur : impossible de rétrograder '%s'", msg->content);
                     }
                     message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
-                    socket_send(sockfd, &error_msg, &sender->addr);
+                    outbox_send(ob, &error_msg, sender->username, &sender->addr);
                 }
-                printf(">>> Échec : impossible de rétrograder %s\n", msg->content);
+                outbox_printf(ob, ">>> Échec : impossible de rétrograder %s\n", msg->content);
             }
             break;
         }
 
         case MSG_DISCONNECT: {
-            user_remove(shm, msg->sender);
-            printf(">>> %s s'est déconnecté\n", msg->sender);
-            snprintf(log_buffer, sizeof(log_buffer), "%s s'est déconnecté", msg->sender);
-            log_event(g_logfile, "DISCONNECT", log_buffer);
+            // Groupes dont l'utilisateur est membre, à pousser aux abonnés
+            // de l'annuaire une fois qu'il en est retiré (les emplacements
+            // de groupes ne bougent pas)
+            int id = user_get_id(shm, msg->sender);
+            int *member_of = NULL;
+            int member_of_count = 0;
+            if (id >= 0 && shm->group_count > 0) {
+                member_of = malloc((size_t)shm->group_count * sizeof(int));
+                if (member_of == NULL) {
+                    perror("Erreur malloc");
+                }
+                for (int j = 0; member_of != NULL && j < shm->group_count; j++) {
+                    Group *group = shm_group(shm, j);
+                    if (group->active && bitset_test(group_members(shm, group), id)) {
+                        member_of[member_of_count++] = j;
+                    }
+                }
+            }
+
+            User *leaving = user_find(shm, msg->sender);
+            if (leaving != NULL) {
+                workers_forget_peer(&leaving->addr);
+            }
+
+            if (user_remove(shm, msg->sender) == 0) {
+                wal_append(WAL_USER_REMOVE, msg->sender, NULL);
+                directory_publish_user(ob, shm, msg->sender);
+                for (int j = 0; j < member_of_count; j++) {
+                    directory_publish_group(ob, shm, shm_group(shm, member_of[j])->name);
+                }
+            }
+            free(member_of);
+            outbox_printf(ob, ">>> %s s'est déconnecté\n", msg->sender);
+            outbox_event(ob, shm, EVT_DISCONNECT, msg->sender, NULL, NULL, NULL,
+                         "%s s'est déconnecté", msg->sender);
             break;
         }
         
@@ -667,135 +986,760 @@ void handle_client_message(int sockfd, SharedMemory *shm, int semid,
             // Répondre avec un accusé de réception
             User *user = user_find(shm, msg->sender);
             if (user == NULL) {
-                user_add(shm, msg->sender, client_addr, ntohs(client_addr->sin_port));
+                if (user_add(shm, msg->sender, client_addr, ntohs(client_addr->sin_port)) >= 0) {
+                    wal_append_user(msg->sender, client_addr);
+                    directory_publish_user(ob, shm, msg->sender);
+                }
                 user = user_find(shm, msg->sender);
+                outbox_event(ob, shm, EVT_USER_NAME, msg->sender, NULL, NULL, msg->sender, NULL);
             }
 
             if (user != NULL) {
                 Message ack;
                 message_create(&ack, MSG_CONNECT_ACK, "Serveur", msg->sender, NULL, "OK");
-                socket_send(sockfd, &ack, &user->addr);
+                outbox_send(ob, &ack, user->username, &user->addr);
             }
 
-            printf(">>> %s s'est connecté\n", msg->sender);
-            snprintf(log_buffer, sizeof(log_buffer), "%s s'est connecté", msg->sender);
-            log_event(g_logfile, "CONNECT", log_buffer);
+            outbox_printf(ob, ">>> %s s'est connecté\n", msg->sender);
+            outbox_event(ob, shm, EVT_CONNECT, msg->sender, NULL, NULL, NULL,
+                         "%s s'est connecté", msg->sender);
             break;
         }
 
-        case MSG_LIST_USERS: {
-            // Envoyer la liste des utilisateurs au client
-            User *requester = user_find(shm, msg->sender);
-            if (requester == NULL) {
+        case MSG_SUBSCRIBE: {
+            // Abonnement à l'annuaire : répondre avec la version courante,
+            // les changements suivants seront poussés au client
+            User *user = user_find(shm, msg->sender);
+            if (user == NULL) {
+                outbox_printf(ob, ">>> Abonnement refusé : %s n'est pas connecté\n", msg->sender);
                 break;
             }
 
-            // Construire la liste des utilisateurs dans le contenu du message
-            char user_list[MAX_MESSAGE * 4] = "";  // Buffer plus grand pour la liste
-            int active_users = 0;
+            uint32_t version = directory_subscribe(shm, msg->sender);
+            char content[16];
+            snprintf(content, sizeof(content), "%u", version);
 
-            for (int i = 0; i < shm->user_count; i++) {
-                if (shm->users[i].active) {
-                    active_users++;
-                    char user_info[128];
-                    snprintf(user_info, sizeof(user_info), "%s:%s|",
-                            shm->users[i].username,
-                            shm->users[i].current_group[0] ? shm->users[i].current_group : "aucun");
+            Message reply;
+            message_create(&reply, MSG_SUBSCRIBE, "Serveur", msg->sender, NULL, content);
+            outbox_send(ob, &reply, user->username, &user->addr);
+            outbox_printf(ob, ">>> %s s'est abonné à l'annuaire (version %u)\n", msg->sender, version);
+            break;
+        }
 
-                    // Vérifier qu'on ne dépasse pas la taille du buffer
-                    if (strlen(user_list) + strlen(user_info) < sizeof(user_list) - 1) {
-                        strcat(user_list, user_info);
-                    }
+        default:
+            outbox_printf(ob, ">>> Type de message inconnu: %d\n", msg->type);
+            break;
+    }
+}
+
+// Traite un message en lecture seule (voir message_is_read_only) : les
+// données utiles sont copiées dans une section de lecture, recopiées si un
+// écrivain est passé entre-temps ; les envois préparés dans l'outbox ne
+// partent qu'au vidage.
+void handle_read_message(Outbox *ob, SharedMemory *shm,
+                         Message *msg, struct sockaddr_in *client_addr) {
+    // Log de débogage
+    char addr_str[ADDR_STR_LEN];
+    outbox_printf(ob, "[DEBUG HANDLER] Message Type: %d, De: %s (%s)\n",
+           msg->type, msg->sender, addr_format(client_addr, addr_str, sizeof(addr_str)));
+
+    Recipient requester;
+    int found;
+    uint32_t seq;
+
+    switch (msg->type) {
+        case MSG_PUBLIC: {
+            // Diffuser le message public au groupe
+            OutboxMark mark = outbox_mark(ob);
+            Group *group;
+            int slot = -1;
+            uint32_t incarnation = 0;
+            int count;
+            do {
+                outbox_rewind(ob, mark);
+                seq = shm_read_begin(shm);
+                group = group_find(shm, msg->group);
+                if (group != NULL) {
+                    slot = shm_group_slot(shm, group);
+                    incarnation = __atomic_load_n(&group->incarnation, __ATOMIC_ACQUIRE);
                 }
+                count = message_send_to_group(ob, shm, msg);
+            } while (shm_read_retry(shm, seq));
+
+            if (count < 0 || group == NULL) {
+                outbox_printf(ob, "Groupe %s non trouvé\n", msg->group);
+            } else {
+                // Une seule fois, après validation de la lecture
+                group_history_append(shm, slot, incarnation, msg);
+                store_append(msg);
+                outbox_printf(ob, "Message envoyé à %d utilisateur(s) du groupe %s\n", count, msg->group);
             }
 
-            Message response;
-            message_create(&response, MSG_LIST_USERS_RESPONSE, "Serveur", msg->sender, NULL, user_list);
-            socket_send(sockfd, &response, &requester->addr);
+            outbox_printf(ob, ">>> [%s] %s: %s\n", msg->group, msg->sender, msg->content);
+            outbox_event(ob, shm, EVT_PUBLIC, msg->sender, NULL, msg->group, msg->content,
+                         "[%s] %s: %s",
+                         msg->group, msg->sender, msg->content);
+            break;
+        }
+
+        case MSG_PRIVATE: {
+            Recipient recipient;
+            int recipient_found;
+            do {
+                seq = shm_read_begin(shm);
+                recipient_found = user_snapshot(shm, msg->recipient, &recipient) == 0;
+                found = user_snapshot(shm, msg->sender, &requester) == 0;
+            } while (shm_read_retry(shm, seq));
 
-            printf(">>> %s a demandé la liste des utilisateurs (%d actifs)\n", msg->sender, active_users);
+            // Envoyer le message privé
+            if (recipient_found) {
+                outbox_send(ob, msg, recipient.username, &recipient.addr);
+                store_append(msg);
+                outbox_printf(ob, ">>> [PRIVÉ] %s -> %s: %s\n",
+                              msg->sender, msg->recipient, msg->content);
+                outbox_event(ob, shm, EVT_PRIVATE, msg->sender, msg->recipient, NULL, msg->content,
+                             "%s -> %s: %s",
+                             msg->sender, msg->recipient, msg->content);
+            } else {
+                // L'utilisateur n'existe pas, envoyer une erreur à l'expéditeur
+                if (found) {
+                    Message error_msg;
+                    char error_content[MAX_MESSAGE];
+                    snprintf(error_content, MAX_MESSAGE,
+                            "Erreur : l'utilisateur '%s' n'existe pas ou n'est pas connecté", msg->recipient);
+                    message_create(&error_msg, MSG_PUBLIC, "Serveur", NULL, NULL, error_content);
+                    outbox_send(ob, &error_msg, requester.username, &requester.addr);
+                }
+                outbox_printf(ob, ">>> [PRIVÉ] Échec: utilisateur %s non trouvé\n", msg->recipient);
+            }
             break;
         }
 
+        case MSG_LIST_USERS:
         case MSG_LIST_GROUPS: {
-            // Envoyer la liste des groupes au client
-            User *requester = user_find(shm, msg->sender);
-            if (requester == NULL) {
+            // Une page de la liste, à partir de l'emplacement indiqué dans
+            // le contenu (vide : depuis le début)
+            int users = (msg->type == MSG_LIST_USERS);
+            int cursor = atoi(msg->content);
+            char chunks[LIST_PAGE_CHUNKS][MAX_MESSAGE];
+            int chunk_count = 0;
+            int entries = 0;
+            uint32_t generation = 0;
+
+            if (cursor < 0) {
+                cursor = 0;
+            }
+
+            do {
+                seq = shm_read_begin(shm);
+                found = user_snapshot(shm, msg->sender, &requester) == 0;
+                generation = users ? shm->user_generation : shm->group_generation;
+            } while (shm_read_retry(shm, seq));
+
+            if (!found) {
                 break;
             }
 
-            // Construire la liste des groupes dans le contenu du message
-            char group_list[MAX_MESSAGE * 4] = "";  // Buffer plus grand pour la liste
-            int active_groups = 0;
+            chunk_count = list_page_cached(shm, users, generation, cursor, chunks, &entries);
+            if (chunk_count == 0) {
+                // Curseur d'une version précédente de la liste (ou cache
+                // indisponible) : découper la page directement
+                do {
+                    seq = shm_read_begin(shm);
+                    chunk_count = list_build_page(shm, users, cursor, chunks, &entries);
+                } while (shm_read_retry(shm, seq));
+            }
+
+            // Envoyer la page au client
+            for (int i = 0; i < chunk_count; i++) {
+                Message response;
+                message_create(&response, users ? MSG_LIST_USERS_RESPONSE : MSG_LIST_GROUPS_RESPONSE,
+                               "Serveur", msg->sender, NULL, chunks[i]);
+                outbox_send(ob, &response, requester.username, &requester.addr);
+            }
+
+            if (cursor == 0) {
+                outbox_printf(ob, ">>> %s a demandé la liste des %s (%d actifs)\n",
+                              msg->sender, users ? "utilisateurs" : "groupes", entries);
+            } else {
+                outbox_printf(ob, ">>> %s a demandé la suite de la liste des %s (%d actifs à partir de %d)\n",
+                              msg->sender, users ? "utilisateurs" : "groupes", entries, cursor);
+            }
+            break;
+        }
 
-            for (int i = 0; i < shm->group_count; i++) {
-                if (shm->groups[i].active && shm->groups[i].user_count > 0) {
-                    active_groups++;
-                    char group_info[128];
-                    snprintf(group_info, sizeof(group_info), "%s:%d:%d|",
-                            shm->groups[i].name,
-                            shm->groups[i].user_count,
-                            shm->groups[i].admin_count);
+        case MSG_HISTORY:
+        case MSG_HISTORY_SINCE: {
+            // Historique du groupe indiqué (membres seulement) ou, sans
+            // groupe, des messages privés reçus par le demandeur
+            int allowed;
+            do {
+                seq = shm_read_begin(shm);
+                found = user_snapshot(shm, msg->sender, &requester) == 0;
+                allowed = found;
+                if (found && msg->group[0] != '\0') {
+                    Group *group = group_find(shm, msg->group);
+                    int id = user_get_id(shm, msg->sender);
+                    allowed = group != NULL && id >= 0 && id < shm->max_users &&
+                              bitset_test(group_members(shm, group), id);
+                }
+            } while (shm_read_retry(shm, seq));
 
-                    // Vérifier qu'on ne dépasse pas la taille du buffer
-                    if (strlen(group_list) + strlen(group_info) < sizeof(group_list) - 1) {
-                        strcat(group_list, group_info);
-                    }
+            if (!found) {
+                break;
+            }
+
+            int count = 0;
+            if (allowed) {
+                MessageType kind = (msg->group[0] != '\0') ? MSG_PUBLIC : MSG_PRIVATE;
+                const char *channel = (kind == MSG_PUBLIC) ? msg->group : msg->sender;
+                if (msg->type == MSG_HISTORY) {
+                    count = store_history(ob, kind, channel, atoi(msg->content),
+                                          requester.username, &requester.addr);
+                } else {
+                    count = store_since(ob, kind, channel, (time_t)strtoll(msg->content, NULL, 10),
+                                        requester.username, &requester.addr);
                 }
             }
 
-            Message response;
-            message_create(&response, MSG_LIST_GROUPS_RESPONSE, "Serveur", msg->sender, NULL, group_list);
-            socket_send(sockfd, &response, &requester->addr);
+            char count_str[16];
+            snprintf(count_str, sizeof(count_str), "%d", count);
+            Message end;
+            message_create(&end, MSG_HISTORY_END, "Serveur", msg->sender, msg->group, count_str);
+            outbox_send(ob, &end, requester.username, &requester.addr);
 
-            printf(">>> %s a demandé la liste des groupes (%d actifs)\n", msg->sender, active_groups);
+            outbox_printf(ob, ">>> %s a demandé l'historique de %s (%d message(s))\n",
+                          msg->sender, msg->group[0] ? msg->group : "ses messages privés", count);
             break;
         }
 
         default:
-            printf(">>> Type de message inconnu: %d\n", msg->type);
             break;
     }
-    
-    // Déverrouiller l'accès à la mémoire partagée
-    sem_v(semid);
+}
+
+// Crée (ou réutilise) le segment de mémoire partagée aux capacités demandées.
+// Un segment existant de capacités différentes est migré vers un nouveau
+// segment ; un segment d'un format inconnu est recréé. *created indique un
+// segment neuf et vide, à restaurer depuis le journal.
+static int setup_shared_memory(key_t key, int max_users, int max_groups, int history_size,
+                               int *created) {
+    SharedMemory layout;
+    size_t size = shm_layout_init(&layout, max_users, max_groups, history_size);
+    SharedMemory *previous = NULL;
+
+    *created = 0;
+    int shmid = shmget(key, 0, 0);
+    if (shmid != -1) {
+        struct shmid_ds ds;
+        SharedMemory *old = NULL;
+
+        if (shmctl(shmid, IPC_STAT, &ds) == -1 || shm_attach(shmid, &old) == -1) {
+            return -1;
+        }
+
+        if (shm_layout_check(old, ds.shm_segsz) == 0) {
+            if (old->max_users == max_users && old->max_groups == max_groups &&
+                old->history_size == history_size) {
+                g_shm = old;
+                return shmid;
+            }
+
+            if (old->user_count > max_users || old->group_count > max_groups) {
+                fprintf(stderr, "Le segment existant contient %d utilisateurs et %d groupes : "
+                        "capacités -u %d -g %d insuffisantes\n",
+                        old->user_count, old->group_count, max_users, max_groups);
+                shm_detach(old);
+                return -1;
+            }
+
+            // Conserver une copie des données pour les migrer
+            previous = malloc(old->total_size);
+            if (previous == NULL) {
+                perror("Erreur malloc");
+                shm_detach(old);
+                return -1;
+            }
+            memcpy(previous, old, old->total_size);
+            printf("Migration de la mémoire partagée : %d/%d/%d -> %d/%d/%d "
+                   "(utilisateurs/groupes/historique)\n",
+                   old->max_users, old->max_groups, old->history_size,
+                   max_users, max_groups, history_size);
+        } else {
+            printf("Mémoire partagée d'un format inconnu, recréation\n");
+        }
+
+        shm_detach(old);
+        shm_destroy(shmid);
+    }
+
+    shmid = shm_create(key, size);
+    if (shmid == -1 || shm_attach(shmid, &g_shm) == -1) {
+        free(previous);
+        return -1;
+    }
+
+    memset(g_shm, 0, size);
+    memcpy(g_shm, &layout, sizeof(layout));
+
+    if (previous != NULL) {
+        int result = shm_migrate(g_shm, previous);
+        free(previous);
+        if (result == -1) {
+            return -1;
+        }
+    } else {
+        *created = 1;
+    }
+
+    return shmid;
+}
+
+// Traite un lot de messages. Les messages en lecture seule passent sans
+// verrou ; les suites de messages qui modifient la mémoire partagée sont
+// traitées sous une seule section d'écriture. Les envois, affichages et
+// entrées du journal sont accumulés dans ob et exécutés hors section
+// d'écriture, avant la suivante et en fin de lot.
+void handle_client_batch(int sockfd, SharedMemory *shm, Outbox *ob,
+                         Message *msgs, struct sockaddr_in *client_addrs, int count) {
+    int writing = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (message_is_read_only(msgs[i].type)) {
+            // Une lecture attendrait la fin de notre propre écriture
+            if (writing) {
+                shm_write_end(shm);
+                writing = 0;
+            }
+            handle_read_message(ob, shm, &msgs[i], &client_addrs[i]);
+        } else {
+            if (!writing) {
+                outbox_flush(ob, sockfd);
+                if (shm_write_begin(shm) == -1) {
+                    continue;
+                }
+                writing = 1;
+            }
+            handle_client_message(ob, shm, &msgs[i], &client_addrs[i]);
+        }
+    }
+
+    if (writing) {
+        shm_write_end(shm);
+    }
+    outbox_flush(ob, sockfd);
+}
+
+// Surveille EPOLLOUT tant que des messages attendent dans les files d'envoi
+static void worker_watch_output(Worker *worker, int watch) {
+    if (watch == worker->watching_output) {
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (watch ? EPOLLOUT : 0);
+    ev.data.fd = worker->sockfd;
+    if (epoll_ctl(worker->epollfd, EPOLL_CTL_MOD, worker->sockfd, &ev) == -1) {
+        perror("Erreur epoll_ctl socket");
+        return;
+    }
+    worker->watching_output = watch;
+}
+
+// Déconnecte les utilisateurs dont la file a débordé (politique disconnect)
+// comme s'ils avaient envoyé MSG_DISCONNECT
+static void worker_disconnect_overflowed(Worker *worker) {
+    int count;
+    while ((count = sendq_take_disconnects(&worker->queues, worker->msgs, worker->client_addrs,
+                                           RECV_BATCH_SIZE)) > 0) {
+        for (int i = 0; i < count; i++) {
+            outbox_printf(&worker->outbox, ">>> File d'envoi de %s pleine : déconnexion\n",
+                          worker->msgs[i].sender);
+        }
+        handle_client_batch(worker->sockfd, g_shm, &worker->outbox,
+                            worker->msgs, worker->client_addrs, count);
+    }
+}
+
+// Traite les messages des clients locaux. Après du trafic, le worker
+// scrute encore les anneaux RING_SPIN fois avant de retourner à epoll : un
+// client qui enchaîne ses envois n'a pas à le réveiller. Au plus
+// RING_POLL_BATCHES lots d'affilée pour ne pas délaisser le socket.
+static void worker_poll_rings(Worker *worker) {
+    int idle = 0;
+    int batches = 0;
+
+    while (idle < RING_SPIN && batches < RING_POLL_BATCHES) {
+        int count = ring_poll(worker->msgs, worker->client_addrs, RECV_BATCH_SIZE);
+        if (count == 0) {
+            if (batches == 0) {
+                return;
+            }
+            idle++;
+            continue;
+        }
+        handle_client_batch(worker->sockfd, g_shm, &worker->outbox,
+                            worker->msgs, worker->client_addrs, count);
+        batches++;
+        idle = 0;
+    }
+}
+
+// Boucle d'un worker : epoll sur son socket et sur l'eventfd d'arrêt. Avec
+// l'option -d, l'attente s'arrête à l'échéance des envois retenus dans
+// l'outbox pour être regroupés. Le worker 0 sert aussi les clients locaux :
+// socket AF_UNIX (option -x) et anneaux (option -l), auquel cas il ne
+// s'endort que si les anneaux sont vides.
+static void *worker_run(void *arg) {
+    Worker *worker = (Worker *)arg;
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    int rings = (worker->id == 0 && ring_enabled());
+    int pending = 0;
+
+    while (1) {
+        int timeout = outbox_send_timeout(&worker->outbox);
+        if ((pending & SENDQ_PENDING_LOCAL) && (timeout < 0 || timeout > SENDQ_LOCAL_RETRY_MS)) {
+            timeout = SENDQ_LOCAL_RETRY_MS;
+        }
+        if (rings && timeout != 0 && !ring_server_sleep()) {
+            timeout = 0;
+        }
+        int nfds = epoll_wait(worker->epollfd, events, SERVER_MAX_EVENTS, timeout);
+        if (rings) {
+            ring_server_wake();
+        }
+        if (nfds == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Erreur epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            if (events[i].data.fd == g_stopfd) {
+                outbox_send_pending(&worker->outbox, worker->sockfd);
+                return NULL;
+            }
+            if (events[i].data.fd == g_ringfd) {
+                uint64_t value;
+                if (read(g_ringfd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+                    perror("Erreur read eventfd");
+                }
+                continue;
+            }
+            if (events[i].data.fd == g_unixfd) {
+                int count;
+                while ((count = socket_receive_unix_batch(g_unixfd, worker->msgs, worker->client_addrs,
+                                                          RECV_BATCH_SIZE)) >= 0) {
+                    if (count > 0) {
+                        handle_client_batch(worker->sockfd, g_shm, &worker->outbox,
+                                            worker->msgs, worker->client_addrs, count);
+                    }
+                }
+                continue;
+            }
+
+            // Le socket accepte de nouveau des datagrammes : servir d'abord
+            // les messages en attente
+            if (events[i].events & EPOLLOUT) {
+                sendq_drain(&worker->queues, worker->sockfd);
+            }
+
+            // Vider tous les datagrammes disponibles avant de se rendormir,
+            // par lots d'un appel recvmmsg
+            int count;
+            while ((events[i].events & EPOLLIN) &&
+                   (count = socket_receive_batch(worker->sockfd, worker->msgs, worker->client_addrs,
+                                                 RECV_BATCH_SIZE)) >= 0) {
+                if (count > 0) {
+                    handle_client_batch(worker->sockfd, g_shm, &worker->outbox,
+                                        worker->msgs, worker->client_addrs, count);
+                }
+            }
+        }
+
+        if (rings) {
+            worker_poll_rings(worker);
+        }
+
+        // Les clients locaux en retard sont réessayés à chaque tour
+        if (pending & SENDQ_PENDING_LOCAL) {
+            sendq_drain(&worker->queues, worker->sockfd);
+        }
+
+        if (outbox_send_timeout(&worker->outbox) == 0) {
+            outbox_send_pending(&worker->outbox, worker->sockfd);
+        }
+        worker_disconnect_overflowed(worker);
+        pending = sendq_pending(&worker->queues);
+        worker_watch_output(worker, (pending & SENDQ_PENDING_NET) != 0);
+    }
+    return NULL;
+}
+
+// Crée le socket et la boucle epoll d'un worker (sans démarrer son thread)
+static int worker_setup(Worker *worker, int id, int port) {
+    worker->id = id;
+    worker->started = 0;
+    worker->epollfd = -1;
+    worker->watching_output = 0;
+    outbox_init(&worker->outbox);
+    sendq_init(&worker->queues);
+    worker->outbox.queues = &worker->queues;
+
+    worker->sockfd = socket_create_udp();
+    if (worker->sockfd == -1) {
+        return -1;
+    }
+
+    if (socket_set_reuseport(worker->sockfd) == -1 ||
+        socket_bind_udp(worker->sockfd, port) == -1) {
+        return -1;
+    }
+
+    // Configurer le socket en mode non-bloquant
+    int flags = fcntl(worker->sockfd, F_GETFL, 0);
+    fcntl(worker->sockfd, F_SETFL, flags | O_NONBLOCK);
+
+    worker->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (worker->epollfd == -1) {
+        perror("Erreur epoll_create1");
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = worker->sockfd;
+    if (epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, worker->sockfd, &ev) == -1) {
+        perror("Erreur epoll_ctl socket");
+        return -1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.fd = g_stopfd;
+    if (epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, g_stopfd, &ev) == -1) {
+        perror("Erreur epoll_ctl eventfd");
+        return -1;
+    }
+
+    if (id == 0 && g_ringfd >= 0) {
+        ev.events = EPOLLIN;
+        ev.data.fd = g_ringfd;
+        if (epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, g_ringfd, &ev) == -1) {
+            perror("Erreur epoll_ctl eventfd");
+            return -1;
+        }
+    }
+
+    if (id == 0 && g_unixfd >= 0) {
+        ev.events = EPOLLIN;
+        ev.data.fd = g_unixfd;
+        if (epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, g_unixfd, &ev) == -1) {
+            perror("Erreur epoll_ctl socket local");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Journal binaire : associe les identifiants existants à leurs noms pour
+// que logdump puisse les afficher. Au démarrage seulement, on attend que le
+// thread du journal libère de la place plutôt que de perdre des entrées.
+static void log_names(SharedMemory *shm) {
+    struct timespec pause = { 0, LOG_FLUSH_INTERVAL_MS * 1000000L };
+
+    for (int i = 0; i < shm->user_count; i++) {
+        while (log_post(EVT_USER_NAME, i, -1, -1, shm_user(shm, i)->username) == -1) {
+            nanosleep(&pause, NULL);
+        }
+    }
+    for (int i = 0; i < shm->group_count; i++) {
+        Group *group = shm_group(shm, i);
+        if (group->active) {
+            while (log_post(EVT_GROUP_NAME, -1, -1, i, group->name) == -1) {
+                nanosleep(&pause, NULL);
+            }
+        }
+    }
+}
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-u max_utilisateurs] [-g max_groupes] [-w workers] [-H historique] [-b] [-r]\n"
+                    "       [-q taille_file] [-p oldest|newest|disconnect] [-m taille_datagramme] [-d ms]\n"
+                    "       [-l emplacements] [-x chemin_socket] [port]\n", prog);
+    fprintf(stderr, "  -r  envois fiables (numérotés, acquittés et retransmis)\n");
+    fprintf(stderr, "  -q  messages en attente par destinataire quand le socket est saturé\n");
+    fprintf(stderr, "  -p  file pleine : écarter le plus ancien, le plus récent, ou déconnecter\n");
+    fprintf(stderr, "  -m  taille max des datagrammes regroupant les messages d'un destinataire (0 : pas de regroupement)\n");
+    fprintf(stderr, "  -d  délai (ms) pendant lequel les envois sont retenus pour être regroupés\n");
+    fprintf(stderr, "  -l  clients locaux par mémoire partagée (nombre d'emplacements, 0 : désactivé)\n");
+    fprintf(stderr, "  -x  clients locaux par un socket AF_UNIX créé à ce chemin\n");
 }
 
 int main(int argc, char **argv) {
     int port = PORT_BASE;
+    int max_users = MAX_CLIENTS;
+    int max_groups = MAX_GROUPS;
+    int history_size = HISTORY_SIZE;
+    int worker_count = (int)sysconf(_SC_NPROCESSORS_ONLN);  // Un par cœur par défaut
+    int log_format = LOG_FORMAT_TEXT;
+    int reliable = 0;
+    int sendq_size = SENDQ_SIZE;
+    const char *sendq_policy = NULL;
+    int bundle_size = BUNDLE_SIZE;
+    int send_delay = 0;
+    int ring_slots = 0;
+    int opt;
+
+    if (worker_count < 1) {
+        worker_count = 1;
+    } else if (worker_count > SERVER_MAX_WORKERS) {
+        worker_count = SERVER_MAX_WORKERS;
+    }
 
-    if (argc > 1) {
-        port = atoi(argv[1]);
+    while ((opt = getopt(argc, argv, "u:g:w:H:brq:p:m:d:l:x:")) != -1) {
+        switch (opt) {
+            case 'u':
+                max_users = atoi(optarg);
+                break;
+            case 'g':
+                max_groups = atoi(optarg);
+                break;
+            case 'w':
+                worker_count = atoi(optarg);
+                break;
+            case 'H':
+                history_size = atoi(optarg);
+                break;
+            case 'b':
+                log_format = LOG_FORMAT_BINARY;
+                break;
+            case 'r':
+                reliable = 1;
+                break;
+            case 'q':
+                sendq_size = atoi(optarg);
+                break;
+            case 'p':
+                sendq_policy = optarg;
+                break;
+            case 'm':
+                bundle_size = atoi(optarg);
+                break;
+            case 'd':
+                send_delay = atoi(optarg);
+                break;
+            case 'l':
+                ring_slots = atoi(optarg);
+                break;
+            case 'x':
+                g_unix_path = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind < argc) {
+        port = atoi(argv[optind]);
+    }
+
+    if (max_users < 1 || max_users > CAPACITY_LIMIT ||
+        max_groups < 1 || max_groups > CAPACITY_LIMIT) {
+        fprintf(stderr, "Capacités invalides (entre 1 et %d)\n", CAPACITY_LIMIT);
+        return EXIT_FAILURE;
+    }
+
+    if (history_size < 0 || history_size > HISTORY_LIMIT) {
+        fprintf(stderr, "Taille d'historique invalide (entre 0 et %d)\n", HISTORY_LIMIT);
+        return EXIT_FAILURE;
+    }
+
+    if (worker_count < 1 || worker_count > SERVER_MAX_WORKERS) {
+        fprintf(stderr, "Nombre de workers invalide (entre 1 et %d)\n", SERVER_MAX_WORKERS);
+        return EXIT_FAILURE;
+    }
+
+    if (sendq_configure(sendq_size, sendq_policy) == -1) {
+        return EXIT_FAILURE;
+    }
+
+    // Un datagramme regroupé doit encore pouvoir recevoir l'en-tête de
+    // numérotation des envois fiables sans dépasser WIRE_MAX_SIZE
+    if (bundle_size < 0 || bundle_size > WIRE_MAX_SIZE - WIRE_SEQ_SIZE) {
+        fprintf(stderr, "Taille de datagramme invalide (entre 0 et %d)\n", WIRE_MAX_SIZE - WIRE_SEQ_SIZE);
+        return EXIT_FAILURE;
+    }
+
+    if (send_delay < 0 || send_delay > SEND_DELAY_LIMIT_MS) {
+        fprintf(stderr, "Délai d'envoi invalide (entre 0 et %d ms)\n", SEND_DELAY_LIMIT_MS);
+        return EXIT_FAILURE;
+    }
+    outbox_configure(bundle_size, send_delay);
+
+    if (ring_slots < 0 || ring_slots > RING_SLOTS_LIMIT) {
+        fprintf(stderr, "Nombre d'emplacements locaux invalide (entre 0 et %d)\n", RING_SLOTS_LIMIT);
+        return EXIT_FAILURE;
     }
 
     printf("=== SERVEUR DE MESSAGERIE ===\n");
-    printf("Port: %d\n\n", port);
+    printf("Port: %d\n", port);
+    printf("Capacités: %d utilisateurs, %d groupes, %d messages d'historique par groupe\n",
+           max_users, max_groups, history_size);
+    printf("Workers: %d\n", worker_count);
+    printf("Envois: %s, file de %d message(s) par destinataire (%s)\n",
+           reliable ? "fiables" : "sans garantie", sendq_size,
+           sendq_policy != NULL ? sendq_policy : "oldest");
+    if (bundle_size > 0) {
+        printf("Regroupement: datagrammes de %d octets au plus, envois retenus %d ms\n\n",
+               bundle_size, send_delay);
+    } else {
+        printf("Regroupement: désactivé\n\n");
+    }
 
-    // Ouvrir le fichier de log
-    g_logfile = fopen("server.log", "a");
-    if (g_logfile == NULL) {
-        perror("Erreur lors de l'ouverture du fichier de log");
+    // Bloquer SIGINT/SIGTERM/SIGUSR1 avant de créer le moindre thread (masque hérité
+    // par les threads de fond et les workers) : ils sont reçus par le thread
+    // principal via un signalfd, puis traités par cleanup_and_exit()
+    sigset_t sigmask;
+    sigemptyset(&sigmask);
+    sigaddset(&sigmask, SIGINT);
+    sigaddset(&sigmask, SIGTERM);
+    sigaddset(&sigmask, SIGUSR1);
+    if (sigprocmask(SIG_BLOCK, &sigmask, NULL) == -1) {
+        perror("Erreur sigprocmask");
+        return EXIT_FAILURE;
+    }
+
+    g_sigfd = signalfd(-1, &sigmask, SFD_CLOEXEC);
+    if (g_sigfd == -1) {
+        perror("Erreur signalfd");
+        return EXIT_FAILURE;
+    }
+
+    // Ouvrir le journal
+    const char *log_path = (log_format == LOG_FORMAT_BINARY) ? SERVER_EVENT_FILE : SERVER_LOG_FILE;
+    if (logger_start(log_path, log_format, LOG_RING_SIZE) == -1) {
         fprintf(stderr, "Le serveur continuera sans logging\n");
     } else {
-        log_event(g_logfile, "SERVER", "Démarrage du serveur");
-        printf("Fichier de log: server.log\n");
+        log_post(EVT_SERVER, -1, -1, -1, "Démarrage du serveur");
+        printf("Fichier de log: %s\n", log_path);
+    }
+
+    // Ouvrir le stockage des messages
+    if (store_open(STORE_DIR) == -1) {
+        fprintf(stderr, "Le serveur continuera sans stockage des messages\n");
+    } else {
+        printf("Stockage des messages: %s/\n", STORE_DIR);
     }
 
-    // Installer le gestionnaire de signal
-    signal(SIGINT, cleanup_and_exit);
-    signal(SIGTERM, cleanup_and_exit);
-    
     // Créer les fichiers de clés s'ils n'existent pas
     FILE *f = fopen(SHM_KEY_FILE, "w");
     if (f != NULL) {
         fclose(f);
     }
     
-    f = fopen(SEM_KEY_FILE, "w");
-    if (f != NULL) {
-        fclose(f);
-    }
-    
     // Créer la mémoire partagée
     key_t shm_key = ftok(SHM_KEY_FILE, '1');
     if (shm_key == -1) {
@@ -803,81 +1747,142 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
     
-    g_shmid = shm_create(shm_key, sizeof(SharedMemory));
+    int created;
+    g_shmid = setup_shared_memory(shm_key, max_users, max_groups, history_size, &created);
     if (g_shmid == -1) {
         return EXIT_FAILURE;
     }
-    
-    if (shm_attach(g_shmid, &g_shm) == -1) {
+
+    // Segment disparu (redémarrage de la machine, ipcrm) : repartir du
+    // dernier checkpoint et du journal
+    if (created && wal_recover(WAL_DIR, g_shm) == -1) {
+        fprintf(stderr, "Impossible de restaurer l'état depuis %s/\n", WAL_DIR);
         return EXIT_FAILURE;
     }
 
     // Vérifier si la mémoire partagée contient déjà des données
     if (g_shm->user_count == 0 && g_shm->group_count == 0) {
-        // Initialiser la mémoire partagée seulement si elle est vide
-        memset(g_shm, 0, sizeof(SharedMemory));
-        printf("Mémoire partagée initialisée (ID: %d)\n", g_shmid);
+        printf("Mémoire partagée initialisée (ID: %d, %zu octets)\n", g_shmid, g_shm->total_size);
     } else {
         // Nettoyer les utilisateurs actifs (ils doivent se reconnecter)
         for (int i = 0; i < g_shm->user_count; i++) {
-            g_shm->users[i].active = 0;
+            shm_user(g_shm, i)->active = 0;
         }
-        printf("Mémoire partagée existante réutilisée (ID: %d) - %d groupes, %d utilisateurs\n",
+        memset(shm_subscribers(g_shm), 0, g_shm->member_words * sizeof(uint64_t));
+        g_shm->user_generation++;
+        user_index_rebuild(g_shm);
+        group_index_rebuild(g_shm);
+        printf("Mémoire partagée %s (ID: %d) - %d groupes, %d utilisateurs\n",
+               created ? "restaurée" : "existante réutilisée",
                g_shmid, g_shm->group_count, g_shm->user_count);
     }
     
-    // Créer le sémaphore
-    key_t sem_key = ftok(SEM_KEY_FILE, '1');
-    if (sem_key == -1) {
-        perror("Erreur ftok pour SEM");
+    // Initialiser le verrou du segment
+    if (shm_lock_init(g_shm) == -1) {
         return EXIT_FAILURE;
     }
-    
-    g_semid = sem_create(sem_key);
-    if (g_semid == -1) {
-        return EXIT_FAILURE;
+
+    if (logger_format() == LOG_FORMAT_BINARY) {
+        log_names(g_shm);
     }
-    
-    if (sem_init(g_semid, 1) == -1) {
-        return EXIT_FAILURE;
+
+    // Checkpoint de l'état de départ, puis journal des modifications
+    if (wal_start(WAL_DIR, g_shm) == -1) {
+        fprintf(stderr, "Le serveur continuera sans journal des modifications\n");
+    } else {
+        printf("Journal des modifications: %s/\n", WAL_DIR);
     }
-    printf("Sémaphore initialisé (ID: %d)\n", g_semid);
-    
-    // Créer et configurer le socket
-    g_sockfd = socket_create_udp();
-    if (g_sockfd == -1) {
+
+    g_stopfd = eventfd(0, EFD_CLOEXEC);
+    if (g_stopfd == -1) {
+        perror("Erreur eventfd");
         return EXIT_FAILURE;
     }
-    
-    if (socket_bind_udp(g_sockfd, port) == -1) {
+
+    // Clients locaux : anneaux dans un second segment, servis par le worker 0
+    if (ring_slots > 0) {
+        key_t ring_key = ftok(SHM_KEY_FILE, '2');
+        if (ring_key == -1) {
+            perror("Erreur ftok pour les anneaux");
+            return EXIT_FAILURE;
+        }
+        g_ringfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (g_ringfd == -1) {
+            perror("Erreur eventfd");
+            return EXIT_FAILURE;
+        }
+        if (ring_start(ring_key, ring_slots, g_ringfd) == -1) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Clients locaux : socket AF_UNIX, lu par le worker 0
+    if (g_unix_path != NULL) {
+        g_unixfd = socket_bind_unix(g_unix_path);
+        if (g_unixfd == -1) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Créer les sockets de tous les workers avant de démarrer leurs threads
+    g_workers = calloc(worker_count, sizeof(Worker));
+    if (g_workers == NULL) {
+        perror("Erreur calloc");
         return EXIT_FAILURE;
     }
-    
-    // Configurer le socket en mode non-bloquant
-    int flags = fcntl(g_sockfd, F_GETFL, 0);
-    fcntl(g_sockfd, F_SETFL, flags | O_NONBLOCK);
+    for (int i = 0; i < worker_count; i++) {
+        if (worker_setup(&g_workers[i], i, port) == -1) {
+            return EXIT_FAILURE;
+        }
+        g_worker_count++;
+    }
 
-    printf("\nServeur en écoute...\n\n");
+    // Les retransmissions partent du socket du premier worker : tous sont
+    // liés au même port, le client les reçoit de la même adresse
+    if (reliable && reliable_start(g_workers[0].sockfd) == -1) {
+        return EXIT_FAILURE;
+    }
 
     char log_buffer[256];
-    snprintf(log_buffer, sizeof(log_buffer), "Serveur en écoute sur le port %d", port);
-    log_event(g_logfile, "SERVER", log_buffer);
+    snprintf(log_buffer, sizeof(log_buffer), "Serveur en écoute sur le port %d (%d workers)",
+             port, worker_count);
+    log_post(EVT_SERVER, -1, -1, -1, log_buffer);
+
+    for (int i = 0; i < worker_count; i++) {
+        int err = pthread_create(&g_workers[i].thread, NULL, worker_run, &g_workers[i]);
+        if (err != 0) {
+            fprintf(stderr, "Erreur pthread_create: %s\n", strerror(err));
+            return EXIT_FAILURE;
+        }
+        g_workers[i].started = 1;
+    }
 
-    // Boucle principale
-    Message msg;
-    struct sockaddr_in client_addr;
-    
+    printf("\nServeur en écoute...\n\n");
+
+    // Le thread principal attend SIGINT/SIGTERM, et SIGUSR1 pour afficher
+    // l'état des files d'envoi et des anneaux locaux
+    struct signalfd_siginfo si;
     while (1) {
-        ssize_t n = socket_receive(g_sockfd, &msg, &client_addr);
-        
-        if (n > 0) {
-            handle_client_message(g_sockfd, g_shm, g_semid, &msg, &client_addr);
+        ssize_t n = read(g_sigfd, &si, sizeof(si));
+        if (n == sizeof(si) && si.ssi_signo == SIGUSR1) {
+            printf("=== FILES D'ENVOI ===\n");
+            for (int i = 0; i < g_worker_count; i++) {
+                sendq_dump(&g_workers[i].queues, g_workers[i].id, stdout);
+            }
+            if (ring_enabled()) {
+                printf("=== ANNEAUX LOCAUX ===\n");
+                ring_dump(stdout);
+            }
+            fflush(stdout);
+        } else if (n == sizeof(si)) {
+            cleanup_and_exit((int)si.ssi_signo);
+        }
+        if (n == -1 && errno != EINTR) {
+            perror("Erreur read signalfd");
+            break;
         }
-        
-        // Petite pause pour éviter une utilisation CPU excessive
-        usleep(10000); // 10 ms
     }
-    
+
     cleanup_and_exit(0);
     return 0;
 }
@@ -0,0 +1,506 @@
+#include "messaging.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// ========== Stockage des messages ==========
+
+// Les messages publics et privés sont ajoutés à la suite dans des segments
+// projetés en mémoire (STORE_DIR/00000000.seg, ...) : un ajout est une
+// copie en mémoire, sans appel système hors changement de segment. Les
+// requêtes lisent directement les segments projetés.
+//
+// Chaque canal garde en mémoire son premier et son dernier message et un
+// index clairsemé (un point tous les STORE_INDEX_INTERVAL messages) des
+// heures d'arrivée. /history remonte la chaîne depuis la fin, /since
+// cherche le point d'index puis avance d'au plus STORE_INDEX_INTERVAL
+// messages. L'index est reconstruit au démarrage en relisant les segments.
+//
+// Le verrou ne couvre que la réservation : place du prochain enregistrement,
+// en-tête de chaînage (prev, next, heure) et rattachement en fin de canal.
+// Le contenu est copié après, hors du verrou, et l'enregistrement n'est
+// valide qu'une fois son magic publié ; il ne change plus ensuite. Les
+// requêtes parcourent les chaînes sans le verrou : elles sautent les
+// enregistrements réservés dont le magic n'est pas encore publié. Seule la
+// recherche dans l'index de /since le prend, le temps de la dichotomie.
+
+#define STORE_CHANNEL_BUCKETS 1024
+
+typedef struct {
+    int64_t timestamp;
+    uint64_t offset;
+} StoreIndexEntry;
+
+typedef struct StoreChannel {
+    int type;                      // MSG_PUBLIC (groupe) ou MSG_PRIVATE (destinataire)
+    char name[MAX_USERNAME];
+    uint64_t first;
+    uint64_t last;
+    uint64_t count;
+    int64_t last_timestamp;
+    StoreIndexEntry *index;
+    int index_count;
+    int index_capacity;
+    struct StoreChannel *next;     // Chaînage dans la table
+} StoreChannel;
+
+#define STORE_RETIRED_MAX 32
+
+static struct {
+    char dir[256];
+    unsigned char **segments;      // Segments projetés, dans l'ordre
+    int segment_count;
+    int segment_capacity;
+    // Tables de segments remplacées en grandissant : des requêtes peuvent
+    // encore les lire, elles ne sont libérées qu'à la fermeture
+    unsigned char **retired[STORE_RETIRED_MAX];
+    int retired_count;
+    uint64_t write_offset;         // Emplacement du prochain enregistrement
+    StoreChannel *channels[STORE_CHANNEL_BUCKETS];
+    pthread_mutex_t lock;          // Ajouts et requêtes des workers
+    int open;
+} g_store = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static size_t record_size(size_t data_len) {
+    return (sizeof(StoreRecord) + data_len + 7) & ~(size_t)7;
+}
+
+static StoreRecord *record_at(uint64_t offset) {
+    unsigned char **segments = __atomic_load_n(&g_store.segments, __ATOMIC_ACQUIRE);
+    return (StoreRecord *)(segments[offset / STORE_SEGMENT_SIZE] + offset % STORE_SEGMENT_SIZE);
+}
+
+static int record_valid(const StoreRecord *rec) {
+    return __atomic_load_n(&rec->magic, __ATOMIC_ACQUIRE) == STORE_RECORD_MAGIC;
+}
+
+// Projette le segment numéro idx, créé et préalloué s'il n'existe pas.
+// Ne modifie pas g_store : appelé sans le verrou lors d'un changement de
+// segment, pour que la préallocation et le mmap ne bloquent pas les autres
+// workers. Retourne NULL en cas d'erreur.
+static unsigned char *segment_open(int idx) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%08d.seg", g_store.dir, idx);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        perror(path);
+        return NULL;
+    }
+
+    // Réserver les blocs d'avance : les ajouts ne font que des copies
+    struct stat st;
+    if (fstat(fd, &st) == -1 ||
+        (st.st_size < STORE_SEGMENT_SIZE &&
+         posix_fallocate(fd, 0, STORE_SEGMENT_SIZE) != 0 &&
+         ftruncate(fd, STORE_SEGMENT_SIZE) == -1)) {
+        perror("Erreur préallocation du segment");
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, STORE_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("Erreur mmap");
+        return NULL;
+    }
+    return base;
+}
+
+// Range le segment projeté base à la suite des autres (idx doit valoir
+// segment_count). Une table trop petite est recopiée dans une plus grande,
+// publiée pour les requêtes en cours sans les interrompre.
+static int segment_install(int idx, unsigned char *base) {
+    if (idx >= g_store.segment_capacity) {
+        if (g_store.retired_count == STORE_RETIRED_MAX) {
+            fprintf(stderr, "Trop de segments de stockage\n");
+            return -1;
+        }
+        int capacity = g_store.segment_capacity > 0 ? g_store.segment_capacity * 2 : 16;
+        unsigned char **grown = malloc(capacity * sizeof(unsigned char *));
+        if (grown == NULL) {
+            perror("Erreur malloc");
+            return -1;
+        }
+        if (g_store.segments != NULL) {
+            memcpy(grown, g_store.segments, g_store.segment_count * sizeof(unsigned char *));
+            g_store.retired[g_store.retired_count++] = g_store.segments;
+        }
+        __atomic_store_n(&g_store.segments, grown, __ATOMIC_RELEASE);
+        g_store.segment_capacity = capacity;
+    }
+
+    g_store.segments[idx] = base;
+    g_store.segment_count = idx + 1;
+    return 0;
+}
+
+static int segment_map(int idx) {
+    unsigned char *base = segment_open(idx);
+    if (base == NULL) {
+        return -1;
+    }
+    if (segment_install(idx, base) == -1) {
+        munmap(base, STORE_SEGMENT_SIZE);
+        return -1;
+    }
+    return 0;
+}
+
+static StoreChannel *channel_find(int type, const char *name, int create) {
+    unsigned int bucket = (hash_string(name) + (unsigned int)type) % STORE_CHANNEL_BUCKETS;
+
+    for (StoreChannel *ch = __atomic_load_n(&g_store.channels[bucket], __ATOMIC_ACQUIRE);
+         ch != NULL; ch = ch->next) {
+        if (ch->type == type && strcmp(ch->name, name) == 0) {
+            return ch;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    StoreChannel *ch = calloc(1, sizeof(StoreChannel));
+    if (ch == NULL) {
+        perror("Erreur calloc");
+        return NULL;
+    }
+    ch->type = type;
+    strncpy(ch->name, name, sizeof(ch->name) - 1);
+    ch->first = STORE_NONE;
+    ch->last = STORE_NONE;
+    ch->next = g_store.channels[bucket];
+    __atomic_store_n(&g_store.channels[bucket], ch, __ATOMIC_RELEASE);
+    return ch;
+}
+
+// Canal d'un message : son groupe, ou son destinataire pour un privé
+static StoreChannel *channel_of(uint8_t type, const char *recipient, size_t recipient_len,
+                                const char *group, size_t group_len) {
+    char name[MAX_USERNAME];
+
+    if (type == MSG_PRIVATE) {
+        snprintf(name, sizeof(name), "%.*s", (int)recipient_len, recipient);
+    } else {
+        snprintf(name, sizeof(name), "%.*s", (int)group_len, group);
+    }
+    return channel_find(type, name, 1);
+}
+
+// Rattache l'enregistrement à offset en fin de son canal ; son en-tête
+// (prev, next, heure) doit être écrit. Les requêtes suivent next et last
+// sans verrou : les publier en dernier.
+static void channel_link(StoreChannel *ch, uint64_t offset) {
+    StoreRecord *rec = record_at(offset);
+
+    if (ch->last != STORE_NONE) {
+        __atomic_store_n(&record_at(ch->last)->next, offset, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&ch->first, offset, __ATOMIC_RELEASE);
+    }
+
+    if (ch->count % STORE_INDEX_INTERVAL == 0) {
+        if (ch->index_count == ch->index_capacity) {
+            int capacity = ch->index_capacity > 0 ? ch->index_capacity * 2 : 16;
+            StoreIndexEntry *grown = realloc(ch->index, capacity * sizeof(StoreIndexEntry));
+            if (grown == NULL) {
+                perror("Erreur realloc");
+                return;
+            }
+            ch->index = grown;
+            ch->index_capacity = capacity;
+        }
+        ch->index[ch->index_count].timestamp = rec->timestamp;
+        ch->index[ch->index_count].offset = offset;
+        ch->index_count++;
+    }
+
+    __atomic_store_n(&ch->last, offset, __ATOMIC_RELEASE);
+    ch->last_timestamp = rec->timestamp;
+    ch->count++;
+}
+
+// Relit un segment existant : reconstruit les canaux et retourne la
+// position de fin des données
+static uint64_t segment_scan(int idx) {
+    uint64_t base = (uint64_t)idx * STORE_SEGMENT_SIZE;
+    uint64_t pos = 0;
+
+    while (pos + sizeof(StoreRecord) <= STORE_SEGMENT_SIZE) {
+        StoreRecord *rec = record_at(base + pos);
+        size_t data_len = (size_t)rec->sender_len + rec->recipient_len +
+                          rec->group_len + rec->content_len;
+
+        if (rec->magic != STORE_RECORD_MAGIC || rec->size != record_size(data_len) ||
+            pos + rec->size > STORE_SEGMENT_SIZE) {
+            break;
+        }
+
+        const char *recipient = rec->data + rec->sender_len;
+        const char *group = recipient + rec->recipient_len;
+
+        // Un arrêt brutal a pu laisser prev/next en retard sur les ajouts
+        StoreChannel *ch = channel_of(rec->type, recipient, rec->recipient_len,
+                                      group, rec->group_len);
+        if (ch != NULL) {
+            rec->prev = ch->last;
+            rec->next = STORE_NONE;
+            channel_link(ch, base + pos);
+        }
+        pos += rec->size;
+    }
+    return pos;
+}
+
+int store_open(const char *dir) {
+    strncpy(g_store.dir, dir, sizeof(g_store.dir) - 1);
+
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        perror(dir);
+        return -1;
+    }
+
+    // Segments existants : 00000000.seg, 00000001.seg, ... sans trou
+    uint64_t end = 0;
+    for (int idx = 0; ; idx++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%08d.seg", dir, idx);
+        if (access(path, F_OK) == -1) {
+            break;
+        }
+        if (segment_map(idx) == -1) {
+            return -1;
+        }
+        end = (uint64_t)idx * STORE_SEGMENT_SIZE + segment_scan(idx);
+    }
+
+    if (g_store.segment_count == 0 && segment_map(0) == -1) {
+        return -1;
+    }
+
+    g_store.write_offset = end;
+    g_store.open = 1;
+    return 0;
+}
+
+int store_append(const Message *msg) {
+    if (!g_store.open) {
+        return -1;
+    }
+
+    size_t sender_len = strnlen(msg->sender, MAX_USERNAME - 1);
+    size_t recipient_len = strnlen(msg->recipient, MAX_USERNAME - 1);
+    size_t group_len = strnlen(msg->group, MAX_GROUP_NAME - 1);
+    size_t content_len = strnlen(msg->content, MAX_MESSAGE - 1);
+    size_t size = record_size(sender_len + recipient_len + group_len + content_len);
+
+    pthread_mutex_lock(&g_store.lock);
+
+    StoreChannel *ch = channel_of((uint8_t)msg->type, msg->recipient, recipient_len,
+                                  msg->group, group_len);
+    if (ch == NULL) {
+        pthread_mutex_unlock(&g_store.lock);
+        return -1;
+    }
+
+    // Passer au segment suivant si l'enregistrement ne tient pas. Le
+    // segment est créé et projeté hors du verrou puis installé ; si un autre
+    // worker l'a installé entre-temps, garder le sien. D'autres ajouts ont
+    // pu avoir lieu pendant ce temps : reprendre depuis write_offset.
+    uint64_t offset = g_store.write_offset;
+    while (offset % STORE_SEGMENT_SIZE + size > STORE_SEGMENT_SIZE) {
+        int idx = (int)(offset / STORE_SEGMENT_SIZE) + 1;
+        if (idx < g_store.segment_count) {
+            offset = (uint64_t)idx * STORE_SEGMENT_SIZE;
+            break;
+        }
+
+        pthread_mutex_unlock(&g_store.lock);
+        unsigned char *base = segment_open(idx);
+        pthread_mutex_lock(&g_store.lock);
+
+        if (base == NULL) {
+            pthread_mutex_unlock(&g_store.lock);
+            return -1;
+        }
+        if (idx < g_store.segment_count) {
+            munmap(base, STORE_SEGMENT_SIZE);
+        } else if (segment_install(idx, base) == -1) {
+            munmap(base, STORE_SEGMENT_SIZE);
+            pthread_mutex_unlock(&g_store.lock);
+            return -1;
+        }
+        offset = g_store.write_offset;
+    }
+
+    // Heures croissantes dans un canal : l'index reste trié
+    int64_t now = (int64_t)time(NULL);
+    if (now < ch->last_timestamp) {
+        now = ch->last_timestamp;
+    }
+
+    // Réserver la place : la case peut contenir un enregistrement laissé par
+    // un arrêt brutal, l'invalider avant de la rendre atteignable
+    StoreRecord *rec = record_at(offset);
+    __atomic_store_n(&rec->magic, 0, __ATOMIC_RELAXED);
+    rec->size = (uint32_t)size;
+    rec->timestamp = now;
+    rec->prev = ch->last;
+    rec->next = STORE_NONE;
+    channel_link(ch, offset);
+    g_store.write_offset = offset + size;
+
+    pthread_mutex_unlock(&g_store.lock);
+
+    rec->type = (uint8_t)msg->type;
+    rec->sender_len = (uint8_t)sender_len;
+    rec->recipient_len = (uint8_t)recipient_len;
+    rec->group_len = (uint8_t)group_len;
+    rec->content_len = (uint16_t)content_len;
+    rec->reserved = 0;
+
+    char *p = rec->data;
+    memcpy(p, msg->sender, sender_len);
+    p += sender_len;
+    memcpy(p, msg->recipient, recipient_len);
+    p += recipient_len;
+    memcpy(p, msg->group, group_len);
+    p += group_len;
+    memcpy(p, msg->content, content_len);
+
+    // L'enregistrement n'est valide qu'une fois complet
+    __atomic_store_n(&rec->magic, STORE_RECORD_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Ajoute à l'outbox l'envoi de l'enregistrement au demandeur
+static int store_emit(Outbox *ob, const StoreRecord *rec,
+                      const char *username, const struct sockaddr_in *addr) {
+    Message msg;
+    const char *p = rec->data;
+
+    msg.type = (MessageType)rec->type;
+    msg.timestamp = (time_t)rec->timestamp;
+    snprintf(msg.sender, sizeof(msg.sender), "%.*s", rec->sender_len, p);
+    p += rec->sender_len;
+    snprintf(msg.recipient, sizeof(msg.recipient), "%.*s", rec->recipient_len, p);
+    p += rec->recipient_len;
+    snprintf(msg.group, sizeof(msg.group), "%.*s", rec->group_len, p);
+    p += rec->group_len;
+    snprintf(msg.content, sizeof(msg.content), "%.*s", rec->content_len, p);
+
+    return outbox_send(ob, &msg, username, addr);
+}
+
+// Envoie au plus STORE_QUERY_MAX messages du canal à partir de offset, en
+// sautant ceux dont la copie n'est pas terminée
+static int store_emit_from(Outbox *ob, uint64_t offset, int count,
+                           const char *username, const struct sockaddr_in *addr) {
+    int sent = 0;
+
+    if (count > STORE_QUERY_MAX) {
+        count = STORE_QUERY_MAX;
+    }
+    while (offset != STORE_NONE && sent < count) {
+        const StoreRecord *rec = record_at(offset);
+        if (record_valid(rec) && store_emit(ob, rec, username, addr) == 0) {
+            sent++;
+        }
+        offset = __atomic_load_n(&rec->next, __ATOMIC_ACQUIRE);
+    }
+    return sent;
+}
+
+// Les count derniers messages du canal (type MSG_PUBLIC : groupe channel,
+// MSG_PRIVATE : messages reçus par channel), du plus ancien au plus récent
+int store_history(Outbox *ob, MessageType type, const char *channel, int count,
+                  const char *username, const struct sockaddr_in *addr) {
+    if (!g_store.open || count <= 0) {
+        return 0;
+    }
+    if (count > STORE_QUERY_MAX) {
+        count = STORE_QUERY_MAX;
+    }
+
+    // prev est écrit avant que l'enregistrement soit rattaché et ne change
+    // plus : remonter la chaîne sans verrou
+    int sent = 0;
+    StoreChannel *ch = channel_find(type, channel, 0);
+    uint64_t offset = (ch != NULL) ? __atomic_load_n(&ch->last, __ATOMIC_ACQUIRE) : STORE_NONE;
+    if (offset != STORE_NONE) {
+        for (int i = 1; i < count && record_at(offset)->prev != STORE_NONE; i++) {
+            offset = record_at(offset)->prev;
+        }
+        sent = store_emit_from(ob, offset, count, username, addr);
+    }
+    return sent;
+}
+
+// Les premiers messages du canal arrivés à partir de since
+int store_since(Outbox *ob, MessageType type, const char *channel, time_t since,
+                const char *username, const struct sockaddr_in *addr) {
+    if (!g_store.open) {
+        return 0;
+    }
+
+    // Le verrou protège l'index, agrandi par les ajouts ; le parcours et
+    // l'envoi se font sans lui
+    uint64_t offset = STORE_NONE;
+    pthread_mutex_lock(&g_store.lock);
+    StoreChannel *ch = channel_find(type, channel, 0);
+    if (ch != NULL && ch->index_count > 0) {
+        // Dernier point d'index antérieur à since, puis avancer
+        int lo = 0;
+        int hi = ch->index_count;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (ch->index[mid].timestamp < (int64_t)since) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        offset = (lo > 0) ? ch->index[lo - 1].offset : ch->first;
+    }
+    pthread_mutex_unlock(&g_store.lock);
+
+    while (offset != STORE_NONE && record_at(offset)->timestamp < (int64_t)since) {
+        offset = __atomic_load_n(&record_at(offset)->next, __ATOMIC_ACQUIRE);
+    }
+    return store_emit_from(ob, offset, STORE_QUERY_MAX, username, addr);
+}
+
+void store_close(void) {
+    if (!g_store.open) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_store.lock);
+    for (int i = 0; i < g_store.segment_count; i++) {
+        msync(g_store.segments[i], STORE_SEGMENT_SIZE, MS_SYNC);
+        munmap(g_store.segments[i], STORE_SEGMENT_SIZE);
+    }
+    free(g_store.segments);
+    g_store.segments = NULL;
+    for (int i = 0; i < g_store.retired_count; i++) {
+        free(g_store.retired[i]);
+    }
+    g_store.retired_count = 0;
+    g_store.segment_count = 0;
+    g_store.segment_capacity = 0;
+
+    for (int i = 0; i < STORE_CHANNEL_BUCKETS; i++) {
+        StoreChannel *ch = g_store.channels[i];
+        while (ch != NULL) {
+            StoreChannel *next = ch->next;
+            free(ch->index);
+            free(ch);
+            ch = next;
+        }
+        g_store.channels[i] = NULL;
+    }
+    g_store.open = 0;
+    pthread_mutex_unlock(&g_store.lock);
+}
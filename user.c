@@ -1,59 +1,107 @@
 #include "messaging.h"
 
+// ========== Index haché des utilisateurs ==========
+
+// Retourne l'emplacement de l'utilisateur (actif ou non) ou -1
+static int user_index_lookup(SharedMemory *shm, const char *username) {
+    int *index = shm_user_index(shm);
+    unsigned int mask = shm->user_hash_size - 1;
+    unsigned int pos = hash_string(username) & mask;
+
+    for (int probe = 0; probe < shm->user_hash_size; probe++) {
+        int slot = index[pos];
+        if (slot == 0) {
+            return -1;
+        }
+        if (slot - 1 < shm->user_count &&
+            strcmp(shm_user(shm, slot - 1)->username, username) == 0) {
+            return slot - 1;
+        }
+        pos = (pos + 1) & mask;
+    }
+    return -1;
+}
+
+static void user_index_insert(SharedMemory *shm, int idx) {
+    int *index = shm_user_index(shm);
+    unsigned int mask = shm->user_hash_size - 1;
+    unsigned int pos = hash_string(shm_user(shm, idx)->username) & mask;
+
+    while (index[pos] != 0) {
+        pos = (pos + 1) & mask;
+    }
+    index[pos] = idx + 1;
+}
+
+void user_index_rebuild(SharedMemory *shm) {
+    memset(shm_user_index(shm), 0, shm->user_hash_size * sizeof(int));
+    for (int i = 0; i < shm->user_count; i++) {
+        user_index_insert(shm, i);
+    }
+}
+
 // ========== Gestion des utilisateurs ==========
 
 int user_add(SharedMemory *shm, const char *username, struct sockaddr_in *addr, int port) {
     // Vérifier si l'utilisateur existe déjà
-    for (int i = 0; i < shm->user_count; i++) {
-        if (strcmp(shm->users[i].username, username) == 0) {
-            if (shm->users[i].active) {
-                fprintf(stderr, "Utilisateur %s existe déjà\n", username);
-                return -1;
-            } else {
-                // Réactiver l'utilisateur
-                shm->users[i].active = 1;
-                shm->users[i].addr = *addr;
-                shm->users[i].port = port;
-                shm->users[i].last_activity = time(NULL);
-                strcpy(shm->users[i].color, COLOR_GREEN);
-                return i;
-            }
+    int i = user_index_lookup(shm, username);
+    if (i >= 0) {
+        User *user = shm_user(shm, i);
+        if (user->active) {
+            fprintf(stderr, "Utilisateur %s existe déjà\n", username);
+            return -1;
+        } else {
+            // Réactiver l'utilisateur
+            user->active = 1;
+            user->addr = *addr;
+            user->port = port;
+            user->last_activity = time(NULL);
+            strcpy(user->color, COLOR_GREEN);
+            // Nouvelle session : l'abonnement à l'annuaire est à refaire
+            bitset_clear(shm_subscribers(shm), i);
+            shm->user_generation++;
+            return i;
         }
     }
     
     // Ajouter un nouvel utilisateur
-    if (shm->user_count >= MAX_CLIENTS) {
+    if (shm->user_count >= shm->max_users) {
         fprintf(stderr, "Nombre maximum d'utilisateurs atteint\n");
         return -1;
     }
     
     int idx = shm->user_count;
-    strncpy(shm->users[idx].username, username, MAX_USERNAME - 1);
-    shm->users[idx].username[MAX_USERNAME - 1] = '\0';
-    shm->users[idx].addr = *addr;
-    shm->users[idx].port = port;
-    shm->users[idx].active = 1;
-    shm->users[idx].current_group[0] = '\0';
-    strcpy(shm->users[idx].color, COLOR_GREEN);
-    shm->users[idx].last_activity = time(NULL);
+    User *user = shm_user(shm, idx);
+    strncpy(user->username, username, MAX_USERNAME - 1);
+    user->username[MAX_USERNAME - 1] = '\0';
+    user->addr = *addr;
+    user->port = port;
+    user->active = 1;
+    user->current_group[0] = '\0';
+    strcpy(user->color, COLOR_GREEN);
+    user->last_activity = time(NULL);
     shm->user_count++;
-    
-    printf("Utilisateur %s ajouté (index %d)\n", username, idx);
+    user_index_insert(shm, idx);
+    shm->user_generation++;
     return idx;
 }
 
 int user_remove(SharedMemory *shm, const char *username) {
-    for (int i = 0; i < shm->user_count; i++) {
-        if (strcmp(shm->users[i].username, username) == 0) {
-            // Retirer l'utilisateur de tous les groupes
-            for (int j = 0; j < shm->group_count; j++) {
-                group_remove_user(shm, shm->groups[j].name, username);
+    int i = user_index_lookup(shm, username);
+    if (i >= 0) {
+        // Retirer l'utilisateur de tous les groupes actifs
+        for (int j = 0; j < shm->group_count; j++) {
+            Group *group = shm_group(shm, j);
+            if (group->active) {
+                group_remove_member(shm, group, username);
             }
-            
-            shm->users[i].active = 0;
-            printf("Utilisateur %s désactivé\n", username);
-            return 0;
         }
+
+        // L'emplacement reste indexé sous ce nom : une reconnexion le réactive
+        shm_user(shm, i)->active = 0;
+        bitset_clear(shm_subscribers(shm), i);
+        shm->user_generation++;
+        return 0;
     }
     
     fprintf(stderr, "Utilisateur %s non trouvé\n", username);
@@ -61,14 +109,30 @@ int user_remove(SharedMemory *shm, const char *username) {
 }
 
 User* user_find(SharedMemory *shm, const char *username) {
-    for (int i = 0; i < shm->user_count; i++) {
-        if (shm->users[i].active && strcmp(shm->users[i].username, username) == 0) {
-            return &shm->users[i];
-        }
+    int i = user_index_lookup(shm, username);
+    if (i >= 0 && shm_user(shm, i)->active) {
+        return shm_user(shm, i);
     }
     return NULL;
 }
 
+// Identifiant stable de l'utilisateur (son emplacement), actif ou non, ou -1
+int user_get_id(SharedMemory *shm, const char *username) {
+    return user_index_lookup(shm, username);
+}
+
+// Copie l'adresse d'un utilisateur actif, dans une section de lecture
+int user_snapshot(SharedMemory *shm, const char *username, Recipient *out) {
+    User *user = user_find(shm, username);
+    if (user == NULL) {
+        return -1;
+    }
+    memcpy(out->username, user->username, MAX_USERNAME);
+    out->username[MAX_USERNAME - 1] = '\0';
+    out->addr = user->addr;
+    return 0;
+}
+
 int user_set_color(SharedMemory *shm, const char *username, const char *color) {
     User *user = user_find(shm, username);
     if (user == NULL) {
@@ -78,7 +142,5 @@ int user_set_color(SharedMemory *shm, const char *username, const char *color) {
     
     strncpy(user->color, color, sizeof(user->color) - 1);
     user->color[sizeof(user->color) - 1] = '\0';
-    
-    printf("Couleur de %s changée\n", username);
     return 0;
 }
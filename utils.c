@@ -11,53 +11,93 @@ void display_prompt(const char *username, const char *group, const char *color)
     fflush(stdout);
 }
 
-void display_users(SharedMemory *shm) {
-    printf("\n=== UTILISATEURS CONNECTÉS ===\n");
+// Les affichages lisent la mémoire partagée sans verrou : le texte est
+// d'abord construit en mémoire, reconstruit si un écrivain est passé
+// entre-temps, puis affiché d'un seul bloc.
+static void display_snapshot(SharedMemory *shm, void (*render)(SharedMemory *, FILE *)) {
+    char *text = NULL;
+    size_t len = 0;
+    uint32_t seq;
+
+    do {
+        free(text);
+        text = NULL;
+        FILE *out = open_memstream(&text, &len);
+        if (out == NULL) {
+            perror("Erreur open_memstream");
+            return;
+        }
+        seq = shm_read_begin(shm);
+        render(shm, out);
+        fclose(out);
+    } while (shm_read_retry(shm, seq));
+
+    fputs(text, stdout);
+    free(text);
+}
+
+static void render_users(SharedMemory *shm, FILE *out) {
+    fprintf(out, "\n=== UTILISATEURS CONNECTÉS ===\n");
     int count = 0;
-    
-    for (int i = 0; i < shm->user_count; i++) {
-        if (shm->users[i].active) {
-            printf("  %s%s%s", 
-                   shm->users[i].color, 
-                   shm->users[i].username, 
-                   COLOR_RESET);
-            
-            if (strlen(shm->users[i].current_group) > 0) {
-                printf(" (groupe: %s)", shm->users[i].current_group);
+    int user_count = shm->user_count;
+
+    for (int i = 0; i < user_count && i < shm->max_users; i++) {
+        User *user = shm_user(shm, i);
+        if (user->active) {
+            fprintf(out, "  %.15s%.*s%s",
+                    user->color,
+                    MAX_USERNAME - 1, user->username,
+                    COLOR_RESET);
+
+            if (user->current_group[0] != '\0') {
+                fprintf(out, " (groupe: %.*s)", MAX_GROUP_NAME - 1, user->current_group);
             }
-            printf("\n");
+            fprintf(out, "\n");
             count++;
         }
     }
-    
-    printf("Total: %d utilisateur(s)\n\n", count);
+
+    fprintf(out, "Total: %d utilisateur(s)\n\n", count);
 }
 
-void display_groups(SharedMemory *shm) {
-    printf("\n=== GROUPES DISPONIBLES ===\n");
+static void render_groups(SharedMemory *shm, FILE *out) {
+    fprintf(out, "\n=== GROUPES DISPONIBLES ===\n");
     int count = 0;
-    
-    for (int i = 0; i < shm->group_count; i++) {
-        if (shm->groups[i].active) {
-            printf("  %s (%d membre(s))\n", 
-                   shm->groups[i].name, 
-                   shm->groups[i].user_count);
-            
-            if (shm->groups[i].user_count > 0) {
-                printf("    Membres: ");
-                for (int j = 0; j < shm->groups[i].user_count; j++) {
-                    printf("%s", shm->groups[i].users[j]);
-                    if (j < shm->groups[i].user_count - 1) {
-                        printf(", ");
+    int words = shm->member_words;
+    int group_count = shm->group_count;
+
+    for (int i = 0; i < group_count && i < shm->max_groups; i++) {
+        Group *group = shm_group(shm, i);
+        if (group->active) {
+            fprintf(out, "  %.*s (%d membre(s))\n",
+                    MAX_GROUP_NAME - 1, group->name,
+                    group->user_count);
+
+            if (group->user_count > 0) {
+                fprintf(out, "    Membres: ");
+                const uint64_t *members = group_members(shm, group);
+                for (int id = bitset_next(members, words, 0); id >= 0 && id < shm->max_users;
+                     id = bitset_next(members, words, id + 1)) {
+                    fprintf(out, "%.*s", MAX_USERNAME - 1, shm_user(shm, id)->username);
+                    if (bitset_next(members, words, id + 1) >= 0) {
+                        fprintf(out, ", ");
                     }
                 }
-                printf("\n");
+                fprintf(out, "\n");
             }
             count++;
         }
     }
-    
-    printf("Total: %d groupe(s)\n\n", count);
+
+    fprintf(out, "Total: %d groupe(s)\n\n", count);
+}
+
+void display_users(SharedMemory *shm) {
+    display_snapshot(shm, render_users);
+}
+
+void display_groups(SharedMemory *shm) {
+    display_snapshot(shm, render_groups);
 }
 
 const char* get_timestamp_str(time_t timestamp) {
@@ -76,11 +116,23 @@ void log_event(FILE *logfile, const char *event_type, const char *details) {
         return;
     }
 
+    // localtime_r : log_event est appelé par plusieurs workers à la fois
     time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
+    struct tm tm_info;
+    localtime_r(&now, &tm_info);
     char timestamp[64];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
 
     fprintf(logfile, "[%s] [%s] %s\n", timestamp, event_type, details);
     fflush(logfile);
 }
+
+// Hachage FNV-1a d'une chaîne, utilisé par les index de la mémoire partagée
+unsigned int hash_string(const char *str) {
+    unsigned int hash = 2166136261u;
+    while (*str != '\0') {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
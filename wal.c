@@ -0,0 +1,563 @@
+#include "messaging.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// ========== Journal des modifications ==========
+
+// Chaque modification réussie de la mémoire partagée est ajoutée, sous le
+// verrou du segment et donc dans l'ordre où elle a été appliquée, à un
+// tampon en mémoire. Un thread de fond l'écrit et le synchronise
+// (fdatasync) toutes les WAL_SYNC_INTERVAL_MS : un seul appel pour toutes
+// les opérations de l'intervalle, au prix de leur perte en cas de panne.
+//
+// Le même thread écrit périodiquement un checkpoint : une copie du segment
+// prise comme une lecture (seqlock) puis écrite dans checkpoint.tmp,
+// synchronisée et renommée. Chaque checkpoint ouvre une nouvelle
+// génération de journal ; les journaux des générations précédentes sont
+// supprimés une fois le checkpoint en place.
+//
+// Au démarrage, si le segment a disparu (redémarrage de la machine, ipcrm),
+// le dernier checkpoint est rechargé par shm_migrate puis les journaux sont
+// rejoués par les fonctions user_* / group_* elles-mêmes. Un segment
+// existant est au moins aussi récent que le journal : il sert de point de
+// départ à un nouveau checkpoint.
+
+#define WAL_MAX_FIELDS 2
+#define WAL_RECORD_MAX (sizeof(WalRecord) + WAL_MAX_FIELDS * (1 + 255))
+
+static struct {
+    char dir[256];
+    SharedMemory *shm;
+    uint64_t generation;     // Génération du journal ouvert
+    int fd;
+    char *pending;           // Opérations pas encore écrites (sous lock)
+    size_t pending_len;
+    size_t pending_capacity;
+    char *writing;           // Lot en cours d'écriture (thread de fond)
+    size_t writing_capacity;
+    size_t journal_size;     // Octets écrits dans le journal courant
+    time_t last_checkpoint;
+    pthread_mutex_t lock;
+    pthread_t thread;
+    int running;
+    int stop;
+} g_wal = { .fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint32_t wal_checksum(const unsigned char *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void wal_path(char *path, size_t size, const char *name, uint64_t generation) {
+    if (name != NULL) {
+        snprintf(path, size, "%s/%s", g_wal.dir, name);
+    } else {
+        snprintf(path, size, "%s/journal.%llu", g_wal.dir, (unsigned long long)generation);
+    }
+}
+
+// Écrit len octets en reprenant après les écritures partielles
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// ========== Ajout au journal ==========
+
+static void wal_push(WalOp op, const void **fields, const size_t *lens, int count) {
+    unsigned char record[WAL_RECORD_MAX];
+    WalRecord *header = (WalRecord *)record;
+    unsigned char *p = record + sizeof(WalRecord);
+
+    for (int i = 0; i < count; i++) {
+        size_t len = lens[i] > 255 ? 255 : lens[i];
+        *p++ = (unsigned char)len;
+        memcpy(p, fields[i], len);
+        p += len;
+    }
+    header->size = (uint16_t)(p - record);
+    header->op = (uint8_t)op;
+    header->field_count = (uint8_t)count;
+    header->checksum = wal_checksum(record + sizeof(header->checksum),
+                                    header->size - sizeof(header->checksum));
+
+    pthread_mutex_lock(&g_wal.lock);
+    if (g_wal.pending_len + header->size > g_wal.pending_capacity) {
+        size_t capacity = g_wal.pending_capacity > 0 ? g_wal.pending_capacity * 2 : 4096;
+        while (capacity < g_wal.pending_len + header->size) {
+            capacity *= 2;
+        }
+        char *grown = realloc(g_wal.pending, capacity);
+        if (grown == NULL) {
+            perror("Erreur realloc");
+            pthread_mutex_unlock(&g_wal.lock);
+            return;
+        }
+        g_wal.pending = grown;
+        g_wal.pending_capacity = capacity;
+    }
+    memcpy(g_wal.pending + g_wal.pending_len, record, header->size);
+    g_wal.pending_len += header->size;
+    pthread_mutex_unlock(&g_wal.lock);
+}
+
+// Journalise une opération ; l'appelant est dans la section d'écriture qui
+// vient de l'appliquer. arg2 peut être NULL.
+void wal_append(WalOp op, const char *arg1, const char *arg2) {
+    if (!g_wal.running) {
+        return;
+    }
+
+    const void *fields[WAL_MAX_FIELDS] = { arg1, arg2 != NULL ? arg2 : "" };
+    size_t lens[WAL_MAX_FIELDS] = { strlen(arg1), arg2 != NULL ? strlen(arg2) : 0 };
+    wal_push(op, fields, lens, WAL_MAX_FIELDS);
+}
+
+void wal_append_user(const char *username, const struct sockaddr_in *addr) {
+    if (!g_wal.running) {
+        return;
+    }
+
+    // Adresse IPv4 et port, dans l'ordre du réseau
+    unsigned char raw[6];
+    memcpy(raw, &addr->sin_addr.s_addr, 4);
+    memcpy(raw + 4, &addr->sin_port, 2);
+
+    const void *fields[WAL_MAX_FIELDS] = { username, raw };
+    size_t lens[WAL_MAX_FIELDS] = { strlen(username), sizeof(raw) };
+    wal_push(WAL_USER_ADD, fields, lens, WAL_MAX_FIELDS);
+}
+
+// ========== Écriture par lots et checkpoints ==========
+
+// Écrit et synchronise les opérations en attente dans le journal courant
+static void wal_flush(void) {
+    // Échanger les deux tampons : les workers continuent dans l'autre
+    pthread_mutex_lock(&g_wal.lock);
+    char *batch = g_wal.pending;
+    size_t batch_capacity = g_wal.pending_capacity;
+    size_t len = g_wal.pending_len;
+    g_wal.pending = g_wal.writing;
+    g_wal.pending_capacity = g_wal.writing_capacity;
+    g_wal.pending_len = 0;
+    pthread_mutex_unlock(&g_wal.lock);
+
+    g_wal.writing = batch;
+    g_wal.writing_capacity = batch_capacity;
+
+    if (len == 0) {
+        return;
+    }
+    if (write_all(g_wal.fd, g_wal.writing, len) == -1 || fdatasync(g_wal.fd) == -1) {
+        perror("Erreur écriture du journal");
+        return;
+    }
+    g_wal.journal_size += len;
+}
+
+static int journal_open(uint64_t generation) {
+    char path[512];
+    wal_path(path, sizeof(path), NULL, generation);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd == -1) {
+        perror(path);
+    }
+    return fd;
+}
+
+static void dir_sync(void) {
+    int fd = open(g_wal.dir, O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// Écrit la copie du segment comme checkpoint de la génération donnée,
+// puis supprime les journaux antérieurs
+static int checkpoint_write(const void *copy, size_t size, uint64_t generation) {
+    char tmp_path[512], path[512];
+    wal_path(tmp_path, sizeof(tmp_path), "checkpoint.tmp", 0);
+    wal_path(path, sizeof(path), "checkpoint", 0);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror(tmp_path);
+        return -1;
+    }
+
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = WAL_CHECKPOINT_MAGIC;
+    header.generation = generation;
+    header.size = size;
+
+    if (write_all(fd, &header, sizeof(header)) == -1 ||
+        write_all(fd, copy, size) == -1 || fsync(fd) == -1) {
+        perror("Erreur écriture du checkpoint");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    if (rename(tmp_path, path) == -1) {
+        perror("Erreur rename checkpoint");
+        return -1;
+    }
+    dir_sync();
+
+    // Générations antérieures, contiguës
+    for (uint64_t g = generation; g-- > 0; ) {
+        char old[512];
+        wal_path(old, sizeof(old), NULL, g);
+        if (unlink(old) == -1) {
+            break;
+        }
+    }
+    return 0;
+}
+
+// Copie le segment et ouvre la génération suivante du journal au même
+// point : les opérations journalisées avant la bascule sont dans la copie,
+// les suivantes dans le nouveau journal. Retourne la copie (à libérer).
+static void *checkpoint_snapshot(size_t *size, int *new_fd) {
+    SharedMemory *shm = g_wal.shm;
+    size_t total = shm->total_size;
+    void *copy = malloc(total);
+    if (copy == NULL) {
+        perror("Erreur malloc");
+        return NULL;
+    }
+
+    *new_fd = journal_open(g_wal.generation + 1);
+    if (*new_fd == -1) {
+        free(copy);
+        return NULL;
+    }
+
+    // Une écriture ajoute son opération au journal après avoir modifié le
+    // segment et avant shm_write_end : si le numéro de séquence n'a pas
+    // bougé, tout ce qui est dans le tampon est dans la copie et rien de
+    // plus. Après quelques essais, prendre le verrou.
+    int locked = 0;
+    for (int attempt = 0; ; attempt++) {
+        uint32_t seq = 0;
+        if (attempt < 3) {
+            seq = shm_read_begin(shm);
+        } else {
+            locked = shm_lock(shm) == 0;
+        }
+        memcpy(copy, shm, total);
+
+        pthread_mutex_lock(&g_wal.lock);
+        if (attempt >= 3 || !shm_read_retry(shm, seq)) {
+            break;
+        }
+        pthread_mutex_unlock(&g_wal.lock);
+    }
+
+    // Bascule : le tampon en attente termine l'ancien journal
+    char *tail = g_wal.pending;
+    size_t tail_len = g_wal.pending_len;
+    g_wal.pending = NULL;
+    g_wal.pending_len = 0;
+    g_wal.pending_capacity = 0;
+    int old_fd = g_wal.fd;
+    g_wal.fd = *new_fd;
+    g_wal.generation++;
+    pthread_mutex_unlock(&g_wal.lock);
+    if (locked) {
+        shm_unlock(shm);
+    }
+
+    if (tail_len > 0 && (write_all(old_fd, tail, tail_len) == -1 || fdatasync(old_fd) == -1)) {
+        perror("Erreur écriture du journal");
+    }
+    close(old_fd);
+    free(tail);
+
+    *size = total;
+    return copy;
+}
+
+static void wal_checkpoint(void) {
+    size_t size;
+    int new_fd;
+    void *copy = checkpoint_snapshot(&size, &new_fd);
+    if (copy == NULL) {
+        return;
+    }
+
+    if (checkpoint_write(copy, size, g_wal.generation) == 0) {
+        g_wal.journal_size = 0;
+    }
+    g_wal.last_checkpoint = time(NULL);
+    free(copy);
+}
+
+static void *wal_run(void *arg) {
+    (void)arg;
+    struct timespec pause = { 0, WAL_SYNC_INTERVAL_MS * 1000000L };
+
+    while (!__atomic_load_n(&g_wal.stop, __ATOMIC_ACQUIRE)) {
+        nanosleep(&pause, NULL);
+        wal_flush();
+
+        if (g_wal.journal_size >= WAL_CHECKPOINT_BYTES ||
+            (g_wal.journal_size > 0 && time(NULL) - g_wal.last_checkpoint >= WAL_CHECKPOINT_INTERVAL)) {
+            wal_checkpoint();
+        }
+    }
+
+    // Dernier lot : les workers sont arrêtés
+    wal_flush();
+    return NULL;
+}
+
+// ========== Démarrage et reprise ==========
+
+// Lit l'en-tête du checkpoint ; retourne le descripteur ouvert ou -1
+static int checkpoint_open(CheckpointHeader *header) {
+    char path[512];
+    wal_path(path, sizeof(path), "checkpoint", 0);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    if (read(fd, header, sizeof(*header)) != sizeof(*header) ||
+        header->magic != WAL_CHECKPOINT_MAGIC) {
+        fprintf(stderr, "%s : checkpoint invalide\n", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int wal_replay_record(SharedMemory *shm, const WalRecord *rec) {
+    char fields[WAL_MAX_FIELDS][256];
+    size_t lens[WAL_MAX_FIELDS] = { 0, 0 };
+    const unsigned char *p = (const unsigned char *)(rec + 1);
+    const unsigned char *end = (const unsigned char *)rec + rec->size;
+
+    if (rec->field_count > WAL_MAX_FIELDS) {
+        return -1;
+    }
+    memset(fields, 0, sizeof(fields));
+    for (int i = 0; i < rec->field_count; i++) {
+        if (p >= end || p + 1 + *p > end) {
+            return -1;
+        }
+        lens[i] = *p;
+        memcpy(fields[i], p + 1, lens[i]);
+        p += 1 + lens[i];
+    }
+
+    const char *arg1 = fields[0];
+    const char *arg2 = fields[1];
+
+    switch ((WalOp)rec->op) {
+        case WAL_USER_ADD: {
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            if (lens[1] == 6) {
+                memcpy(&addr.sin_addr.s_addr, arg2, 4);
+                memcpy(&addr.sin_port, arg2 + 4, 2);
+            }
+            return user_add(shm, arg1, &addr, ntohs(addr.sin_port)) >= 0 ? 0 : -1;
+        }
+        case WAL_USER_REMOVE:
+            return user_remove(shm, arg1);
+        case WAL_GROUP_CREATE:
+            return group_create(shm, arg1, arg2[0] ? arg2 : NULL) >= 0 ? 0 : -1;
+        case WAL_GROUP_ADD_USER:
+            return group_add_user(shm, arg1, arg2);
+        case WAL_GROUP_REMOVE_USER:
+            return group_remove_user(shm, arg1, arg2);
+        case WAL_GROUP_MERGE:
+            return group_merge(shm, arg1, arg2);
+        case WAL_GROUP_ADD_ADMIN:
+            return group_add_admin(shm, group_find(shm, arg1), arg2);
+        case WAL_GROUP_REMOVE_ADMIN:
+            return group_remove_admin(shm, group_find(shm, arg1), arg2);
+        case WAL_GROUP_KICK:
+            return group_kick_user(shm, arg1, arg2);
+        case WAL_GROUP_COLOR: {
+            Group *group = group_find(shm, arg1);
+            if (group == NULL) {
+                return -1;
+            }
+            strncpy(group->color, arg2, sizeof(group->color) - 1);
+            group->color[sizeof(group->color) - 1] = '\0';
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Rejoue un journal ; retourne le nombre d'opérations ou -1 s'il n'existe pas
+static long wal_replay(SharedMemory *shm, uint64_t generation) {
+    char path[512];
+    wal_path(path, sizeof(path), NULL, generation);
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+
+    unsigned char record[WAL_RECORD_MAX];
+    WalRecord *header = (WalRecord *)record;
+    long count = 0;
+
+    while (fread(header, sizeof(WalRecord), 1, f) == 1) {
+        // Fin d'un lot interrompu par une panne : ignorer la suite
+        if (header->size < sizeof(WalRecord) || header->size > WAL_RECORD_MAX ||
+            fread(record + sizeof(WalRecord), header->size - sizeof(WalRecord), 1, f) != 1 ||
+            wal_checksum(record + sizeof(header->checksum),
+                         header->size - sizeof(header->checksum)) != header->checksum) {
+            fprintf(stderr, "%s : fin de journal incomplète ignorée\n", path);
+            break;
+        }
+        if (wal_replay_record(shm, header) == -1) {
+            fprintf(stderr, "%s : opération %d non rejouable\n", path, header->op);
+        }
+        count++;
+    }
+    fclose(f);
+    return count;
+}
+
+// Reconstruit l'état dans un segment neuf (initialisé par shm_layout_init
+// et mis à zéro) depuis le dernier checkpoint et les journaux suivants.
+// Retourne 1 si un état a été restauré, 0 s'il n'y a rien, -1 en cas d'erreur.
+int wal_recover(const char *dir, SharedMemory *shm) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    strncpy(g_wal.dir, dir, sizeof(g_wal.dir) - 1);
+
+    CheckpointHeader header;
+    int fd = checkpoint_open(&header);
+    if (fd == -1) {
+        return 0;
+    }
+
+    SharedMemory *copy = malloc(header.size);
+    if (copy == NULL) {
+        perror("Erreur malloc");
+        close(fd);
+        return -1;
+    }
+    ssize_t n = read(fd, copy, header.size);
+    close(fd);
+    if (n != (ssize_t)header.size || shm_layout_check(copy, header.size) == -1) {
+        fprintf(stderr, "Checkpoint de %s illisible\n", dir);
+        free(copy);
+        return -1;
+    }
+
+    int result = shm_migrate(shm, copy);
+    free(copy);
+    if (result == -1) {
+        return -1;
+    }
+
+    long operations = 0;
+    uint64_t generation = header.generation;
+    long replayed;
+    while ((replayed = wal_replay(shm, generation)) >= 0) {
+        operations += replayed;
+        generation++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("État restauré depuis %s/ : checkpoint %llu + %ld opération(s) en %.1f ms\n",
+           dir, (unsigned long long)header.generation, operations,
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    return 1;
+}
+
+// Écrit un checkpoint de l'état courant, ouvre un nouveau journal et
+// démarre le thread de fond. À appeler avant le démarrage des workers.
+int wal_start(const char *dir, SharedMemory *shm) {
+    strncpy(g_wal.dir, dir, sizeof(g_wal.dir) - 1);
+    g_wal.shm = shm;
+
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        perror(dir);
+        return -1;
+    }
+
+    // Génération suivant celle du checkpoint existant et de ses journaux
+    CheckpointHeader header;
+    uint64_t generation = 0;
+    int fd = checkpoint_open(&header);
+    if (fd >= 0) {
+        close(fd);
+        generation = header.generation;
+        char path[512];
+        do {
+            wal_path(path, sizeof(path), NULL, ++generation);
+        } while (access(path, F_OK) == 0);
+    }
+
+    if (checkpoint_write(shm, shm->total_size, generation) == -1) {
+        return -1;
+    }
+    g_wal.fd = journal_open(generation);
+    if (g_wal.fd == -1) {
+        return -1;
+    }
+    g_wal.generation = generation;
+    g_wal.journal_size = 0;
+    g_wal.last_checkpoint = time(NULL);
+    g_wal.stop = 0;
+
+    int err = pthread_create(&g_wal.thread, NULL, wal_run, NULL);
+    if (err != 0) {
+        fprintf(stderr, "Erreur pthread_create: %s\n", strerror(err));
+        close(g_wal.fd);
+        g_wal.fd = -1;
+        return -1;
+    }
+    g_wal.running = 1;
+    return 0;
+}
+
+// Écrit les dernières opérations et ferme le journal. À appeler une fois
+// les workers arrêtés.
+void wal_stop(void) {
+    if (g_wal.running) {
+        __atomic_store_n(&g_wal.stop, 1, __ATOMIC_RELEASE);
+        pthread_join(g_wal.thread, NULL);
+        g_wal.running = 0;
+    }
+    if (g_wal.fd >= 0) {
+        close(g_wal.fd);
+        g_wal.fd = -1;
+    }
+    free(g_wal.pending);
+    free(g_wal.writing);
+    g_wal.pending = NULL;
+    g_wal.writing = NULL;
+    g_wal.pending_len = 0;
+    g_wal.pending_capacity = 0;
+    g_wal.writing_capacity = 0;
+}